@@ -0,0 +1,38 @@
+# - Find libdeflate
+# Find the native libdeflate includes and library
+# This module defines
+#  LIBDEFLATE_INCLUDE_DIRS, where to find libdeflate.h.
+#  LIBDEFLATE_LIBRARIES, libraries to link against to use libdeflate.
+#  LIBDEFLATE_FOUND, If false, do not try to use libdeflate.
+#
+# Search hint (in CMake or as an environment variable):
+#  LIBDEFLATE_ROOT, the libdeflate install directory root.
+
+
+
+set( LIBDEFLATE_INCLUDE_DIRS )
+find_path( LIBDEFLATE_INCLUDE_DIRS libdeflate.h
+    PATHS ${LIBDEFLATE_ROOT} ENV LIBDEFLATE_ROOT
+    PATH_SUFFIXES include
+)
+
+set( LIBDEFLATE_LIBRARIES )
+find_library( LIBDEFLATE_LIBRARIES
+    NAMES deflate libdeflate deflatestatic libdeflatestatic
+    PATHS ${LIBDEFLATE_ROOT} ENV LIBDEFLATE_ROOT
+    PATH_SUFFIXES lib
+)
+
+
+# handle the QUIETLY and REQUIRED arguments and set LIBDEFLATE_FOUND to TRUE if
+# all listed variables are TRUE
+include( FindPackageHandleStandardArgs )
+FIND_PACKAGE_HANDLE_STANDARD_ARGS( LIBDEFLATE
+    REQUIRED_VARS LIBDEFLATE_INCLUDE_DIRS LIBDEFLATE_LIBRARIES
+)
+
+
+mark_as_advanced(
+    LIBDEFLATE_INCLUDE_DIRS
+    LIBDEFLATE_LIBRARIES
+)
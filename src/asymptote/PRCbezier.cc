@@ -0,0 +1,302 @@
+/************
+*
+*   This file is part of a tool for producing 3D content in the PRC format.
+*   Copyright (C) 2008  Orest Shardt <shardtor (at) gmail dot com> and
+*                       Michail Vidiassov <master@iaas.msu.ru>
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU Lesser General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*************/
+
+#include "PRCbezier.h"
+#include <algorithm>
+#include <math.h>
+
+using std::vector;
+
+// times a span may be halved to approximate it
+static const unsigned int maximumHalvings = 6;
+
+// Insert knots into a B-spline of degree d with knots U and points of dim
+// doubles each, one after the other in P, until every knot of its domain
+// [U[d],U[n]] is there at least d times (Boehm's algorithm). The points of
+// each span [U[i],U[i+1]] of the domain are then P[i-d]...P[i], those of a
+// Bezier curve. False if U is not a knot vector for the points.
+static bool refineKnots(uint32_t d, vector<double> &U, vector<double> &P, size_t dim)
+{
+  size_t n = P.size()/dim;
+  if(U.size() != n+d+1)
+    return false;
+  for(size_t i = 1; i < U.size(); ++i)
+    if(!(U[i-1] <= U[i]))
+      return false;
+  const double a = U[d], b = U[n];
+  if(!(a < b))
+    return false;
+  vector<double> knots, Q;
+  for(size_t i = d; i <= n; ++i)
+    if(knots.empty() || U[i] != knots.back())
+      knots.push_back(U[i]);
+  for(size_t l = 0; l < knots.size(); ++l)
+  {
+    const double t = knots[l];
+    for(size_t s = std::upper_bound(U.begin(),U.end(),t)-std::lower_bound(U.begin(),U.end(),t);
+        s < d; ++s)
+    {
+      // the span [U[k],U[k+1]] of t, the last one for the end of the domain
+      const size_t k = (t < b ? std::upper_bound(U.begin(),U.end(),t) :
+                        std::lower_bound(U.begin(),U.end(),t))-U.begin()-1;
+      Q.resize((n+1)*dim);
+      std::copy(P.begin(),P.begin()+(k-d+1)*dim,Q.begin());
+      for(size_t i = k-d+1; i <= k; ++i)
+      {
+        const double alpha = (t-U[i])/(U[i+d]-U[i]);
+        for(size_t c = 0; c < dim; ++c)
+          Q[i*dim+c] = alpha*P[i*dim+c]+(1-alpha)*P[(i-1)*dim+c];
+      }
+      std::copy(P.begin()+k*dim,P.end(),Q.begin()+(k+1)*dim);
+      P.swap(Q);
+      U.insert(U.begin()+k+1,t);
+      ++n;
+    }
+  }
+  return true;
+}
+
+// raise a Bezier curve of degree d, P[0], P[stride]..., to degree 3
+static void elevateBezier(uint32_t d, PRCVector3d *P, size_t stride)
+{
+  for(; d < 3; ++d)
+  {
+    P[(d+1)*stride] = P[d*stride];
+    for(uint32_t i = d; i > 0; --i)
+      P[i*stride] = (double)i/(d+1)*P[(i-1)*stride]+(1-(double)i/(d+1))*P[i*stride];
+  }
+}
+
+// the Bernstein polynomials of degree d at s, B[0]...B[d]
+static void bernstein(uint32_t d, double s, double *B)
+{
+  B[0] = 1;
+  for(uint32_t k = 1; k <= d; ++k)
+  {
+    B[k] = s*B[k-1];
+    for(uint32_t j = k-1; j > 0; --j)
+      B[j] = (1-s)*B[j]+s*B[j-1];
+    B[0] *= 1-s;
+  }
+}
+
+// A rational Bezier patch of degree dU, dV, its homogeneous points Pw
+// (x*w, y*w, z*w, w), v varying fastest.
+class RationalPatch
+{
+  public:
+    RationalPatch(uint32_t dU, uint32_t dV) : dU(dU), dV(dV), Pw(4*(dU+1)*(dV+1)),
+      BU(dU+1), BV(dV+1) {}
+    double *point(uint32_t i, uint32_t j) { return &Pw[4*(i*(dV+1)+j)]; }
+    PRCVector3d evaluate(double s, double t)
+    {
+      bernstein(dU,s,&BU[0]);
+      bernstein(dV,t,&BV[0]);
+      double p[4] = {0,0,0,0};
+      for(uint32_t i = 0; i <= dU; ++i)
+        for(uint32_t j = 0; j <= dV; ++j)
+        {
+          const double b = BU[i]*BV[j];
+          const double *q = point(i,j);
+          for(int c = 0; c < 4; ++c)
+            p[c] += b*q[c];
+        }
+      return PRCVector3d(p[0]/p[3],p[1]/p[3],p[2]/p[3]);
+    }
+    // the halves at s = 1/2 into this, the lower one, and upper
+    void halveU(RationalPatch &upper) { halve(dU,4*(dV+1),dV+1,4,upper); }
+    void halveV(RationalPatch &upper) { halve(dV,4,dU+1,4*(dV+1),upper); }
+    const uint32_t dU, dV;
+    vector<double> Pw;
+  private:
+    // de Casteljau's algorithm on the curves of degree d with points at
+    // stride, count of them offset apart
+    void halve(uint32_t d, size_t stride, size_t count, size_t offset, RationalPatch &upper)
+    {
+      for(size_t l = 0; l < count; ++l)
+      {
+        double *P = &Pw[l*offset], *R = &upper.Pw[l*offset];
+        for(uint32_t k = 1; k <= d; ++k)
+        {
+          std::copy(P+d*stride,P+d*stride+4,R+(d-k+1)*stride);
+          for(uint32_t i = d; i >= k; --i)
+            for(int c = 0; c < 4; ++c)
+              P[i*stride+c] = 0.5*(P[i*stride+c]+P[(i-1)*stride+c]);
+        }
+        std::copy(P+d*stride,P+d*stride+4,R);
+      }
+    }
+    vector<double> BU, BV;
+};
+
+// turn Q[0],Q[stride]... at 0, 1/3, 2/3 and 1 into the points of the
+// cubic Bezier curve through them
+static void interpolateCubic(PRCVector3d *Q, size_t stride)
+{
+  const PRCVector3d q0 = Q[0], q1 = Q[stride], q2 = Q[2*stride], q3 = Q[3*stride];
+  Q[stride] = (-5*q0+18*q1-9*q2+2*q3)/6;
+  Q[2*stride] = (2*q0-9*q1+18*q2-5*q3)/6;
+}
+
+static PRCVector3d evaluateCubic(const PRCVector3d *P, double s, double t)
+{
+  double BU[4], BV[4];
+  bernstein(3,s,BU);
+  bernstein(3,t,BV);
+  PRCVector3d p(0.0,0.0,0.0);
+  for(uint32_t i = 0; i < 4; ++i)
+    for(uint32_t j = 0; j < 4; ++j)
+      p = p+(BU[i]*BV[j])*P[4*i+j];
+  return p;
+}
+
+// Add the patches standing for the rational patch over [u0,u1]x[v0,v1].
+// False if it cannot be approximated after halving it again.
+static bool addPatches(RationalPatch &rational, double u0, double u1, double v0, double v1,
+                       double tolerance, unsigned int halvings,
+                       vector<PRCbezierPatch> &patches)
+{
+  const uint32_t dU = rational.dU, dV = rational.dV;
+  const double w = rational.Pw[3];
+  bool polynomial = dU <= 3 && dV <= 3;
+  for(size_t i = 7; polynomial && i < rational.Pw.size(); i += 4)
+    polynomial = fabs(rational.Pw[i]-w) <= 1e-12*w;
+
+  PRCbezierPatch patch;
+  patch.u0 = u0;
+  patch.u1 = u1;
+  patch.v0 = v0;
+  patch.v1 = v1;
+  if(polynomial)
+  {
+    patch.degree = (dU == 1 && dV == 1) ? 1 : 3;
+    const uint32_t size = patch.degree+1;
+    for(uint32_t i = 0; i <= dU; ++i)
+      for(uint32_t j = 0; j <= dV; ++j)
+      {
+        const double *p = rational.point(i,j);
+        patch.point[i*size+j] = PRCVector3d(p[0]/p[3],p[1]/p[3],p[2]/p[3]);
+      }
+    if(patch.degree == 3)
+    {
+      for(uint32_t i = 0; i <= dU; ++i)
+        elevateBezier(dV,patch.point+i*size,1);
+      for(uint32_t j = 0; j < size; ++j)
+        elevateBezier(dU,patch.point+j,size);
+    }
+    patches.push_back(patch);
+    return true;
+  }
+
+  // the bicubic patch through the surface at a 4x4 grid, if it keeps
+  // within tolerance at a finer one
+  patch.degree = 3;
+  for(uint32_t i = 0; i < 4; ++i)
+    for(uint32_t j = 0; j < 4; ++j)
+      patch.point[4*i+j] = rational.evaluate(i/3.0,j/3.0);
+  for(uint32_t i = 0; i < 4; ++i)
+    interpolateCubic(patch.point+4*i,1);
+  for(uint32_t j = 0; j < 4; ++j)
+    interpolateCubic(patch.point+j,4);
+  double error = 0;
+  for(uint32_t i = 0; i <= 8 && error <= tolerance; ++i)
+    for(uint32_t j = 0; j <= 8 && error <= tolerance; ++j)
+    {
+      const PRCVector3d d = rational.evaluate(i/8.0,j/8.0)-evaluateCubic(patch.point,i/8.0,j/8.0);
+      error = std::max(error,sqrt(d.x*d.x+d.y*d.y+d.z*d.z));
+    }
+  if(error <= tolerance)
+  {
+    patches.push_back(patch);
+    return true;
+  }
+  if(halvings == maximumHalvings)
+    return false;
+
+  const double u = 0.5*(u0+u1), v = 0.5*(v0+v1);
+  RationalPatch upperU(dU,dV), upperV(dU,dV);
+  rational.halveU(upperU);
+  rational.halveV(upperV);
+  if(!addPatches(rational,u0,u,v0,v,tolerance,halvings+1,patches) ||
+     !addPatches(upperV,u0,u,v,v1,tolerance,halvings+1,patches))
+    return false;
+  upperU.halveV(upperV);
+  return addPatches(upperU,u,u1,v0,v,tolerance,halvings+1,patches) &&
+         addPatches(upperV,u,u1,v,v1,tolerance,halvings+1,patches);
+}
+
+bool splitNURBSSurface(uint32_t dU, uint32_t dV, uint32_t nU, uint32_t nV,
+                       const double cP[][3], const double *kU, const double *kV,
+                       const double *w, double tolerance,
+                       vector<PRCbezierPatch> &patches)
+{
+  patches.clear();
+  if(dU == 0 || dV == 0 || nU <= dU || nV <= dV)
+    return false;
+  // homogeneous points, in rows along v
+  vector<double> P(4*(size_t)nU*nV);
+  for(size_t i = 0; i < (size_t)nU*nV; ++i)
+  {
+    const double weight = w != NULL ? w[i] : 1;
+    if(!(weight > 0))
+      return false;
+    P[4*i] = weight*cP[i][0];
+    P[4*i+1] = weight*cP[i][1];
+    P[4*i+2] = weight*cP[i][2];
+    P[4*i+3] = weight;
+  }
+  // refine u with the rows as points, then v with the columns
+  vector<double> U(kU,kU+nU+dU+1), V(kV,kV+nV+dV+1);
+  if(!refineKnots(dU,U,P,4*(size_t)nV))
+    return false;
+  const size_t mU = P.size()/(4*nV);
+  vector<double> T(P.size());
+  for(size_t i = 0; i < mU; ++i)
+    for(size_t j = 0; j < nV; ++j)
+      std::copy(&P[4*(i*nV+j)],&P[4*(i*nV+j)]+4,&T[4*(j*mU+i)]);
+  if(!refineKnots(dV,V,T,4*mU))
+    return false;
+  const size_t mV = T.size()/(4*mU);
+
+  RationalPatch rational(dU,dV);
+  for(size_t s = dU; s < mU; ++s)
+  {
+    if(U[s] == U[s+1])
+      continue;
+    for(size_t t = dV; t < mV; ++t)
+    {
+      if(V[t] == V[t+1])
+        continue;
+      for(uint32_t i = 0; i <= dU; ++i)
+        for(uint32_t j = 0; j <= dV; ++j)
+        {
+          const double *p = &T[4*((t-dV+j)*mU+s-dU+i)];
+          std::copy(p,p+4,rational.point(i,j));
+        }
+      if(!addPatches(rational,U[s],U[s+1],V[t],V[t+1],tolerance,0,patches))
+      {
+        patches.clear();
+        return false;
+      }
+    }
+  }
+  return true;
+}
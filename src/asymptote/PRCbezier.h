@@ -0,0 +1,53 @@
+/************
+*
+*   This file is part of a tool for producing 3D content in the PRC format.
+*   Copyright (C) 2008  Orest Shardt <shardtor (at) gmail dot com> and
+*                       Michail Vidiassov <master@iaas.msu.ru>
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU Lesser General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*************/
+
+#ifndef __PRC_BEZIER_H
+#define __PRC_BEZIER_H
+
+#include <vector>
+#include "writePRC.h"
+
+// A Bezier patch as compressed faces hold them, of degree 1 or 3 in u and
+// v, with the part [u0,u1]x[v0,v1] of the surface's domain it stands for.
+struct PRCbezierPatch
+{
+  uint32_t degree;
+  double u0, u1, v0, v1;
+  PRCVector3d point[16]; // (degree+1)^2 of them, v varying fastest
+};
+
+// Split a NURBS surface of degree dU, dV with nU x nV points, v varying
+// fastest, knots kU and kV and weights w (NULL if not rational) into
+// Bezier patches. The knot vectors need not be clamped: the domain is
+// [kU[dU],kU[nU]]x[kV[dV],kV[nV]], as for closed and periodic surfaces.
+// The spans of the surface give exact patches when it has degree at most
+// 3 and the same weight for all the points of the span: bilinear ones for
+// degree 1 in u and v, else bicubic. Other spans, rational or of higher
+// degree, are approximated by bicubic patches interpolating the surface,
+// halved until they are within tolerance of it on a grid of points. False
+// for weights that are not positive, knots that are not a knot vector,
+// or a span that still needs halving after six times.
+bool splitNURBSSurface(uint32_t dU, uint32_t dV, uint32_t nU, uint32_t nV,
+                       const double cP[][3], const double *kU, const double *kV,
+                       const double *w, double tolerance,
+                       std::vector<PRCbezierPatch> &patches);
+
+#endif // __PRC_BEZIER_H
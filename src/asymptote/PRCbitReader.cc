@@ -0,0 +1,230 @@
+/************
+*
+*   This file is part of a tool for producing 3D content in the PRC format.
+*   Copyright (C) 2008  Orest Shardt <shardtor (at) gmail dot com> and
+*                       Michail Vidiassov <master@iaas.msu.ru>
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU Lesser General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*************/
+
+#include <iostream>
+#include <vector>
+#include <string.h>
+#include "PRCbitReader.h"
+#include "PRCdouble.h"
+#include "PRCdoubleTables.h"
+
+using std::string;
+using std::cerr;
+using std::endl;
+
+void PRCbitReader::refill()
+{
+  if(byteIndex+8 <= size)
+  {
+    // load a big endian word; of its bytes, those that fit entirely are
+    // counted, the bits of the others are only a preview
+    const uint8_t *p = data+byteIndex;
+    const uint64_t word =
+      ((uint64_t)p[0] << 56) | ((uint64_t)p[1] << 48) | ((uint64_t)p[2] << 40) | ((uint64_t)p[3] << 32) |
+      ((uint64_t)p[4] << 24) | ((uint64_t)p[5] << 16) | ((uint64_t)p[6] << 8) | (uint64_t)p[7];
+    window |= word >> windowBits;
+    byteIndex += (63-windowBits) >> 3;
+    windowBits |= 56;
+  }
+  else
+  {
+    while(windowBits <= 56)
+    {
+      const uint64_t byte = byteIndex < size ? data[byteIndex] : 0;
+      window |= byte << (56-windowBits);
+      ++byteIndex;
+      windowBits += 8;
+    }
+  }
+}
+
+PRCbitReader& PRCbitReader::operator >>(bool &b)
+{
+  b = readBits(1) != 0;
+  return *this;
+}
+
+PRCbitReader& PRCbitReader::operator >>(uint32_t &u)
+{
+  // a 1 bit followed by a byte, until a 0 bit
+  uint64_t value = 0;
+  for(unsigned int shift = 0;; shift += 8)
+  {
+    const uint32_t chunk = peekBits(9);
+    if((chunk & 0x100) == 0)
+    {
+      skipBits(1);
+      break;
+    }
+    skipBits(9);
+    if(shift < 32)
+      value |= (uint64_t)(chunk & 0xFF) << shift;
+  }
+  u = (uint32_t)value;
+  return *this;
+}
+
+PRCbitReader& PRCbitReader::operator >>(uint8_t &u)
+{
+  u = readBits(8);
+  return *this;
+}
+
+PRCbitReader& PRCbitReader::operator >>(int32_t &i)
+{
+  // as unsigned integers, with the sign of the last byte extended
+  uint64_t value = 0;
+  uint32_t lastByte = 0;
+  unsigned int shift = 0;
+  for(;; shift += 8)
+  {
+    const uint32_t chunk = peekBits(9);
+    if((chunk & 0x100) == 0)
+    {
+      skipBits(1);
+      break;
+    }
+    skipBits(9);
+    lastByte = chunk & 0xFF;
+    if(shift < 64)
+      value |= (uint64_t)lastByte << shift;
+  }
+  if((lastByte & 0x80) != 0 && shift < 64)
+    value |= ~(uint64_t)0 << shift;
+  i = (int32_t)(uint32_t)value;
+  return *this;
+}
+
+// index into acofdoe of the code at the start of the stream, or -1
+static int decodeDoubleCode(PRCbitReader &in)
+{
+  const PRCdoubleCode *code = &prcDoubleDecodeTable[in.peekBits(PRC_DOUBLE_PRIMARY_BITS)];
+  if(code->secondaryBits != 0)
+    code = &prcDoubleDecodeTable[code->value + (in.peekBits(PRC_DOUBLE_PRIMARY_BITS+code->secondaryBits) & ((1 << code->secondaryBits)-1))];
+  if(code->length == 0)
+    return -1;
+  in.skipBits(code->length);
+  return code->value;
+}
+
+PRCbitReader& PRCbitReader::operator >>(double &value)
+{
+  const int index = decodeDoubleCode(*this);
+  if(index < 0)
+  {
+    cerr << "Invalid double code." << endl;
+    value = 0;
+    return *this;
+  }
+  const sCodageOfFrequentDoubleOrExponent &cofdoe = acofdoe[index];
+  // zero is written without a sign
+  if(cofdoe.Type == VT_double && cofdoe.u2uod.Value == 0)
+  {
+    value = 0;
+    return *this;
+  }
+  const uint32_t negative = readBits(1);
+  if(cofdoe.Type == VT_double)
+  {
+    value = negative ? -cofdoe.u2uod.Value : cofdoe.u2uod.Value;
+    return *this;
+  }
+
+  const uint32_t exponent = EXPONENT(cofdoe.u2uod.Value);
+  // the bytes of the double from the most significant one: sign and
+  // exponent, exponent and the upper 4 bits of the mantissa, then the
+  // other 6 bytes of the mantissa
+  uint8_t b[8];
+  b[0] = (negative << 7) | (exponent >> 4);
+  if(readBits(1) == 0)
+  {
+    // zero mantissa
+    b[1] = (exponent & 0x0F) << 4;
+    memset(b+2,0,6);
+  }
+  else
+  {
+    b[1] = ((exponent & 0x0F) << 4) | readBits(4);
+    for(unsigned int i = 2; i < 8; ++i)
+    {
+      // 1 then the byte, or 0 then 3 bits: the distance back to an equal
+      // mantissa byte, 0 if the remaining bytes repeat the previous one,
+      // or 6 if they do except the last one, which follows
+      const uint32_t token = peekBits(9);
+      if((token & 0x100) != 0)
+      {
+        skipBits(9);
+        b[i] = token & 0xFF;
+        continue;
+      }
+      skipBits(4);
+      const uint32_t distance = token >> 5;
+      if(distance == 0 || distance == 6)
+      {
+        for(unsigned int j = i; j < 7; ++j)
+          b[j] = b[i-1];
+        b[7] = (distance == 6) ? (uint8_t)readBits(8) : b[i-1];
+        break;
+      }
+      if(distance > i-2)
+      {
+        cerr << "Invalid double mantissa." << endl;
+        b[i] = 0;
+      }
+      else
+        b[i] = b[i-distance];
+    }
+  }
+  uint64_t bits = 0;
+  for(unsigned int i = 0; i < 8; ++i)
+    bits = (bits << 8) | b[i];
+  memcpy(&value,&bits,sizeof(value));
+  return *this;
+}
+
+PRCbitReader& PRCbitReader::operator >>(string &s)
+{
+  bool isNotNull;
+  *this >> isNotNull;
+  s.clear();
+  if(!isNotNull)
+    return *this;
+  uint32_t l;
+  *this >> l;
+  s.reserve(l);
+  for(uint32_t i = 0; i < l && !overrun(); ++i)
+    s.push_back((char)readBits(8));
+  return *this;
+}
+
+struct sCodageOfFrequentDoubleOrExponent* getcofdoe(unsigned Bits, short NumberOfBits)
+{
+  if(NumberOfBits <= 0 || NumberOfBits > 2*PRC_DOUBLE_PRIMARY_BITS)
+    return NULL;
+  // look the code up as the start of a stream of 22 bits
+  const uint32_t stream = (uint32_t)Bits << (2*PRC_DOUBLE_PRIMARY_BITS-NumberOfBits);
+  const PRCdoubleCode *code = &prcDoubleDecodeTable[stream >> PRC_DOUBLE_PRIMARY_BITS];
+  if(code->secondaryBits != 0)
+    code = &prcDoubleDecodeTable[code->value + ((stream >> (PRC_DOUBLE_PRIMARY_BITS-code->secondaryBits)) & ((1 << code->secondaryBits)-1))];
+  if(code->length != NumberOfBits || acofdoe[code->value].Bits != Bits)
+    return NULL;
+  return acofdoe+code->value;
+}
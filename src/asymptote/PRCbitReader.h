@@ -0,0 +1,82 @@
+/************
+*
+*   This file is part of a tool for producing 3D content in the PRC format.
+*   Copyright (C) 2008  Orest Shardt <shardtor (at) gmail dot com> and
+*                       Michail Vidiassov <master@iaas.msu.ru>
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU Lesser General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*************/
+
+#ifndef __PRC_BIT_READER_H
+#define __PRC_BIT_READER_H
+
+#include "PRCbitStream.h"
+
+// Reads back what PRCbitStream writes, from uncompressed data. The data
+// is consumed through a 64 bit window refilled a word at a time, and
+// compressed doubles are decoded with a lookup table over acofdoe.
+// Reading past the end yields zero bits and sets the overrun flag.
+class PRCbitReader
+{
+  public:
+    PRCbitReader(const uint8_t *data, unsigned int size) : data(data), size(size),
+                 byteIndex(0), window(0), windowBits(0) {}
+
+    PRCbitReader& operator >>(bool&);
+    PRCbitReader& operator >>(uint32_t&);
+    PRCbitReader& operator >>(uint8_t&);
+    PRCbitReader& operator >>(int32_t&);
+    // -0.0 is written as 0.0 and read back as such
+    PRCbitReader& operator >>(double&);
+    // a NULL string is read as an empty one
+    PRCbitReader& operator >>(std::string&);
+
+    // position in bits from the start of the data
+    unsigned int getPosition() const { return 8*byteIndex-windowBits; }
+    bool overrun() const { return getPosition() > 8*size; }
+
+    // the next bits, most significant first, at most 56 at a time
+    uint64_t peekBits(uint8_t bits)
+    {
+      if(bits == 0)
+        return 0;
+      if(windowBits < bits)
+        refill();
+      return window >> (64-bits);
+    }
+    void skipBits(uint8_t bits)
+    {
+      if(windowBits < bits)
+        refill();
+      window <<= bits;
+      windowBits -= bits;
+    }
+    uint64_t readBits(uint8_t bits)
+    {
+      const uint64_t value = peekBits(bits);
+      skipBits(bits);
+      return value;
+    }
+  private:
+    void refill();
+
+    const uint8_t *data;
+    unsigned int size;
+    unsigned int byteIndex; // next byte to enter the window
+    uint64_t window;        // next bits, left aligned
+    uint8_t windowBits;     // number of valid bits in the window
+};
+
+#endif // __PRC_BIT_READER_H
@@ -24,66 +24,239 @@
 #include <stdlib.h>
 #include <string.h>
 #include <cassert>
+#include <chrono>
 #include "PRCbitStream.h"
 #include "PRCdouble.h"
+#include "PRCdoubleTables.h"
+#include "PRCcompress.h"
+#include "PRCbufferPool.h"
+#include "PRCparallel.h"
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 using std::string;
 using std::cerr;
 using std::endl;
 
-void PRCbitStream::compress()
+// uncompressed bytes collected before they are handed to deflate
+#define STREAM_CHUNK_SIZE (256*1024)
+
+PRCbitStream::~PRCbitStream()
 {
-  const int CHUNK= 1024; // is this reasonable?
-  compressedDataSize = 0;
+  if(stream != NULL)
+  {
+    deflateEnd(stream);
+    delete stream;
+    releaseBuffer(streamOutput,streamOutputLength);
+  }
+  releaseBuffer(data,allocatedLength);
+  data = NULL;
+  setDoubleCache(false);
+}
 
-  z_stream strm;
-  strm.zalloc = Z_NULL;
-  strm.zfree = Z_NULL;
-  strm.opaque = Z_NULL;
-  if(deflateInit(&strm,Z_DEFAULT_COMPRESSION) != Z_OK)
+void PRCbitStream::releaseBuffer(uint8_t *buffer, unsigned int capacity)
+{
+  if(pool != NULL)
+    pool->release(buffer,capacity);
+  else
+    free(buffer);
+}
+
+static double seconds()
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void PRCbitStream::setStreamingCompression(bool streaming, int level, int strategy)
+{
+  if(streaming == (stream != NULL))
+    return;
+  if(compressed || byteIndex != 0 || bitCount != 0)
+  {
+    cerr << "Streaming compression has to be set before writing." << endl;
+    return;
+  }
+  if(!streaming)
+  {
+    deflateEnd(stream);
+    delete stream;
+    stream = NULL;
+    releaseBuffer(streamOutput,streamOutputLength);
+    streamOutput = NULL;
+    return;
+  }
+  stream = new z_stream;
+  stream->zalloc = Z_NULL;
+  stream->zfree = Z_NULL;
+  stream->opaque = Z_NULL;
+  if(deflateInit2(stream,level,Z_DEFLATED,MAX_WBITS,8,strategy) != Z_OK)
   {
     cerr << "Compression initialization failed" << endl;
+    delete stream;
+    stream = NULL;
+    return;
+  }
+  if(pool != NULL)
+  {
+    size_t capacity;
+    streamOutput = pool->acquire(CHUNK_SIZE,capacity);
+    streamOutputLength = capacity;
+  }
+  else
+  {
+    streamOutputLength = CHUNK_SIZE;
+    streamOutput = (uint8_t*) malloc(streamOutputLength);
+  }
+  stream->next_out = (Bytef*)streamOutput;
+  stream->avail_out = streamOutputLength;
+}
+
+void PRCbitStream::setCounting(bool count)
+{
+  if(count == counting)
     return;
+  if(compressed || stream != NULL || byteIndex != 0 || bitCount != 0)
+  {
+    cerr << "Counting has to be set before writing." << endl;
+    return;
+  }
+  counting = count;
+}
+
+const char* PRCentityStatistics::getPartName(unsigned int part)
+{
+  static const char *names[NumberOfParts] = { "names", "attributes", "graphics",
+    "coordinates", "normals", "texture coordinates", "indices", "colours",
+    "compressed faces" };
+  return part < NumberOfParts ? names[part] : "";
+}
+
+const char* PRCentityStatistics::getDoubleEncodingName(unsigned int encoding)
+{
+  static const char *names[NumberOfDoubleEncodings] = { "zero", "table",
+    "exponent", "mantissa" };
+  return encoding < NumberOfDoubleEncodings ? names[encoding] : "";
+}
+
+void PRCentityStatistics::add(const PRCentityStatistics &statistics)
+{
+  for(EntryMap::const_iterator it = statistics.entries.begin(); it != statistics.entries.end(); ++it)
+  {
+    Entry &entry = entries[it->first];
+    entry.count += it->second.count;
+    entry.bits += it->second.bits;
+  }
+  for(unsigned int i = 0; i < NumberOfParts; ++i)
+  {
+    parts[i].count += statistics.parts[i].count;
+    parts[i].bits += statistics.parts[i].bits;
   }
-  unsigned int sizeAvailable = deflateBound(&strm,getSize());
-  uint8_t *compressedData = (uint8_t*) malloc(sizeAvailable);
-  strm.avail_in = getSize();
-  strm.next_in = (unsigned char*)data;
-  strm.next_out = (unsigned char*)compressedData;
-  strm.avail_out = sizeAvailable;
+  for(unsigned int i = 0; i < NumberOfDoubleEncodings; ++i)
+    doubles[i] += statistics.doubles[i];
+}
+
+void PRCentityStatistics::begin(uint64_t position)
+{
+  const Open open = { 0, position, 0 };
+  stack.push_back(open);
+  typePending = true;
+}
+
+void PRCentityStatistics::end(uint64_t position)
+{
+  if(stack.empty())
+    return;
+  const Open open = stack.back();
+  stack.pop_back();
+  typePending = false;
+  const uint64_t bits = position - open.start;
+  Entry &entry = entries[open.type];
+  ++entry.count;
+  entry.bits += bits - open.nested;
+  if(!stack.empty())
+    stack.back().nested += bits;
+}
 
+void PRCbitStream::deflateBytes(unsigned int size, bool finish)
+{
+  const double start = seconds();
+  stream->next_in = (Bytef*)data;
+  stream->avail_in = size;
   int code;
-  unsigned int chunks = 0;
-  while((code = deflate(&strm,Z_FINISH)) == Z_OK)
+  do
   {
-    ++chunks;
-    // strm.avail_out should be 0 if we got Z_OK
-    compressedDataSize = sizeAvailable - strm.avail_out;
-    compressedData = (uint8_t*) realloc(compressedData,CHUNK*chunks);
-    strm.next_out = (Bytef*)(compressedData + compressedDataSize);
-    strm.avail_out += CHUNK;
-    sizeAvailable += CHUNK;
+    if(stream->avail_out == 0)
+    {
+      // the output buffer is full: double it
+      streamOutput = (uint8_t*) realloc(streamOutput,2*streamOutputLength);
+      if(streamOutput == NULL)
+      {
+        cerr << "Memory allocation error." << endl;
+        exit(1);
+      }
+      stream->next_out = (Bytef*)(streamOutput + streamOutputLength);
+      stream->avail_out = streamOutputLength;
+      streamOutputLength *= 2;
+    }
+    code = deflate(stream,finish ? Z_FINISH : Z_NO_FLUSH);
+    if(code == Z_STREAM_ERROR)
+    {
+      cerr << "Compression error" << endl;
+      exit(1);
+    }
   }
-  compressedDataSize = sizeAvailable-strm.avail_out;
+  while(stream->avail_in != 0 || stream->avail_out == 0 || (finish && code != Z_STREAM_END));
+  streamedSize += size;
+  compressionTime += seconds() - start;
+}
 
-  if(code != Z_STREAM_END)
+void PRCbitStream::compress(int level, int strategy, unsigned int threads)
+{
+  if(counting)
   {
-    cerr << "Compression error" << endl;
-    deflateEnd(&strm);
-    free(compressedData);
+    cerr << "Cannot compress a counting stream." << endl;
     return;
   }
+  getData(); // store pending bits
+  uncompressedDataSize = getSize();
+
+  if(stream != NULL)
+  {
+    // level and strategy were set when streaming started
+    deflateBytes(byteIndex+1,true);
+    compressedDataSize = stream->total_out;
+    deflateEnd(stream);
+    delete stream;
+    stream = NULL;
+    compressed = true;
+    releaseBuffer(data,allocatedLength);
+    data = streamOutput;
+    allocatedLength = streamOutputLength;
+    streamOutput = NULL;
+    return;
+  }
+
+  const double start = seconds();
+  uint8_t *compressedData = NULL;
+  if(!compressData(data,uncompressedDataSize,compressedData,compressedDataSize,level,strategy,threads))
+    return;
+  compressionTime = seconds() - start;
 
   compressed = true;
 
-  free(data);
+  releaseBuffer(data,allocatedLength);
   data = compressedData;
-
-  deflateEnd(&strm);
+  allocatedLength = compressedDataSize;
 }
 
 void PRCbitStream::write(std::ostream &out) const
 {
+  if(compressed && data == NULL)
+  {
+    cerr << "Attempt to write stream data that has been handed over." << endl;
+    exit(1);
+  }
   if(compressed)
   {
     out.write((char*)data,compressedDataSize);
@@ -95,16 +268,42 @@ void PRCbitStream::write(std::ostream &out) const
   }
 }
 
+uint8_t* PRCbitStream::takeData(unsigned int &capacity, PRCbufferPool *&from)
+{
+  if(!compressed || data == NULL)
+  {
+    cerr << "Attempt to hand over stream data before compression." << endl;
+    exit(1);
+  }
+  uint8_t *taken = data;
+  capacity = allocatedLength;
+  from = pool;
+  data = NULL;
+  allocatedLength = 0;
+  return taken;
+}
+
+unsigned int PRCbitStream::getUncompressedSize() const
+{
+  return compressed ? uncompressedDataSize : getSize();
+}
+
 unsigned int PRCbitStream::getSize() const
 {
   if(compressed)
     return compressedDataSize;
   else
-    return byteIndex+1;
+    return streamedSize+byteIndex+(bitCount>>3)+1;
 }
 
 uint8_t* PRCbitStream::getData()
 {
+  if(!compressed && !counting)
+  {
+    flushBytes();
+    // the last, partially filled, byte is padded with zeros
+    data[byteIndex] = (bitCount == 0) ? 0 : (uint8_t)(bitBuffer << (8-bitCount));
+  }
   return data;
 }
 
@@ -114,16 +313,59 @@ PRCbitStream& PRCbitStream::operator <<(bool b)
   return *this;
 }
 
+// number of significant bits of u, 0 for 0
+static inline unsigned int bitLength(uint32_t u)
+{
+#if defined(__GNUC__)
+  return u == 0 ? 0 : 32-__builtin_clz(u);
+#elif defined(_MSC_VER)
+  unsigned long index;
+  return _BitScanReverse(&index,u) ? index+1 : 0;
+#else
+  unsigned int n = 0;
+  for(; u != 0; u >>= 1)
+    ++n;
+  return n;
+#endif
+}
+
+// The integer encodings are, for each of n bytes from the least
+// significant one, a 1 bit then the byte, and a final 0 bit: 9n+1 bits.
+// All four bytes are spread into 9 bit groups at once and the groups
+// past n shifted out.
+static inline uint64_t encodeBytes(uint32_t u, unsigned int n)
+{
+  const uint64_t groups =
+    ((uint64_t)(0x100|(u & 0xFF)) << 27) | ((uint64_t)(0x100|((u >> 8) & 0xFF)) << 18) |
+    ((uint64_t)(0x100|((u >> 16) & 0xFF)) << 9) | (uint64_t)(0x100|(u >> 24));
+  return (groups >> (9*(4-n))) << 1;
+}
+
+// bytes up to the most significant nonzero one
+static inline unsigned int unsignedBytes(uint32_t u)
+{
+  return (bitLength(u)+7) >> 3;
+}
+
 PRCbitStream& PRCbitStream::operator <<(uint32_t u)
 {
-  while(u != 0)
+  if(entities != NULL && entities->isTypePending())
+    entities->setType(u);
+  const unsigned int n = unsignedBytes(u);
+  writeBits(encodeBytes(u,n),9*n+1);
+  return *this;
+}
+
+void PRCbitStream::writeUnsignedIntegers(const uint32_t *values, size_t count)
+{
+  if(count != 0 && entities != NULL && entities->isTypePending())
+    entities->setType(values[0]);
+  for(size_t i = 0; i < count; ++i)
   {
-    writeBit(1);
-    writeByte(u & 0xFF);
-    u >>= 8;
+    const uint32_t u = values[i];
+    const unsigned int n = unsignedBytes(u);
+    writeBits(encodeBytes(u,n),9*n+1);
   }
-  writeBit(0);
-  return *this;
 }
 
 PRCbitStream& PRCbitStream::operator <<(uint8_t u)
@@ -134,252 +376,486 @@ PRCbitStream& PRCbitStream::operator <<(uint8_t u)
 
 PRCbitStream& PRCbitStream::operator <<(int32_t i)
 {
-  uint8_t lastByte = 0;
-  //while(!((current value is 0 and last byte was positive) OR (current value is -1 and last value was negative)))
-  while(!(((i == 0)&&((lastByte & 0x80)==0))||((i == -1)&&((lastByte & 0x80) != 0))))
-  {
-    writeBit(1);
-    lastByte = i & 0xFF;
-    writeByte(lastByte);
-    i >>= 8;
-  }
-  writeBit(0);
+  // bytes until the rest is the sign extension of the last one written,
+  // no byte at all for 0
+  const uint32_t u = (uint32_t)i;
+  const unsigned int n = (i == 0) ? 0 : (bitLength(i < 0 ? ~u : u) >> 3) + 1;
+  writeBits(encodeBytes(u,n),9*n+1);
   return *this;
 }
 
-PRCbitStream& PRCbitStream::operator <<(double value)
+// The bits of an encoded double, in at most two pieces that writeBits
+// takes, and how it was encoded, a PRCentityStatistics::DoubleEncoding.
+struct PRCencodedDouble
 {
-  // write a double
-  if(compressed)
+  uint64_t bits[2];
+  uint8_t length[2];
+  uint8_t encoding;
+};
+
+// Tokens being gathered: those that no longer fit one writeBits move to
+// the first piece.
+struct PRCdoubleTokens
+{
+  uint64_t first;
+  uint64_t pending;
+  unsigned int firstLength;
+  unsigned int count;
+};
+
+static inline void putToken(PRCdoubleTokens &tokens, uint64_t token, unsigned int bits)
+{
+  if(tokens.count+bits > 57)
   {
-    cerr << "Cannot write to a stream that has been compressed." << endl;
-    return *this;
+    tokens.first = tokens.pending;
+    tokens.firstLength = tokens.count;
+    tokens.pending = 0;
+    tokens.count = 0;
   }
-  union ieee754_double *pid=(union ieee754_double *)&value;
-  int
-        i,
-        fSaveAtEnd;
-        PRCbyte
-        *pb,
-        *pbStart,
-        *pbStop,
-        *pbEnd,
-        *pbResult,
-        bSaveAtEnd = 0;
-  struct sCodageOfFrequentDoubleOrExponent
-        cofdoe,
-        *pcofdoe;
-
-  cofdoe.u2uod.Value=value;
-  pcofdoe = (struct sCodageOfFrequentDoubleOrExponent *)bsearch(
-                           &cofdoe,
-                           acofdoe,
-                           sizeof(acofdoe)/sizeof(pcofdoe[0]),
-                           sizeof(pcofdoe[0]),
-                           stCOFDOECompare);
-
-  while(pcofdoe>acofdoe && EXPONENT(pcofdoe->u2uod.Value)==EXPONENT((pcofdoe-1)->u2uod.Value))
-    pcofdoe--;
-
-  assert(pcofdoe);
-  while(pcofdoe->Type==VT_double)
-  {
-    if(fabs(value)==pcofdoe->u2uod.Value)
-      break;
-    pcofdoe++;
-  }
-
-  for(i=1<<(pcofdoe->NumberOfBits-1);i>=1;i>>=1)
-    writeBit((pcofdoe->Bits&i)!=0);
-
-  if
-  (
-    !memcmp(&value,stadwZero,sizeof(value))
-    ||      !memcmp(&value,stadwNegativeZero,sizeof(value))
-  )
-    return *this;
-
-  writeBit(pid->ieee.negative);
+  tokens.pending = tokens.pending << bits | token;
+  tokens.count += bits;
+}
 
-  if(pcofdoe->Type==VT_double)
-    return *this;
+// The token for mantissa byte k: the distance back to the nearest equal
+// byte among bytes k+1 to 5, 0 then 3 bits, else 1 then the byte.
+static inline void putMantissaByte(PRCdoubleTokens &tokens, uint64_t bits, unsigned int k)
+{
+  const uint8_t b = (uint8_t)(bits >> 8*k);
+  for(unsigned int j = k+1; j <= 5; ++j)
+    if((uint8_t)(bits >> 8*j) == b)
+    {
+      putToken(tokens,j-k,4);
+      return;
+    }
+  putToken(tokens,0x100|b,9);
+}
 
-  if(pid->ieee.mantissa0==0 && pid->ieee.mantissa1==0)
+static inline void encodeDouble(uint64_t bits, PRCencodedDouble &encoded)
+{
+  const PRCdoubleCodeword &code = findDoubleCode(bits);
+  const uint64_t negative = bits >> 63;
+  encoded.bits[1] = 0;
+  encoded.length[1] = 0;
+  // zero has no sign
+  if((bits << 1) == 0)
   {
-    writeBit(0);
-    return *this;
+    encoded.bits[0] = code.bits;
+    encoded.length[0] = code.length;
+    encoded.encoding = PRCentityStatistics::DoubleZero;
+    return;
   }
-
-  writeBit(1);
-
-#ifdef WORDS_BIGENDIAN
-  pb=((PRCbyte *)&value)+1;
-#else
-  pb=((PRCbyte *)&value)+6;
-#endif
-  //add_bits((*pb)&0x0f,4 STAT_V STAT_DOUBLE);
-  writeBits((*pb)&0x0F,4);
-
-  NEXTBYTE(pb);
-  pbStart=pb;
-#ifdef WORDS_BIGENDIAN
-  pbEnd=
-  pbStop= ((PRCbyte *)(&value+1))-1;
-#else
-  pbEnd=
-  pbStop= ((PRCbyte *)&value);
-#endif
-
-  if((fSaveAtEnd=(*pbStop!=*BEFOREBYTE(pbStop)))!=0)
-    bSaveAtEnd=*pbEnd;
-  PREVIOUSBYTE(pbStop);
-
-  while(*pbStop==*BEFOREBYTE(pbStop))
-    PREVIOUSBYTE(pbStop);
-
-  for(;MOREBYTE(pb,pbStop);NEXTBYTE(pb))
+  if(code.value)
   {
-    if(pb!=pbStart && (pbResult=SEARCHBYTE(BEFOREBYTE(pb),*pb,DIFFPOINTERS(pb,pbStart)))!=NULL)
-    {
-      writeBit(0);
-      writeBits(DIFFPOINTERS(pb,pbResult),3);
-    }
-    else
-    {
-      writeBit(1);
-      writeByte(*pb);
-    }
+    encoded.bits[0] = (uint64_t)code.bits << 1 | negative;
+    encoded.length[0] = code.length+1;
+    encoded.encoding = PRCentityStatistics::DoubleTable;
+    return;
   }
-
-  if(!MOREBYTE(BEFOREBYTE(pbEnd),pbStop))
+  const uint64_t mantissa = bits & (((uint64_t)1 << 52)-1);
+  if(mantissa == 0)
   {
-    if(fSaveAtEnd)
-    {
-      writeBit(0);
-      writeBits(6,3);
-      writeByte(bSaveAtEnd);
-    }
+    encoded.bits[0] = (uint64_t)code.bits << 2 | negative << 1;
+    encoded.length[0] = code.length+2;
+    encoded.encoding = PRCentityStatistics::DoubleExponent;
+    return;
+  }
+  encoded.encoding = PRCentityStatistics::DoubleMantissa;
+  // the code, the sign, then 1 and the upper 4 bits of the mantissa
+  PRCdoubleTokens tokens;
+  tokens.first = 0;
+  tokens.firstLength = 0;
+  tokens.pending = (uint64_t)code.bits << 6 | negative << 5 | 0x10 | mantissa >> 48;
+  tokens.count = code.length+6;
+
+  // Bytes 5 down to 0 of the mantissa follow, least significant last.
+  // Bytes from stop down that repeat the one before need not be written.
+  unsigned int stop = 1;
+  while(stop < 6 && (uint8_t)(bits >> 8*stop) == (uint8_t)(bits >> 8*(stop+1)))
+    ++stop;
+  if(stop <= 5)
+    putToken(tokens,0x100|(uint8_t)(bits >> 40),9);
+  for(unsigned int k = 4; k+1 > stop; --k)
+    putMantissaByte(tokens,bits,k);
+  if(stop > 1)
+  {
+    const uint8_t last = (uint8_t)bits;
+    if(last != (uint8_t)(bits >> 8))
+      putToken(tokens,(6<<8)|last,12); // 0, 6 on 3 bits, then the byte
     else
-    {
-      writeBit(0);
-      writeBits(0,3);
-    }
+      putToken(tokens,0,4); // 0, 0 on 3 bits
   }
   else
+    putMantissaByte(tokens,bits,0);
+  if(tokens.firstLength != 0)
   {
-    if((pbResult=SEARCHBYTE(BEFOREBYTE(pb),*pb,DIFFPOINTERS(pb,pbStart)))!=NULL)
+    encoded.bits[0] = tokens.first;
+    encoded.length[0] = tokens.firstLength;
+    encoded.bits[1] = tokens.pending;
+    encoded.length[1] = tokens.count;
+  }
+  else
+  {
+    encoded.bits[0] = tokens.pending;
+    encoded.length[0] = tokens.count;
+  }
+}
+
+#define DOUBLE_CACHE_BITS 11
+
+class PRCdoubleCache
+{
+  public:
+    PRCdoubleCache() : hits(0), lookups(0)
     {
-      writeBit(0);
-      writeBits(DIFFPOINTERS(pb,pbResult),3);
+      memset(entries,0,sizeof(entries));
     }
-    else
+
+    // the encoding of the double with these bits
+    const PRCencodedDouble &encode(uint64_t bits)
     {
-      writeBit(1);
-      writeByte(*pb);
+      Entry &entry = entries[(bits * (uint64_t)0x9E3779B97F4A7C15ULL) >> (64-DOUBLE_CACHE_BITS)];
+      ++lookups;
+      // an empty entry has no bits
+      if(entry.key == bits && entry.encoded.length[0] != 0)
+        ++hits;
+      else
+      {
+        entry.key = bits;
+        encodeDouble(bits,entry.encoded);
+      }
+      return entry.encoded;
     }
+
+    uint64_t hits;
+    uint64_t lookups;
+  private:
+    struct Entry
+    {
+      uint64_t key;
+      PRCencodedDouble encoded;
+    };
+    Entry entries[1 << DOUBLE_CACHE_BITS];
+};
+
+// returns how the value was encoded, for the statistics
+static inline unsigned int writeDouble(PRCbitStream &out, PRCdoubleCache *cache, double value)
+{
+  uint64_t bits;
+  memcpy(&bits,&value,sizeof(bits));
+  if(cache != NULL)
+  {
+    const PRCencodedDouble &encoded = cache->encode(bits);
+    out.writeBits(encoded.bits[0],encoded.length[0]);
+    out.writeBits(encoded.bits[1],encoded.length[1]);
+    return encoded.encoding;
   }
+  PRCencodedDouble encoded;
+  encodeDouble(bits,encoded);
+  out.writeBits(encoded.bits[0],encoded.length[0]);
+  out.writeBits(encoded.bits[1],encoded.length[1]);
+  return encoded.encoding;
+}
 
+void PRCbitStream::setDoubleCache(bool cache)
+{
+  if(cache == (doubleCache != NULL))
+    return;
+  if(cache)
+    doubleCache = new PRCdoubleCache;
+  else
+  {
+    delete doubleCache;
+    doubleCache = NULL;
+  }
+}
+
+uint64_t PRCbitStream::getDoubleCacheHits() const
+{
+  return doubleCache != NULL ? doubleCache->hits : 0;
+}
+
+uint64_t PRCbitStream::getDoubleCacheLookups() const
+{
+  return doubleCache != NULL ? doubleCache->lookups : 0;
+}
+
+PRCbitStream& PRCbitStream::operator <<(double value)
+{
+  // write a double
+  if(compressed)
+  {
+    writeAfterCompression();
+    return *this;
+  }
+  const unsigned int encoding = writeDouble(*this,doubleCache,value);
+  if(entities != NULL)
+    ++entities->doubles[encoding];
   return *this;
 }
 
+void PRCbitStream::writeDoubles(const double *values, size_t count)
+{
+  if(compressed)
+  {
+    writeAfterCompression();
+    return;
+  }
+  if(entities != NULL)
+    for(size_t i = 0; i < count; ++i)
+      ++entities->doubles[writeDouble(*this,doubleCache,values[i])];
+  else
+    for(size_t i = 0; i < count; ++i)
+      writeDouble(*this,doubleCache,values[i]);
+}
+
 PRCbitStream& PRCbitStream::operator <<(const char* s)
 {
-  if (s == NULL)
+  if (s == NULL || *s == '\0')
   {
     writeBit(false); // string is NULL
     return *this;
   }
-  string str(s);
-  *this << str;
+  writeBit(true);
+  const size_t l = strlen(s);
+  *this << static_cast<uint32_t>(l);
+  writeBytes(reinterpret_cast<const uint8_t*>(s),l);
   return *this;
 }
 
 PRCbitStream& PRCbitStream::operator <<(const string& s)
 {
-  if(s == "")
+  if(s.empty())
   {
     writeBit(false); // string is NULL
     return *this;
   }
   writeBit(true);
-  size_t l = s.length();
+  const size_t l = s.length();
   *this << static_cast<uint32_t>(l);
-  for(size_t i = 0; i < l; ++i)
-    writeByte(s[i]);
+  writeBytes(reinterpret_cast<const uint8_t*>(s.data()),l);
   return *this;
 }
 
-void PRCbitStream::writeBit(bool b)
+void PRCbitStream::writeBytes(const uint8_t *bytes, size_t size)
 {
-  if(compressed)
+  flushBytes();
+  if(compressed || size == 0)
+    return;
+  if(counting)
   {
-    cerr << "Cannot write to a stream that has been compressed." << endl;
+    byteIndex += size;
     return;
   }
-
-  if(b)
+  // work in pieces so that streaming compression keeps its bounded window
+  while(size > 0)
   {
-    data[byteIndex] |= (0x80 >> bitIndex);
+    const size_t piece = size < STREAM_CHUNK_SIZE ? size : STREAM_CHUNK_SIZE;
+    reserve(piece);
+    uint8_t *p = data+byteIndex;
+    if(bitCount == 0)
+    {
+      memcpy(p,bytes,piece);
+      byteIndex += piece;
+    }
+    else
+    {
+      // shift 8 bytes at a time in behind the pending bits, whose place
+      // the low bits of the last byte shifted in take
+      const unsigned int shift = bitCount;
+      uint64_t carry = bitBuffer & (((uint64_t)1 << shift)-1);
+      size_t i = 0;
+      for(; i+8 <= piece; i += 8)
+      {
+        const uint8_t *b = bytes+i;
+        const uint64_t word = (uint64_t)b[0] << 56 | (uint64_t)b[1] << 48 |
+                              (uint64_t)b[2] << 40 | (uint64_t)b[3] << 32 |
+                              (uint64_t)b[4] << 24 | (uint64_t)b[5] << 16 |
+                              (uint64_t)b[6] << 8  | (uint64_t)b[7];
+        const uint64_t out = carry << (64-shift) | word >> shift;
+        p[i]   = (uint8_t)(out >> 56);
+        p[i+1] = (uint8_t)(out >> 48);
+        p[i+2] = (uint8_t)(out >> 40);
+        p[i+3] = (uint8_t)(out >> 32);
+        p[i+4] = (uint8_t)(out >> 24);
+        p[i+5] = (uint8_t)(out >> 16);
+        p[i+6] = (uint8_t)(out >> 8);
+        p[i+7] = (uint8_t)(out);
+        carry = word & (((uint64_t)1 << shift)-1);
+      }
+      byteIndex += i;
+      bitBuffer = carry;
+      // the remaining bytes, at most 7, in one go
+      uint64_t tail = 0;
+      for(size_t j = i; j < piece; ++j)
+        tail = tail << 8 | bytes[j];
+      writeBits(tail,(uint8_t)(8*(piece-i)));
+    }
+    bytes += piece;
+    size -= piece;
   }
-  nextBit();
 }
 
-void PRCbitStream::writeBits(uint32_t u, uint8_t bits)
+void PRCbitStream::append(const PRCbitStream &bits)
 {
-  if(bits > 32)
+  if(bits.compressed || bits.stream != NULL || bits.counting)
+  {
+    cerr << "Cannot append a compressed, streaming or counting stream." << endl;
     return;
-  else
+  }
+  writeBytes(bits.data,bits.byteIndex);
+  // the pending bits, in two parts if more than writeBits() takes
+  if(bits.bitCount > 32)
   {
-    for(uint32_t mask = (1 << (bits-1)); mask != 0; mask >>= 1)
-    {
-      writeBit((u&mask) != 0);
-    }
+    writeBits(bits.bitBuffer >> 32,bits.bitCount-32);
+    writeBits(bits.bitBuffer,32);
   }
+  else
+    writeBits(bits.bitBuffer,bits.bitCount);
 }
 
-void PRCbitStream::writeByte(uint8_t u)
+// writes a run of items to each stream
+class PRCitemRuns : public PRCparallelWork
 {
-  if(compressed)
+  public:
+    PRCitemRuns(PRCbitStreamItems &items, std::vector<PRCbitStream*> &runs, size_t run_length) :
+      items(items), runs(runs), run_length(run_length), first(0), end(0) {}
+    void run(size_t index)
+    {
+      const size_t begin = first+index*run_length;
+      const size_t stop = begin+run_length < end ? begin+run_length : end;
+      for(size_t i = begin; i < stop; ++i)
+        items.write(*runs[index],i);
+    }
+    PRCbitStreamItems &items;
+    std::vector<PRCbitStream*> &runs;
+    const size_t run_length;
+    size_t first, end; // items of the current round
+};
+
+void PRCbitStream::writeItems(PRCbitStreamItems &items, size_t count)
+{
+  const unsigned int n = threads == 0 ? getHardwareThreads() : threads;
+  if(n <= 1 || count < 2*(size_t)n || counting || entities != NULL || compressed)
   {
-    cerr << "Cannot write to a stream that has been compressed." << endl;
+    for(size_t i = 0; i < count; ++i)
+      items.write(*this,i);
     return;
   }
-
-  if(bitIndex == 0)
+  // Write in rounds of one run per thread, appending each round before
+  // the next, so that only a part of the items is held twice. The run
+  // streams are kept from round to round.
+  const size_t rounds = 8;
+  const size_t run_length = (count+rounds*n-1)/(rounds*n);
+  std::vector<uint8_t*> buffers(n,(uint8_t*)NULL);
+  std::vector<PRCbitStream*> runs(n);
+  for(unsigned int t = 0; t < n; ++t)
   {
-    data[byteIndex] = u;
-    nextByte();
+    runs[t] = new PRCbitStream(buffers[t],0,pool);
+    runs[t]->setDoubleCache(doubleCache != NULL);
   }
-  else
+  PRCitemRuns work(items,runs,run_length);
+  for(size_t first = 0; first < count; first += n*run_length)
   {
-    data[byteIndex] |= (u >> bitIndex);
-    unsigned int obi = bitIndex;
-    nextByte();
-    data[byteIndex] |= (u << (8-obi));
-    bitIndex = obi; // bit index is not changed by writing 8 bits
+    work.first = first;
+    work.end = first+n*run_length < count ? first+n*run_length : count;
+    const size_t round_runs = (work.end-first+run_length-1)/run_length;
+    runInParallel(work,round_runs,n);
+    for(size_t t = 0; t < round_runs; ++t)
+    {
+      append(*runs[t]);
+      runs[t]->bitBuffer = 0;
+      runs[t]->bitCount = 0;
+      runs[t]->byteIndex = 0;
+    }
   }
+  for(unsigned int t = 0; t < n; ++t)
+  {
+    if(doubleCache != NULL)
+    {
+      doubleCache->hits += runs[t]->doubleCache->hits;
+      doubleCache->lookups += runs[t]->doubleCache->lookups;
+    }
+    delete runs[t];
+  }
+}
+
+void PRCbitStream::writeBit(bool b)
+{
+  writeBits(b,1);
+}
+
+void PRCbitStream::writeByte(uint8_t u)
+{
+  writeBits(u,8);
+}
+
+void PRCbitStream::writeAfterCompression() const
+{
+  cerr << "Cannot write to a stream that has been compressed." << endl;
 }
 
-void PRCbitStream::nextBit()
+void PRCbitStream::flushBytes()
 {
-  ++bitIndex;
-  if(bitIndex == 8)
+  if(compressed)
   {
-    nextByte();
+    writeAfterCompression();
+    return;
   }
+  // store the complete bytes of the bit buffer as one big endian word,
+  // less than 8 bits remain in the buffer afterwards
+  const unsigned int bytes = bitCount >> 3;
+  if(bytes == 0)
+    return;
+  if(counting)
+  {
+    byteIndex += bytes;
+    bitCount &= 7;
+    return;
+  }
+  reserve(0);
+  const uint64_t word = bitBuffer << (64-bitCount);
+  uint8_t *p = data+byteIndex;
+  p[0] = (uint8_t)(word >> 56);
+  p[1] = (uint8_t)(word >> 48);
+  p[2] = (uint8_t)(word >> 40);
+  p[3] = (uint8_t)(word >> 32);
+  p[4] = (uint8_t)(word >> 24);
+  p[5] = (uint8_t)(word >> 16);
+  p[6] = (uint8_t)(word >> 8);
+  p[7] = (uint8_t)(word);
+  byteIndex += bytes;
+  bitCount &= 7;
 }
 
-void PRCbitStream::nextByte()
+void PRCbitStream::reserve(size_t bytes)
 {
-  ++byteIndex;
-  if(byteIndex >= allocatedLength)
+  if(stream != NULL && byteIndex >= STREAM_CHUNK_SIZE)
+  {
+    deflateBytes(byteIndex,false);
+    byteIndex = 0;
+  }
+  while(byteIndex+bytes+sizeof(bitBuffer) >= allocatedLength)
     getAChunk();
-  data[byteIndex] = 0; // clear the garbage data
-  bitIndex = 0;
 }
 
 void PRCbitStream::getAChunk()
 {
+   if(pool != NULL)
+   {
+     // move to a pooled buffer at least twice as large
+     size_t capacity;
+     uint8_t *grown = pool->acquire(allocatedLength==0 ? CHUNK_SIZE : 2*allocatedLength,capacity);
+     if(allocatedLength==0)
+       *grown = 0; // clear first byte
+     else
+     {
+       memcpy(grown,data,byteIndex);
+       pool->release(data,allocatedLength);
+     }
+     data = grown;
+     allocatedLength = capacity;
+     return;
+   }
    if(allocatedLength==0)
      data = (uint8_t*)realloc((void*)data,CHUNK_SIZE);
    else
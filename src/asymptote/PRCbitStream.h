@@ -33,31 +33,138 @@ typedef signed long int32_t;
 typedef unsigned char uint8_t;
 typedef unsigned short uint16_t;
 typedef unsigned long uint32_t;
+typedef signed __int64 int64_t;
+typedef unsigned __int64 uint64_t;
 #endif // _MSC_VER >= 1600
 #else
 #include <inttypes.h>
 #endif // _MSC_VER
 #include <string>
 #include <iostream>
+#include <vector>
+#include <map>
 #include <stdlib.h>
+#include <assert.h>
 
 #define CHUNK_SIZE (1024)
 // Is this a reasonable initial size?
 
+struct z_stream_s;
+class PRCbufferPool;
+class PRCdoubleCache;
+
+// Bits written by entities, by PRC type. An entity is what is written
+// within a PRCentityScope, its type the first unsigned integer it writes;
+// the bits of nested entities are only counted for these.
+class PRCentityStatistics
+{
+  public:
+    PRCentityStatistics() : typePending(false)
+    {
+      for(unsigned int i = 0; i < NumberOfDoubleEncodings; ++i)
+        doubles[i] = 0;
+    }
+    struct Entry
+    {
+      Entry() : count(0), bits(0) {}
+      uint64_t count;
+      uint64_t bits;
+    };
+    typedef std::map<uint32_t,Entry> EntryMap;
+    EntryMap entries;
+
+    // Parts of entities, counted wherever they are written, within
+    // PRCpartScope; a name within attributes counts for both.
+    enum Part { Names, Attributes, Graphics, Coordinates, Normals,
+                TextureCoordinates, Indices, Colours, CompressedFaces,
+                NumberOfParts };
+    Entry parts[NumberOfParts];
+    static const char* getPartName(unsigned int part);
+    // doubles written, by how they were encoded: zero, a value of the
+    // table, a power of two, with mantissa bytes
+    enum DoubleEncoding { DoubleZero, DoubleTable, DoubleExponent,
+                          DoubleMantissa, NumberOfDoubleEncodings };
+    uint64_t doubles[NumberOfDoubleEncodings];
+    static const char* getDoubleEncodingName(unsigned int encoding);
+
+    // add the counts of another
+    void add(const PRCentityStatistics &statistics);
+
+    void begin(uint64_t position);
+    void end(uint64_t position);
+    bool isTypePending() const { return typePending; }
+    void setType(uint32_t type) { stack.back().type = type; typePending = false; }
+  private:
+    struct Open
+    {
+      uint32_t type;
+      uint64_t start;
+      uint64_t nested;
+    };
+    std::vector<Open> stack;
+    bool typePending;
+};
+
+// What PRC entities last wrote to a stream: they write their name and
+// graphics only when these change. Every stream has its own, so that
+// each section starts afresh and sections can be written concurrently.
+class PRCSerializationContext
+{
+  public:
+    PRCSerializationContext() { reset(); }
+    void resetName() { name.clear(); }
+    void resetGraphics()
+    {
+      layer_index = (uint32_t)-1;
+      index_of_line_style = (uint32_t)-1;
+      behaviour_bit_field = 1;
+    }
+    void reset() { resetName(); resetGraphics(); }
+
+    std::string name;
+    uint32_t layer_index;
+    uint32_t index_of_line_style;
+    uint16_t behaviour_bit_field;
+};
+
+class PRCbitStream;
+
+// Items written one after the other, each of them without regard to what
+// was written before it: not through the PRCSerializationContext of the
+// stream, for instance. write() must be safe to call concurrently for
+// different items and streams.
+class PRCbitStreamItems
+{
+  public:
+    virtual ~PRCbitStreamItems() {}
+    virtual void write(PRCbitStream &out, size_t index) = 0;
+};
+
+// The stream owns its buffer, which has to come from malloc, and frees it
+// on destruction, or gives it back to the pool if it was given one; buff
+// follows the buffer and is set to NULL then.
 class PRCbitStream
 {
   public:
-    PRCbitStream(uint8_t*& buff, unsigned int l) : byteIndex(0), bitIndex(0),
-                 allocatedLength(l), data(buff), compressed(false)
+    PRCbitStream(uint8_t*& buff, unsigned int l, PRCbufferPool *pool=NULL) : bitBuffer(0), bitCount(0),
+                 byteIndex(0), allocatedLength(l), data(buff), compressed(false),
+                 compressedDataSize(0), uncompressedDataSize(0), compressionTime(0),
+                 stream(NULL), streamedSize(0),
+                 streamOutput(NULL), streamOutputLength(0), pool(pool),
+                 counting(false), entities(NULL), doubleCache(NULL), threads(1)
     {
       if(data == 0)
       {
         getAChunk();
       }
     }
+    ~PRCbitStream();
 
     unsigned int getSize() const;
     uint8_t* getData();
+    // size before compression, and the time spent in deflate in seconds
+    unsigned int getUncompressedSize() const;
+    double getCompressionTime() const { return compressionTime; }
 
     PRCbitStream& operator <<(const std::string&);
     PRCbitStream& operator <<(bool);
@@ -66,22 +173,155 @@ class PRCbitStream
     PRCbitStream& operator <<(int32_t);
     PRCbitStream& operator <<(double);
     PRCbitStream& operator <<(const char*);
+    // unsigned integers as operator<< writes them, in one call
+    void writeUnsignedIntegers(const uint32_t *values, size_t count);
+    void writeUnsignedIntegers(const std::vector<uint32_t> &values)
+    {
+      if(!values.empty())
+        writeUnsignedIntegers(&values[0],values.size());
+    }
+    // doubles as operator<< writes them
+    void writeDoubles(const double *values, size_t count);
+    void writeDoubles(const std::vector<double> &values)
+    {
+      if(!values.empty())
+        writeDoubles(&values[0],values.size());
+    }
+    // raw bytes, as that many operator<<(uint8_t) would write them
+    void writeBytes(const uint8_t *bytes, size_t size);
+    // the bits written to another stream, which must be neither
+    // compressed, streaming nor counting, at the current bit position
+    void append(const PRCbitStream &bits);
+    // Write items [0,count) in turn. With threads other than 1 set, runs
+    // of them are written to streams of their own concurrently and then
+    // appended here, with the same result.
+    void writeItems(PRCbitStreamItems &items, size_t count);
 
-    void compress();
+    // write the low "bits" bits of value, most significant first; bits <= 57
+    void writeBits(uint64_t value, uint8_t bits)
+    {
+      assert(bits <= 57);
+      if(compressed)
+      {
+        writeAfterCompression();
+        return;
+      }
+      if(bits == 0)
+        return;
+      if(bitCount+bits > 64)
+        flushBytes();
+      bitBuffer = (bitBuffer << bits) | (value & (((uint64_t)1 << bits)-1));
+      bitCount += bits;
+    }
+
+    // Hand completed bytes over to deflate while writing, so that only a
+    // bounded window of uncompressed data is kept in memory. Has to be set
+    // before anything is written. getSize() still reports the uncompressed
+    // size until compress(), but getData() then only holds the bytes not
+    // yet handed over.
+    void setStreamingCompression(bool streaming, int level=-1, int strategy=0);
+
+    // Only count what is written, without storing it, to learn the size
+    // of the data. Has to be set before anything is written; a counting
+    // stream has no data and cannot be compressed.
+    void setCounting(bool counting);
+    // number of bits written so far
+    uint64_t getBitCount() const { return 8*((uint64_t)streamedSize+byteIndex)+bitCount; }
+    // attribute the bits written to entity types, NULL to stop
+    void setEntityStatistics(PRCentityStatistics *statistics) { entities = statistics; }
+    PRCentityStatistics* getEntityStatistics() const { return entities; }
+    // Remember the encodings of recently written doubles, so that a value
+    // written again takes a single copy of its bits. The cache is small
+    // and direct mapped; hits and lookups count the doubles written since.
+    void setDoubleCache(bool cache);
+    uint64_t getDoubleCacheHits() const;
+    uint64_t getDoubleCacheLookups() const;
+    PRCSerializationContext &getSerializationContext() { return context; }
+    // threads writeItems() may use, 0 for all
+    void setThreads(unsigned int t) { threads = t; }
+    unsigned int getThreads() const { return threads; }
+    void beginEntity() { if(entities != NULL) entities->begin(getBitCount()); }
+    void endEntity() { if(entities != NULL) entities->end(getBitCount()); }
+
+    // zlib level (-1 default, 0 store only ... 9 best) and strategy;
+    // threads other than 1 deflate large data in blocks on that many
+    // threads (0 for all), ignored when streaming
+    void compress(int level=-1, int strategy=0, unsigned int threads=1);
     void write(std::ostream &out) const;
+    // Hand the data of a compressed stream over, with its capacity and
+    // the pool to release it to, NULL to free() it; the stream keeps its
+    // sizes but no longer has data to write.
+    uint8_t* takeData(unsigned int &capacity, PRCbufferPool *&from);
   private:
+    // the stream owns its buffer
+    PRCbitStream(const PRCbitStream&);
+    PRCbitStream& operator=(const PRCbitStream&);
+
+    // report a write to a compressed stream
+    void writeAfterCompression() const;
     void writeBit(bool);
-    void writeBits(uint32_t,uint8_t);
     void writeByte(uint8_t);
-    void nextByte();
-    void nextBit();
+    void flushBytes();
+    // make room for bytes more after byteIndex, handing full chunks to
+    // deflate when streaming
+    void reserve(size_t bytes);
     void getAChunk();
-    // bitIndex is "big endian", zero based, location of next bit to write
-    unsigned int byteIndex,bitIndex;
+    void deflateBytes(unsigned int size, bool finish);
+    void releaseBuffer(uint8_t *buffer, unsigned int capacity);
+    // bits not yet stored in data, right aligned; bitCount of them are valid
+    uint64_t bitBuffer;
+    unsigned int bitCount;
+    // number of complete bytes already stored in data
+    unsigned int byteIndex;
     unsigned int allocatedLength;
     uint8_t*& data;
     bool compressed;
     uint32_t compressedDataSize;
+    uint32_t uncompressedDataSize;
+    double compressionTime;
+    // streaming compression state
+    struct z_stream_s *stream;
+    uint32_t streamedSize; // uncompressed bytes already handed to deflate
+    uint8_t *streamOutput;
+    uint32_t streamOutputLength;
+    PRCbufferPool *pool;
+    bool counting;
+    PRCentityStatistics *entities;
+    PRCdoubleCache *doubleCache;
+    PRCSerializationContext context;
+    unsigned int threads;
+};
+
+// delimits an entity for PRCentityStatistics
+class PRCentityScope
+{
+  public:
+    PRCentityScope(PRCbitStream &out) : out(out) { out.beginEntity(); }
+    ~PRCentityScope() { out.endEntity(); }
+  private:
+    PRCbitStream &out;
+};
+
+// delimits a part of an entity for PRCentityStatistics
+class PRCpartScope
+{
+  public:
+    PRCpartScope(PRCbitStream &out, PRCentityStatistics::Part part) : out(out),
+      statistics(out.getEntityStatistics()), part(part),
+      start(statistics != NULL ? out.getBitCount() : 0) {}
+    ~PRCpartScope()
+    {
+      if(statistics != NULL)
+      {
+        ++statistics->parts[part].count;
+        statistics->parts[part].bits += out.getBitCount() - start;
+      }
+    }
+  private:
+    PRCbitStream &out;
+    PRCentityStatistics *statistics;
+    const PRCentityStatistics::Part part;
+    const uint64_t start;
 };
 
 #endif // __PRC_BIT_STREAM_H
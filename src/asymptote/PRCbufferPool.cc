@@ -0,0 +1,106 @@
+/************
+*
+*   This file is part of a tool for producing 3D content in the PRC format.
+*   Copyright (C) 2008  Orest Shardt <shardtor (at) gmail dot com> and
+*                       Michail Vidiassov <master@iaas.msu.ru>
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU Lesser General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*************/
+
+#include <iostream>
+#include <stdlib.h>
+#include "PRCbufferPool.h"
+
+using std::cerr;
+using std::endl;
+
+PRCbufferPool::~PRCbufferPool()
+{
+  clear();
+}
+
+void PRCbufferPool::clear()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  for(BufferMap::iterator it = buffers.begin(); it != buffers.end(); ++it)
+    free(it->second);
+  buffers.clear();
+  bytes = 0;
+}
+
+unsigned char* PRCbufferPool::acquire(size_t size, size_t &capacity)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    BufferMap::iterator it = buffers.lower_bound(size);
+    if(it != buffers.end())
+    {
+      unsigned char *buffer = it->second;
+      capacity = it->first;
+      bytes -= capacity;
+      buffers.erase(it);
+      ++reuses;
+      return buffer;
+    }
+    ++allocations;
+  }
+  unsigned char *buffer = (unsigned char*)malloc(size);
+  if(buffer == NULL)
+  {
+    cerr << "Memory allocation error." << endl;
+    exit(1);
+  }
+  capacity = size;
+  return buffer;
+}
+
+void PRCbufferPool::release(unsigned char *buffer, size_t capacity)
+{
+  if(buffer == NULL)
+    return;
+  std::lock_guard<std::mutex> lock(mutex);
+  ++releases;
+  if(capacity > max_bytes || max_buffers == 0)
+  {
+    ++discards;
+    free(buffer);
+    return;
+  }
+  buffers.insert(BufferMap::value_type(capacity,buffer));
+  bytes += capacity;
+  // over the limits: drop the largest buffers for size, the smallest
+  // ones for number
+  while(bytes > max_bytes)
+  {
+    BufferMap::iterator largest = --buffers.end();
+    bytes -= largest->first;
+    free(largest->second);
+    buffers.erase(largest);
+    ++discards;
+  }
+  while(buffers.size() > max_buffers)
+  {
+    bytes -= buffers.begin()->first;
+    free(buffers.begin()->second);
+    buffers.erase(buffers.begin());
+    ++discards;
+  }
+}
+
+PRCbufferPool& PRCbufferPool::getThreadPool()
+{
+  static thread_local PRCbufferPool pool;
+  return pool;
+}
@@ -0,0 +1,77 @@
+/************
+*
+*   This file is part of a tool for producing 3D content in the PRC format.
+*   Copyright (C) 2008  Orest Shardt <shardtor (at) gmail dot com> and
+*                       Michail Vidiassov <master@iaas.msu.ru>
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU Lesser General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*************/
+
+#ifndef __PRC_BUFFER_POOL_H
+#define __PRC_BUFFER_POOL_H
+
+#include <stddef.h>
+#include <map>
+#include <mutex>
+
+// Keeps buffers released by PRCbitStream for later streams, so that
+// repeated exports reuse grown buffers instead of allocating them again.
+// Buffers come from malloc and may be realloc'ed or freed by their user.
+// The pool may be shared between threads.
+class PRCbufferPool
+{
+  public:
+    // at most max_buffers buffers and max_bytes bytes are kept
+    PRCbufferPool(size_t max_buffers=32, size_t max_bytes=256*1024*1024) :
+      max_buffers(max_buffers), max_bytes(max_bytes), bytes(0),
+      allocations(0), reuses(0), releases(0), discards(0) {}
+    ~PRCbufferPool();
+
+    // the smallest kept buffer of at least size bytes, or a new one;
+    // capacity is set to its actual size
+    unsigned char* acquire(size_t size, size_t &capacity);
+    // take a buffer of the given capacity back
+    void release(unsigned char *buffer, size_t capacity);
+    // free all kept buffers
+    void clear();
+
+    // buffers allocated, handed out again, taken back and freed because
+    // the pool was full, since construction
+    size_t getAllocations() const { std::lock_guard<std::mutex> lock(mutex); return allocations; }
+    size_t getReuses() const { std::lock_guard<std::mutex> lock(mutex); return reuses; }
+    size_t getReleases() const { std::lock_guard<std::mutex> lock(mutex); return releases; }
+    size_t getDiscards() const { std::lock_guard<std::mutex> lock(mutex); return discards; }
+    size_t getKeptBytes() const { std::lock_guard<std::mutex> lock(mutex); return bytes; }
+
+    // a pool for the calling thread, destroyed with it
+    static PRCbufferPool& getThreadPool();
+
+  private:
+    PRCbufferPool(const PRCbufferPool&);
+    PRCbufferPool& operator=(const PRCbufferPool&);
+
+    typedef std::multimap<size_t,unsigned char*> BufferMap;
+    BufferMap buffers;
+    mutable std::mutex mutex;
+    const size_t max_buffers;
+    const size_t max_bytes;
+    size_t bytes;
+    size_t allocations;
+    size_t reuses;
+    size_t releases;
+    size_t discards;
+};
+
+#endif // __PRC_BUFFER_POOL_H
@@ -0,0 +1,289 @@
+/************
+*
+*   This file is part of a tool for producing 3D content in the PRC format.
+*   Copyright (C) 2008  Orest Shardt <shardtor (at) gmail dot com> and
+*                       Michail Vidiassov <master@iaas.msu.ru>
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU Lesser General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*************/
+
+#include <iostream>
+#include <vector>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#ifdef PRC_USE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+#include "PRCcompress.h"
+#include "PRCparallel.h"
+
+using std::cerr;
+using std::endl;
+
+class PRCzlibCompressor : public PRCcompressor
+{
+  public:
+    const char* getName() const { return "zlib"; }
+    bool compress(const uint8_t *in, uint32_t size, uint8_t *&out, uint32_t &out_size,
+                  int level, int strategy) const
+    {
+      z_stream strm;
+      strm.zalloc = Z_NULL;
+      strm.zfree = Z_NULL;
+      strm.opaque = Z_NULL;
+      if(deflateInit2(&strm,level,Z_DEFLATED,MAX_WBITS,8,strategy) != Z_OK)
+      {
+        cerr << "Compression initialization failed" << endl;
+        return false;
+      }
+      // deflateBound is an upper bound for the settings in use, the loop
+      // below only grows the buffer should it ever be exceeded
+      uLong sizeAvailable = deflateBound(&strm,size);
+      uint8_t *compressedData = (uint8_t*) malloc(sizeAvailable);
+      if(compressedData == NULL)
+      {
+        cerr << "Memory allocation error." << endl;
+        exit(1);
+      }
+      strm.avail_in = size;
+      strm.next_in = (Bytef*)in;
+      strm.next_out = (Bytef*)compressedData;
+      strm.avail_out = sizeAvailable;
+
+      int code;
+      while((code = deflate(&strm,Z_FINISH)) == Z_OK)
+      {
+        // strm.avail_out should be 0 if we got Z_OK: double the buffer,
+        // keeping what was written so far
+        const uLong written = sizeAvailable - strm.avail_out;
+        compressedData = (uint8_t*) realloc(compressedData,2*sizeAvailable);
+        if(compressedData == NULL)
+        {
+          cerr << "Memory allocation error." << endl;
+          exit(1);
+        }
+        strm.next_out = (Bytef*)(compressedData + written);
+        strm.avail_out += sizeAvailable;
+        sizeAvailable *= 2;
+      }
+      if(code != Z_STREAM_END)
+      {
+        cerr << "Compression error" << endl;
+        deflateEnd(&strm);
+        free(compressedData);
+        return false;
+      }
+      out = compressedData;
+      out_size = strm.total_out;
+      deflateEnd(&strm);
+      return true;
+    }
+};
+
+#ifdef PRC_USE_LIBDEFLATE
+// libdeflate compresses in one call and has no strategies
+class PRClibdeflateCompressor : public PRCcompressor
+{
+  public:
+    const char* getName() const { return "libdeflate"; }
+    bool compress(const uint8_t *in, uint32_t size, uint8_t *&out, uint32_t &out_size,
+                  int level, int) const
+    {
+      if(level < 0)
+        level = 6; // zlib's default
+      struct libdeflate_compressor *compressor = libdeflate_alloc_compressor(level);
+      if(compressor == NULL)
+      {
+        cerr << "Compression initialization failed" << endl;
+        return false;
+      }
+      const size_t sizeAvailable = libdeflate_zlib_compress_bound(compressor,size);
+      uint8_t *compressedData = (uint8_t*) malloc(sizeAvailable);
+      if(compressedData == NULL)
+      {
+        cerr << "Memory allocation error." << endl;
+        exit(1);
+      }
+      const size_t compressedDataSize =
+        libdeflate_zlib_compress(compressor,in,size,compressedData,sizeAvailable);
+      libdeflate_free_compressor(compressor);
+      if(compressedDataSize == 0)
+      {
+        cerr << "Compression error" << endl;
+        free(compressedData);
+        return false;
+      }
+      out = compressedData;
+      out_size = compressedDataSize;
+      return true;
+    }
+};
+#endif
+
+const PRCcompressor& getZlibCompressor()
+{
+  static const PRCzlibCompressor compressor;
+  return compressor;
+}
+
+const PRCcompressor& getCompressor()
+{
+#if defined(PRC_USE_LIBDEFLATE)
+  static const PRClibdeflateCompressor compressor;
+  return compressor;
+#else
+  return getZlibCompressor();
+#endif
+}
+
+// the deflate window: each block is compressed with the 32K of data
+// preceding it as dictionary, so matches can reach into the previous block
+#define DICTIONARY_SIZE (32*1024)
+
+// Raw deflate of each block, ended by a sync flush that byte aligns it,
+// the last one by Z_FINISH; the blocks are then concatenated between a
+// zlib header and the Adler-32 of the whole data.
+class PRCdeflateBlocks : public PRCparallelWork
+{
+  public:
+    PRCdeflateBlocks(const uint8_t *in, uint32_t size, int level, int strategy) :
+      in(in), size(size), level(level), strategy(strategy),
+      number_of_blocks((size+PRC_PARALLEL_DEFLATE_BLOCK_SIZE-1)/PRC_PARALLEL_DEFLATE_BLOCK_SIZE),
+      blocks(number_of_blocks), adlers(number_of_blocks), failed(number_of_blocks,0) {}
+
+    void run(size_t i)
+    {
+      const uint32_t start = i*PRC_PARALLEL_DEFLATE_BLOCK_SIZE;
+      const uint32_t length = (size-start < PRC_PARALLEL_DEFLATE_BLOCK_SIZE) ? size-start : PRC_PARALLEL_DEFLATE_BLOCK_SIZE;
+      const bool last = (i == number_of_blocks-1);
+      adlers[i] = adler32(adler32(0,Z_NULL,0),(const Bytef*)(in+start),length);
+
+      z_stream strm;
+      strm.zalloc = Z_NULL;
+      strm.zfree = Z_NULL;
+      strm.opaque = Z_NULL;
+      if(deflateInit2(&strm,level,Z_DEFLATED,-MAX_WBITS,8,strategy) != Z_OK)
+      {
+        failed[i] = 1;
+        return;
+      }
+      if(start != 0)
+      {
+        const uint32_t dictionary = start < DICTIONARY_SIZE ? start : DICTIONARY_SIZE;
+        deflateSetDictionary(&strm,(const Bytef*)(in+start-dictionary),dictionary);
+      }
+      std::vector<uint8_t> &block = blocks[i];
+      // room for the sync flush marker on top of the bound
+      block.resize(deflateBound(&strm,length)+16);
+      strm.next_in = (Bytef*)(in+start);
+      strm.avail_in = length;
+      strm.next_out = (Bytef*)&block[0];
+      strm.avail_out = block.size();
+      int code;
+      while(true)
+      {
+        code = deflate(&strm,last ? Z_FINISH : Z_SYNC_FLUSH);
+        if(code == Z_STREAM_ERROR || (last && code == Z_STREAM_END) || (!last && strm.avail_out != 0))
+          break;
+        const size_t written = block.size() - strm.avail_out;
+        block.resize(2*block.size());
+        strm.next_out = (Bytef*)&block[written];
+        strm.avail_out = block.size() - written;
+      }
+      if(code == Z_STREAM_ERROR || (last && code != Z_STREAM_END))
+        failed[i] = 1;
+      block.resize(strm.total_out);
+      deflateEnd(&strm);
+    }
+
+    bool assemble(uint8_t *&out, uint32_t &out_size)
+    {
+      size_t total = 2+4;
+      for(size_t i = 0; i < number_of_blocks; ++i)
+      {
+        if(failed[i])
+        {
+          cerr << "Compression error" << endl;
+          return false;
+        }
+        total += blocks[i].size();
+      }
+      uint8_t *data = (uint8_t*) malloc(total);
+      if(data == NULL)
+      {
+        cerr << "Memory allocation error." << endl;
+        exit(1);
+      }
+      // zlib header, as deflateInit2 would write it for these settings
+      uint32_t level_flags;
+      if(strategy >= Z_HUFFMAN_ONLY || (level >= 0 && level < 2))
+        level_flags = 0;
+      else if(level >= 0 && level < 6)
+        level_flags = 1;
+      else if(level < 0 || level == 6)
+        level_flags = 2;
+      else
+        level_flags = 3;
+      uint32_t header = ((Z_DEFLATED + ((MAX_WBITS-8)<<4)) << 8) | (level_flags << 6);
+      header += 31 - (header % 31);
+      data[0] = (uint8_t)(header >> 8);
+      data[1] = (uint8_t)(header);
+
+      size_t offset = 2;
+      uLong adler = adlers[0];
+      for(size_t i = 0; i < number_of_blocks; ++i)
+      {
+        memcpy(data+offset,&blocks[i][0],blocks[i].size());
+        offset += blocks[i].size();
+        if(i != 0)
+        {
+          const uint32_t start = i*PRC_PARALLEL_DEFLATE_BLOCK_SIZE;
+          const uint32_t length = (size-start < PRC_PARALLEL_DEFLATE_BLOCK_SIZE) ? size-start : PRC_PARALLEL_DEFLATE_BLOCK_SIZE;
+          adler = adler32_combine(adler,adlers[i],length);
+        }
+      }
+      data[offset++] = (uint8_t)(adler >> 24);
+      data[offset++] = (uint8_t)(adler >> 16);
+      data[offset++] = (uint8_t)(adler >> 8);
+      data[offset++] = (uint8_t)(adler);
+      out = data;
+      out_size = offset;
+      return true;
+    }
+
+  private:
+    const uint8_t *in;
+    const uint32_t size;
+    const int level;
+    const int strategy;
+    const size_t number_of_blocks;
+    std::vector< std::vector<uint8_t> > blocks;
+    std::vector<uLong> adlers;
+    std::vector<char> failed;
+};
+
+bool compressData(const uint8_t *in, uint32_t size, uint8_t *&out, uint32_t &out_size,
+                  int level, int strategy, unsigned int threads)
+{
+  if(threads == 0)
+    threads = getHardwareThreads();
+  if(threads == 1 || size < 2*PRC_PARALLEL_DEFLATE_BLOCK_SIZE)
+    return getCompressor().compress(in, size, out, out_size, level, strategy);
+
+  PRCdeflateBlocks blocks(in, size, level, strategy);
+  runInParallel(blocks, (size+PRC_PARALLEL_DEFLATE_BLOCK_SIZE-1)/PRC_PARALLEL_DEFLATE_BLOCK_SIZE, threads);
+  return blocks.assemble(out, out_size);
+}
@@ -0,0 +1,55 @@
+/************
+*
+*   This file is part of a tool for producing 3D content in the PRC format.
+*   Copyright (C) 2008  Orest Shardt <shardtor (at) gmail dot com> and
+*                       Michail Vidiassov <master@iaas.msu.ru>
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU Lesser General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*************/
+
+#ifndef __PRC_COMPRESS_H
+#define __PRC_COMPRESS_H
+
+#include "PRCbitStream.h"
+
+// A deflate implementation producing zlib (RFC 1950) streams.
+class PRCcompressor
+{
+  public:
+    virtual ~PRCcompressor() {}
+    virtual const char* getName() const = 0;
+    // compress size bytes into a buffer allocated with malloc;
+    // level and strategy take zlib values, strategy may be ignored
+    virtual bool compress(const uint8_t *in, uint32_t size, uint8_t *&out, uint32_t &out_size,
+                          int level, int strategy) const = 0;
+};
+
+// stock zlib, always available
+const PRCcompressor& getZlibCompressor();
+// the implementation selected at build time (CMake PRC_COMPRESSION_BACKEND),
+// zlib unless another one was found
+const PRCcompressor& getCompressor();
+
+// Deflate size bytes with the build time selection. With threads other
+// than 1 (0 is one per hardware thread), data larger than two blocks is
+// deflated in blocks on that many threads instead, pigz style, with zlib.
+// The result is still a single ordinary zlib stream.
+bool compressData(const uint8_t *in, uint32_t size, uint8_t *&out, uint32_t &out_size,
+                  int level=-1, int strategy=0, unsigned int threads=1);
+
+// size of the blocks compressed in parallel
+#define PRC_PARALLEL_DEFLATE_BLOCK_SIZE (128*1024)
+
+#endif // __PRC_COMPRESS_H
@@ -5,17 +5,6 @@
 PRCdword stadwZero[2]={DOUBLEWITHTWODWORD(0x00000000,0x00000000)};
 PRCdword stadwNegativeZero[2]={DOUBLEWITHTWODWORD(0x80000000,0x00000000)};
 
-struct sCodageOfFrequentDoubleOrExponent* getcofdoe(unsigned Bits, short NumberOfBits)
-{
-  struct sCodageOfFrequentDoubleOrExponent *pcofdoe;
-  for(pcofdoe=acofdoe; pcofdoe < acofdoe+NUMBEROFELEMENTINACOFDOE; ++pcofdoe)
-  {
-    if(pcofdoe->NumberOfBits == NumberOfBits && pcofdoe->Bits == Bits)
-      return pcofdoe;
-  }
-  return NULL;
-}
-
 int stCOFDOECompare(const void* pcofdoe1,const void* pcofdoe2)
 {
   return(EXPONENT(((const struct sCodageOfFrequentDoubleOrExponent *)pcofdoe1)->u2uod.Value)-
@@ -0,0 +1,99 @@
+/************
+*
+*   This file is part of a tool for producing 3D content in the PRC format.
+*   Copyright (C) 2008  Orest Shardt <shardtor (at) gmail dot com> and
+*                       Michail Vidiassov <master@iaas.msu.ru>
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU Lesser General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*************/
+
+#ifndef __PRC_DOUBLE_TABLES_H
+#define __PRC_DOUBLE_TABLES_H
+
+#include "PRCbitStream.h"
+
+// Tables derived from acofdoe, to encode and decode doubles without
+// searching it. The build generates PRCdoubleTables.cc with the
+// prcdoubletables tool, so they follow any change to acofdoe.
+
+// the prefix code of a frequent value, or of an exponent that the
+// mantissa follows
+struct PRCdoubleCodeword
+{
+  uint32_t bits;
+  uint8_t length;
+  bool value; // the code of a frequent value, not of an exponent
+};
+
+#define PRC_DOUBLE_EXPONENTS 2048
+
+struct PRCdoubleExponentCode
+{
+  PRCdoubleCodeword code;
+  bool frequent; // whether frequent values have this exponent
+};
+
+// the code of each exponent
+extern const PRCdoubleExponentCode prcDoubleExponentCodes[PRC_DOUBLE_EXPONENTS];
+
+#define PRC_DOUBLE_FREQUENT_BITS 6
+
+struct PRCdoubleFrequentCode
+{
+  uint64_t key; // bits of the absolute value
+  PRCdoubleCodeword code;
+  bool used;
+};
+
+// The frequent values, hashed by the bits of their absolute value with
+// linear probing. As in a search of acofdoe sorted by exponent, the
+// frequent values of an exponent are the entries from its first one up
+// to its exponent code.
+extern const PRCdoubleFrequentCode prcDoubleFrequentCodes[1 << PRC_DOUBLE_FREQUENT_BITS];
+
+inline size_t prcDoubleFrequentHash(uint64_t key)
+{
+  return (size_t)((key * (uint64_t)0x9E3779B97F4A7C15ULL) >> (64-PRC_DOUBLE_FREQUENT_BITS));
+}
+
+// the code of a double given as its bits
+inline const PRCdoubleCodeword &findDoubleCode(uint64_t bits)
+{
+  const uint64_t key = bits & ~((uint64_t)1 << 63);
+  const PRCdoubleExponentCode &exponent = prcDoubleExponentCodes[key >> 52];
+  if(exponent.frequent)
+    for(size_t slot = prcDoubleFrequentHash(key); prcDoubleFrequentCodes[slot].used;
+        slot = (slot+1) & ((1 << PRC_DOUBLE_FREQUENT_BITS)-1))
+      if(prcDoubleFrequentCodes[slot].key == key)
+        return prcDoubleFrequentCodes[slot].code;
+  return exponent.code;
+}
+
+#define PRC_DOUBLE_PRIMARY_BITS 11
+
+struct PRCdoubleCode
+{
+  uint32_t value;  // index into acofdoe, or of the secondary table
+  uint8_t length;  // code length, 0 for an invalid code
+  uint8_t secondaryBits; // nonzero for a secondary table
+};
+
+// Decoding table for the prefix codes, at most 22 bits long. The first
+// PRC_DOUBLE_PRIMARY_BITS bits index the primary table at its start;
+// codes that are longer continue in a secondary table per primary prefix,
+// indexed by the bits that follow.
+extern const PRCdoubleCode prcDoubleDecodeTable[];
+
+#endif // __PRC_DOUBLE_TABLES_H
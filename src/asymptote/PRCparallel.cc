@@ -0,0 +1,59 @@
+/************
+*
+*   This file is part of a tool for producing 3D content in the PRC format.
+*   Copyright (C) 2008  Orest Shardt <shardtor (at) gmail dot com> and
+*                       Michail Vidiassov <master@iaas.msu.ru>
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU Lesser General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*************/
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include "PRCparallel.h"
+
+unsigned int getHardwareThreads()
+{
+  const unsigned int n = std::thread::hardware_concurrency();
+  return n == 0 ? 1 : n;
+}
+
+static void runItems(PRCparallelWork *work, std::atomic<size_t> *next, size_t count)
+{
+  for(size_t i = (*next)++; i < count; i = (*next)++)
+    work->run(i);
+}
+
+void runInParallel(PRCparallelWork &work, size_t count, unsigned int threads)
+{
+  if(threads == 0)
+    threads = getHardwareThreads();
+  if(threads > count)
+    threads = count;
+  if(threads <= 1)
+  {
+    for(size_t i = 0; i < count; ++i)
+      work.run(i);
+    return;
+  }
+  std::atomic<size_t> next(0);
+  std::vector<std::thread> workers;
+  workers.reserve(threads-1);
+  for(unsigned int t = 1; t < threads; ++t)
+    workers.push_back(std::thread(runItems, &work, &next, count));
+  runItems(&work, &next, count);
+  for(size_t t = 0; t < workers.size(); ++t)
+    workers[t].join();
+}
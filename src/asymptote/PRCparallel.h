@@ -0,0 +1,44 @@
+/************
+*
+*   This file is part of a tool for producing 3D content in the PRC format.
+*   Copyright (C) 2008  Orest Shardt <shardtor (at) gmail dot com> and
+*                       Michail Vidiassov <master@iaas.msu.ru>
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU Lesser General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*************/
+
+#ifndef __PRC_PARALLEL_H
+#define __PRC_PARALLEL_H
+
+#include <stddef.h>
+
+// A job made of independent items, run(i) must be safe to call
+// concurrently for different values of i.
+class PRCparallelWork
+{
+  public:
+    virtual ~PRCparallelWork() {}
+    virtual void run(size_t index) = 0;
+};
+
+// Call work.run(i) for i in [0,count) on up to "threads" threads, the
+// calling thread included; 0 threads means one per hardware thread.
+// Returns once every item is done.
+void runInParallel(PRCparallelWork &work, size_t count, unsigned int threads);
+
+// number of threads meant by a thread count of 0
+unsigned int getHardwareThreads();
+
+#endif // __PRC_PARALLEL_H
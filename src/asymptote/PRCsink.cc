@@ -0,0 +1,228 @@
+/************
+*
+*   This file is part of a tool for producing 3D content in the PRC format.
+*   Copyright (C) 2008  Orest Shardt <shardtor (at) gmail dot com> and
+*                       Michail Vidiassov <master@iaas.msu.ru>
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU Lesser General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*************/
+
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#ifdef _WIN32
+#include <io.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#else
+#include <unistd.h>
+#include <limits.h>
+#include <sys/uio.h>
+#endif
+#include "PRCsink.h"
+#include "PRCbufferPool.h"
+
+using std::cerr;
+using std::endl;
+
+// size of the blocks writes are copied into
+#define GATHER_BLOCK_SIZE (4096)
+
+#ifndef IOV_MAX
+#define IOV_MAX (1024)
+#endif
+
+bool PRCstreamSink::write(const PRCbuffer *buffers, size_t count)
+{
+  for(size_t i = 0; i < count; ++i)
+    out.write((const char*)buffers[i].data,buffers[i].size);
+  out.flush();
+  return !out.fail();
+}
+
+bool PRCmemorySink::write(const PRCbuffer *buffers, size_t count)
+{
+  size_t total = size;
+  for(size_t i = 0; i < count; ++i)
+    total += buffers[i].size;
+  uint8_t *grown = (uint8_t*)realloc(data,total);
+  if(grown == NULL && total != 0)
+  {
+    cerr << "Memory allocation error." << endl;
+    return false;
+  }
+  data = grown;
+  for(size_t i = 0; i < count; ++i)
+  {
+    memcpy(data+size,buffers[i].data,buffers[i].size);
+    size += buffers[i].size;
+  }
+  return true;
+}
+
+PRCfileSink::PRCfileSink(FILE *file) : fd(-1), owned(false)
+{
+  if(file != NULL)
+  {
+    // anything already buffered goes first
+    fflush(file);
+#ifdef _WIN32
+    fd = _fileno(file);
+#else
+    fd = fileno(file);
+#endif
+  }
+}
+
+PRCfileSink::PRCfileSink(const std::string &name) : owned(true)
+{
+#ifdef _WIN32
+  fd = _open(name.c_str(),_O_WRONLY|_O_CREAT|_O_TRUNC|_O_BINARY,_S_IREAD|_S_IWRITE);
+#else
+  fd = open(name.c_str(),O_WRONLY|O_CREAT|O_TRUNC,0666);
+#endif
+  if(fd < 0)
+    cerr << "Cannot open " << name << " for writing." << endl;
+}
+
+PRCfileSink::~PRCfileSink()
+{
+  if(owned && fd >= 0)
+#ifdef _WIN32
+    _close(fd);
+#else
+    close(fd);
+#endif
+}
+
+bool PRCfileSink::write(const PRCbuffer *buffers, size_t count)
+{
+  if(fd < 0)
+    return false;
+#ifdef _WIN32
+  for(size_t i = 0; i < count; ++i)
+  {
+    const char *p = (const char*)buffers[i].data;
+    size_t left = buffers[i].size;
+    while(left > 0)
+    {
+      const int written = _write(fd,p,left > 0x40000000 ? 0x40000000 : (unsigned int)left);
+      if(written <= 0)
+        return false;
+      p += written;
+      left -= written;
+    }
+  }
+  return true;
+#else
+  std::vector<struct iovec> iov;
+  iov.reserve(count);
+  for(size_t i = 0; i < count; ++i)
+    if(buffers[i].size != 0)
+    {
+      struct iovec v;
+      v.iov_base = const_cast<void*>(buffers[i].data);
+      v.iov_len = buffers[i].size;
+      iov.push_back(v);
+    }
+  // as many buffers per call as allowed, resuming after partial writes
+  size_t first = 0;
+  while(first < iov.size())
+  {
+    const size_t n = iov.size()-first < (size_t)IOV_MAX ? iov.size()-first : (size_t)IOV_MAX;
+    ssize_t written = writev(fd,&iov[first],n);
+    if(written < 0)
+    {
+      if(errno == EINTR)
+        continue;
+      return false;
+    }
+    while(written > 0)
+    {
+      if((size_t)written >= iov[first].iov_len)
+      {
+        written -= iov[first].iov_len;
+        ++first;
+      }
+      else
+      {
+        iov[first].iov_base = (char*)iov[first].iov_base + written;
+        iov[first].iov_len -= written;
+        written = 0;
+      }
+    }
+  }
+  return true;
+#endif
+}
+
+bool PRCcallbackSink::write(const PRCbuffer *buffers, size_t count)
+{
+  for(size_t i = 0; i < count; ++i)
+    if(buffers[i].size != 0 && !callback(user,buffers[i].data,buffers[i].size))
+      return false;
+  return true;
+}
+
+PRCgatherBuffer::~PRCgatherBuffer()
+{
+  for(size_t i = 0; i < blocks.size(); ++i)
+    delete[] blocks[i];
+  for(size_t i = 0; i < sections.size(); ++i)
+    if(sections[i].pool != NULL)
+      sections[i].pool->release(sections[i].data,sections[i].capacity);
+    else
+      free(sections[i].data);
+}
+
+void PRCgatherBuffer::append(PRCbitStream &section)
+{
+  endPiece();
+  const unsigned int size = section.getSize();
+  Section taken;
+  taken.data = section.takeData(taken.capacity,taken.pool);
+  sections.push_back(taken);
+  const PRCbuffer buffer = { taken.data, size };
+  buffers.push_back(buffer);
+}
+
+void PRCgatherBuffer::endPiece()
+{
+  if(pptr() != pieceStart)
+  {
+    const PRCbuffer buffer = { pieceStart, (size_t)(pptr()-pieceStart) };
+    buffers.push_back(buffer);
+    pieceStart = pptr();
+  }
+}
+
+const std::vector<PRCbuffer>& PRCgatherBuffer::getBuffers()
+{
+  endPiece();
+  return buffers;
+}
+
+PRCgatherBuffer::int_type PRCgatherBuffer::overflow(int_type c)
+{
+  endPiece();
+  blocks.push_back(new char[GATHER_BLOCK_SIZE]);
+  setp(blocks.back(),blocks.back()+GATHER_BLOCK_SIZE);
+  pieceStart = pptr();
+  if(traits_type::eq_int_type(c,traits_type::eof()))
+    return traits_type::not_eof(c);
+  return sputc(traits_type::to_char_type(c));
+}
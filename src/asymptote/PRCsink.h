@@ -0,0 +1,134 @@
+/************
+*
+*   This file is part of a tool for producing 3D content in the PRC format.
+*   Copyright (C) 2008  Orest Shardt <shardtor (at) gmail dot com> and
+*                       Michail Vidiassov <master@iaas.msu.ru>
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU Lesser General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*************/
+
+#ifndef __PRC_SINK_H
+#define __PRC_SINK_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <iostream>
+#include "PRCbitStream.h"
+
+// a piece of output, not owned
+struct PRCbuffer
+{
+  const void *data;
+  size_t size;
+};
+
+// Destination of a finished PRC file, handed all of its pieces at once.
+class PRCsink
+{
+  public:
+    virtual ~PRCsink() {}
+    // write the buffers in order, false on error
+    virtual bool write(const PRCbuffer *buffers, size_t count) = 0;
+};
+
+// to a std::ostream, one write per buffer
+class PRCstreamSink : public PRCsink
+{
+  public:
+    PRCstreamSink(std::ostream &out) : out(out) {}
+    bool write(const PRCbuffer *buffers, size_t count);
+  private:
+    std::ostream &out;
+};
+
+// into one contiguous block of memory, allocated with malloc
+class PRCmemorySink : public PRCsink
+{
+  public:
+    PRCmemorySink() : data(NULL), size(0) {}
+    ~PRCmemorySink() { free(data); }
+    bool write(const PRCbuffer *buffers, size_t count);
+    const uint8_t* getData() const { return data; }
+    size_t getSize() const { return size; }
+    // hand the data over, to be released with free()
+    uint8_t* release() { uint8_t *d = data; data = NULL; size = 0; return d; }
+  private:
+    uint8_t *data;
+    size_t size;
+};
+
+// to a file descriptor with gathering writes (writev), without copying
+// the sections; a FILE* is flushed first and written through its
+// descriptor, a file name is opened (and truncated) by the constructor
+class PRCfileSink : public PRCsink
+{
+  public:
+    PRCfileSink(int fd) : fd(fd), owned(false) {}
+    PRCfileSink(FILE *file);
+    PRCfileSink(const std::string &name);
+    ~PRCfileSink();
+    bool write(const PRCbuffer *buffers, size_t count);
+    bool isOpen() const { return fd >= 0; }
+  private:
+    int fd;
+    bool owned;
+};
+
+// to a function, called once per buffer with the user pointer; it
+// returns false on error
+typedef bool (*PRCwriteCallback)(void *user, const void *data, size_t size);
+class PRCcallbackSink : public PRCsink
+{
+  public:
+    PRCcallbackSink(PRCwriteCallback callback, void *user) : callback(callback), user(user) {}
+    bool write(const PRCbuffer *buffers, size_t count);
+  private:
+    PRCwriteCallback callback;
+    void *user;
+};
+
+// A stream buffer collecting what is written to it as a list of buffers
+// for a sink. What is written through the stream is copied into blocks;
+// only the compressed sections given to append() are not copied, their
+// buffers are taken over and released with the gather buffer.
+class PRCgatherBuffer : public std::streambuf
+{
+  public:
+    PRCgatherBuffer() : pieceStart(NULL) {}
+    ~PRCgatherBuffer();
+    // the data of a compressed section, which then has none
+    void append(PRCbitStream &section);
+    const std::vector<PRCbuffer>& getBuffers();
+  protected:
+    int_type overflow(int_type c);
+  private:
+    void endPiece();
+
+    struct Section
+    {
+      uint8_t *data;
+      unsigned int capacity;
+      PRCbufferPool *pool;
+    };
+
+    std::vector<char*> blocks;
+    std::vector<Section> sections;
+    std::vector<PRCbuffer> buffers;
+    char *pieceStart;
+};
+
+#endif // __PRC_SINK_H
@@ -26,8 +26,11 @@
 #include <fstream>
 #include <iomanip>
 #include <string>
-#include <zlib.h>
+#include "PRCcompress.h"
+#include "PRCparallel.h"
+#include "PRCbezier.h"
 #include <string.h>
+#include <chrono>
 
 #define WriteUnsignedInteger( value ) out << (uint32_t)(value);
 #define WriteInteger( value ) out << (int32_t)(value);
@@ -39,21 +42,21 @@
 #define SerializeCompressedUniqueId( value ) (value).serializeCompressedUniqueId(out);
 #define SerializeContentPRCBase write(out);
 #define SerializeRgbColor( value ) (value).serializeRgbColor(out);
-#define SerializePicture( value ) (value).serializePicture(out);
-#define SerializeTextureDefinition( value ) (value)->serializeTextureDefinition(out);
+#define SerializePicture( value ) { PRCentityScope entity(out); (value).serializePicture(out); }
+#define SerializeTextureDefinition( value ) { PRCentityScope entity(out); (value)->serializeTextureDefinition(out); }
 #define SerializeMarkup( value ) (value)->serializeMarkup(out);
 #define SerializeAnnotationEntity( value ) (value)->serializeAnnotationEntity(out);
 #define SerializeFontKeysSameFont( value ) (value).serializeFontKeysSameFont(out);
-#define SerializeMaterial( value ) (value)->serializeMaterial(out);
+#define SerializeMaterial( value ) { PRCentityScope entity(out); (value)->serializeMaterial(out); }
 
 #define SerializeUserData UserData(0,0).write(out);
 #define SerializeEmptyContentPRCBase ContentPRCBase(PRC_TYPE_ROOT_PRCBase).serializeContentPRCBase(out);
-#define SerializeCategory1LineStyle( value ) (value)->serializeCategory1LineStyle(out);
-#define SerializeCoordinateSystem( value ) (value)->serializeCoordinateSystem(out);
+#define SerializeCategory1LineStyle( value ) { PRCentityScope entity(out); (value)->serializeCategory1LineStyle(out); }
+#define SerializeCoordinateSystem( value ) { PRCentityScope entity(out); (value)->serializeCoordinateSystem(out); }
 #define SerializeRepresentationItem( value ) (value)->serializeRepresentationItem(out);
-#define SerializePartDefinition( value ) (value)->serializePartDefinition(out);
-#define SerializeProductOccurrence( value ) (value)->serializeProductOccurrence(out);
-#define SerializeContextAndBodies( value ) (value)->serializeContextAndBodies(out);
+#define SerializePartDefinition( value ) { PRCentityScope entity(out); (value)->serializePartDefinition(out); }
+#define SerializeProductOccurrence( value ) { PRCentityScope entity(out); (value)->serializeProductOccurrence(out); }
+#define SerializeContextAndBodies( value ) { PRCentityScope entity(out); (value)->serializeContextAndBodies(out); }
 #define SerializeGeometrySummary( value ) (value)->serializeGeometrySummary(out);
 #define SerializeContextGraphics( value ) (value)->serializeContextGraphics(out);
 #define SerializeStartHeader serializeStartHeader(out);
@@ -67,7 +70,7 @@
     WriteUncompressedBlock ((*it)->data, (*it)->file_size) \
   } \
  }
-#define SerializeModelFileData serializeModelFileData(modelFile_out); modelFile_out.compress();
+#define SerializeModelFileData serializeModelFileData(modelFile_out); modelFile_out.compress(compression.modelFile.level, compression.modelFile.strategy, compression.modelFile.threads);
 #define SerializeUnit( value ) (value).serializeUnit(out);
 
 using std::string;
@@ -187,6 +190,19 @@ void PRCFileStructure::serializeFileStructureTree(PRCbitStream &out)
   SerializeUserData
 }
 
+class PRCtessellationItems : public PRCbitStreamItems
+{
+  public:
+    PRCtessellationItems(const PRCTessList &tessellations) : tessellations(tessellations) {}
+    void write(PRCbitStream &out, size_t index)
+    {
+      PRCentityScope entity(out);
+      tessellations[index]->serializeBaseTessData(out);
+    }
+  private:
+    const PRCTessList &tessellations;
+};
+
 void PRCFileStructure::serializeFileStructureTessellation(PRCbitStream &out)
 {
   WriteUnsignedInteger (PRC_TYPE_ASM_FileStructureTessellation)
@@ -194,8 +210,8 @@ void PRCFileStructure::serializeFileStructureTessellation(PRCbitStream &out)
   SerializeEmptyContentPRCBase
   const uint32_t number_of_tessellations = tessellations.size();
   WriteUnsignedInteger (number_of_tessellations)
-  for (uint32_t i=0;i<number_of_tessellations;i++)
-    tessellations[i]->serializeBaseTessData(out);
+  PRCtessellationItems items(tessellations);
+  out.writeItems(items,number_of_tessellations);
 
   SerializeUserData
 }
@@ -260,9 +276,8 @@ void oPRCFile::serializeModelFileData(PRCbitStream &out)
 
 void makeFileUUID(PRCUniqueId& UUID)
 {
-  // make a UUID
-  static uint32_t count = 0;
-  ++count;
+  // make a UUID, counted in the current identifier context
+  const uint32_t count = ++PRCIdentifierContext::current().fileUUIDCount;
   // the minimum requirement on UUIDs is that all must be unique in the file
   UUID.id0 = 0x33595341; // some constant
   UUID.id1 = (uint32_t)time(NULL); // the time
@@ -308,24 +323,75 @@ uint32_t PRCStartHeader::getStartHeaderSize() const
 }
 
 
-void PRCFileStructure::write(ostream &out)
+void PRCFileStructure::write(PRCgatherBuffer &gather)
 {
+  ostream out(&gather);
   // SerializeFileStructureHeader
   SerializeStartHeader
   SerializeUncompressedFiles
-  globals_out.write(out);
-  tree_out.write(out);
-  tessellations_out.write(out);
-  geometry_out.write(out);
-  extraGeometry_out.write(out);
-}
-
-#define SerializeFileStructureGlobals serializeFileStructureGlobals(globals_out); globals_out.compress(); sizes[1]=globals_out.getSize();
-#define SerializeFileStructureTree serializeFileStructureTree(tree_out); tree_out.compress(); sizes[2]=tree_out.getSize();
-#define SerializeFileStructureTessellation serializeFileStructureTessellation(tessellations_out); tessellations_out.compress(); sizes[3]=tessellations_out.getSize();
-#define SerializeFileStructureGeometry serializeFileStructureGeometry(geometry_out); geometry_out.compress(); sizes[4]=geometry_out.getSize();
-#define SerializeFileStructureExtraGeometry serializeFileStructureExtraGeometry(extraGeometry_out); extraGeometry_out.compress(); sizes[5]=extraGeometry_out.getSize();
-#define FlushSerialization resetGraphicsAndName();
+  gather.append(globals_out);
+  gather.append(tree_out);
+  gather.append(tessellations_out);
+  gather.append(geometry_out);
+  gather.append(extraGeometry_out);
+}
+
+#define SerializeFileStructureSection(serialize,section,index) \
+ { \
+  const chrono::steady_clock::time_point start = chrono::steady_clock::now(); \
+  if(streaming_compression) \
+    section##_out.setStreamingCompression(true, compression.section.level, compression.section.strategy); \
+  section##_out.setDoubleCache(double_cache); \
+  section##_out.setThreads(entity_threads); \
+  if(statistics != NULL) \
+    section##_out.setEntityStatistics(&statistics[index-1].entities); \
+  serialize(section##_out); \
+  section##_out.setEntityStatistics(NULL); \
+  const uint64_t bits = section##_out.getBitCount(); \
+  section##_out.compress(compression.section.level, compression.section.strategy, compression.section.threads); \
+  sizes[index]=section##_out.getSize(); \
+  if(statistics != NULL) \
+  { \
+    statistics[index-1].name = #section; \
+    statistics[index-1].record(section##_out, bits, chrono::duration<double>(chrono::steady_clock::now() - start).count()); \
+  } \
+ }
+#define SerializeFileStructureGlobals SerializeFileStructureSection(serializeFileStructureGlobals,globals,1)
+#define SerializeFileStructureTree SerializeFileStructureSection(serializeFileStructureTree,tree,2)
+#define SerializeFileStructureTessellation SerializeFileStructureSection(serializeFileStructureTessellation,tessellations,3)
+#define SerializeFileStructureGeometry SerializeFileStructureSection(serializeFileStructureGeometry,geometry,4)
+#define SerializeFileStructureExtraGeometry SerializeFileStructureSection(serializeFileStructureExtraGeometry,extraGeometry,5)
+// The sections of a file structure, serialized concurrently. The globals
+// and the tree take identifiers, the line pattern and the next available
+// index, so they are written one after the other with the identifiers in
+// use, as they would be sequentially. The other sections take none and
+// each get a copy.
+class PRCsectionWork : public PRCparallelWork
+{
+  public:
+    PRCsectionWork(PRCFileStructure &fileStructure) : fileStructure(fileStructure),
+      identifiers(PRCIdentifierContext::current()), base(identifiers) {}
+    void run(size_t index)
+    {
+      if(index < 3)
+      {
+        PRCIdentifierContext copy(base);
+        PRCIdentifierScope scope(copy);
+        fileStructure.prepareSection(3+index);
+      }
+      else
+      {
+        PRCIdentifierScope scope(identifiers);
+        fileStructure.prepareSection(1);
+        fileStructure.prepareSection(2);
+      }
+    }
+  private:
+    PRCFileStructure &fileStructure;
+    PRCIdentifierContext &identifiers;
+    const PRCIdentifierContext base;
+};
+
 void PRCFileStructure::prepare()
 {
   uint32_t size = 0;
@@ -335,20 +401,86 @@ void PRCFileStructure::prepare()
     size += (*it)->getSize();
   sizes[0]=size;
 
-  SerializeFileStructureGlobals
-  FlushSerialization
+  if(section_threads == 1)
+  {
+    SerializeFileStructureGlobals
+    SerializeFileStructureTree
+    SerializeFileStructureTessellation
+    SerializeFileStructureGeometry
+    SerializeFileStructureExtraGeometry
+    return;
+  }
+  PRCsectionWork work(*this);
+  runInParallel(work,4,section_threads);
+}
 
-  SerializeFileStructureTree
-  FlushSerialization
+void PRCFileStructure::prepareSection(uint32_t index)
+{
+  switch(index)
+  {
+    case 1: SerializeFileStructureGlobals break;
+    case 2: SerializeFileStructureTree break;
+    case 3: SerializeFileStructureTessellation break;
+    case 4: SerializeFileStructureGeometry break;
+    case 5: SerializeFileStructureExtraGeometry break;
+  }
+}
 
-  SerializeFileStructureTessellation
-  FlushSerialization
+#define CountFileStructureSection(serialize,section) \
+  { \
+    uint8_t *counting_data = NULL; \
+    PRCbitStream counting_out(counting_data,0); \
+    counting_out.setCounting(true); \
+    counting_out.setEntityStatistics(&report.entities); \
+    serialize(counting_out); \
+    report.section += counting_out.getBitCount(); \
+  }
+void PRCFileStructure::countSizes(PRCsizeReport &report)
+{
+  report.uncompressedFiles += getStartHeaderSize() + sizeof(uint32_t);
+  for(PRCUncompressedFileList::const_iterator it = uncompressed_files.begin(); it != uncompressed_files.end(); it++)
+    report.uncompressedFiles += (*it)->getSize();
 
-  SerializeFileStructureGeometry
-  FlushSerialization
+  CountFileStructureSection(serializeFileStructureGlobals,globals)
+  CountFileStructureSection(serializeFileStructureTree,tree)
+  CountFileStructureSection(serializeFileStructureTessellation,tessellations)
+  CountFileStructureSection(serializeFileStructureGeometry,geometry)
+  CountFileStructureSection(serializeFileStructureExtraGeometry,extraGeometry)
+}
+
+uint32_t PRCFileStructure::countGeometrySize(size_t first_tessellation, size_t first_context)
+{
+  uint8_t *counting_data = NULL;
+  PRCbitStream counting_out(counting_data,0);
+  counting_out.setCounting(true);
+  for(size_t i=first_tessellation; i<tessellations.size(); i++)
+    tessellations[i]->serializeBaseTessData(counting_out);
+  for(size_t i=first_context; i<contexts.size(); i++)
+    contexts[i]->serializeContextAndBodies(counting_out);
+  return (uint32_t)((counting_out.getBitCount()+7)/8);
+}
+
+void PRCFileStructure::setStreamingCompression(bool streaming)
+{
+  // applied to the sections in prepare(), with the level of each section
+  streaming_compression = streaming;
+}
+
+void PRCFileStructure::setDoubleCache(bool cache)
+{
+  // applied to the sections in prepare()
+  double_cache = cache;
+}
+
+void PRCFileStructure::setSectionThreads(unsigned int threads)
+{
+  section_threads = threads;
+}
 
-  SerializeFileStructureExtraGeometry
-  FlushSerialization
+void PRCFileStructure::setEntityThreads(unsigned int threads)
+{
+  // applied to the sections in prepare()
+  entity_threads = threads;
 }
 
 uint32_t PRCFileStructure::getSize()
@@ -882,8 +1014,10 @@ void oPRCFile::doGroup(PRCgroup& group)
     }
     lastgroupname.clear();
     lastgroupnames.clear();
+    // entities can only be moved to a parent in the same file structure
+    const bool same_file_structure = group.file_structure == group.parent_file_structure;
     // First option - reduce to one element in parent
-    if (parent_part_definition && product_occurrence->index_son_occurrence.empty() &&
+    if (parent_part_definition && same_file_structure && product_occurrence->index_son_occurrence.empty() &&
         part_definition->representation_item.size() == 1 &&
         ( name.empty() || part_definition->representation_item.front()->name.empty() ) &&
         ( !group.transform  || part_definition->representation_item.front()->index_local_coordinate_system==m1) )
@@ -899,7 +1033,7 @@ void oPRCFile::doGroup(PRCgroup& group)
       delete part_definition; part_definition = NULL;
     }
     // Second option - reduce to a set
-    else if (parent_part_definition && product_occurrence->index_son_occurrence.empty() &&
+    else if (parent_part_definition && same_file_structure && product_occurrence->index_son_occurrence.empty() &&
       !part_definition->representation_item.empty() &&
       !group.options.do_break && nonamedparts)
     {
@@ -942,7 +1076,18 @@ void oPRCFile::doGroup(PRCgroup& group)
         product_occurrence->location = group.transform;
         group.transform = NULL;
       }
-      if (parent_product_occurrence) {
+      if (parent_product_occurrence && !same_file_structure) {
+        // the parent refers to the product through an occurrence in its
+        // own file structure, placed where the product is
+        PRCProductOccurrence *instance = new PRCProductOccurrence(name);
+        instance->location = product_occurrence->location;
+        product_occurrence->location = NULL;
+        instance->prototype_in_same_file_structure = false;
+        instance->prototype_file_structure = fileStructures[group.file_structure]->file_structure_uuid;
+        instance->index_prototype = addProductOccurrence(product_occurrence);
+        parent_product_occurrence->index_son_occurrence.push_back(addProductOccurrence(instance,group.parent_file_structure));
+      }
+      else if (parent_product_occurrence) {
         parent_product_occurrence->index_son_occurrence.push_back(addProductOccurrence(product_occurrence));
       }
       else {
@@ -963,8 +1108,8 @@ std::string oPRCFile::calculate_unique_name(const ContentPRCBase *prc_entity,con
 {
   std::stringstream ss (std::stringstream::in | std::stringstream::out);
   uint8_t *serialization_buffer = NULL;
-  PRCbitStream serialization(serialization_buffer,0u);
-  const PRCFileStructure *pfile_structure = fileStructures[0];
+  PRCbitStream serialization(serialization_buffer,0u,buffer_pool);
+  const PRCFileStructure *pfile_structure = fileStructures[current_file_structure];
   const PRCUniqueId& uuid = pfile_structure->file_structure_uuid;
 // ConvertUniqueIdentifierToString (prc_entity)
 // SerializeCompressedUniqueId (file_structure)
@@ -991,23 +1136,128 @@ std::string oPRCFile::calculate_unique_name(const ContentPRCBase *prc_entity,con
   }
   ss << (prc_entity->name.empty()?"node":prc_entity->name) << '.';
   const uint32_t size_serialization = serialization.getSize();
+  const uint8_t *serialization_data = serialization.getData();
   for(size_t j=0; j<size_serialization; j++)
-    ss << hex << setfill('0') << setw(2) << (uint32_t)(serialization_buffer[j]);
+    ss << hex << setfill('0') << setw(2) << (uint32_t)(serialization_data[j]);
 
   return ss.str();
 }
 
-bool oPRCFile::finish()
+void oPRCFile::init()
+{
+  partition = KEPRCFileStructurePartition_None;
+  partition_budget = 0;
+  file_structure_threads = 1;
+  statistics = NULL;
+  current_file_structure = 0;
+  structure_maps.resize(number_of_file_structures);
+  top_level_groups = 0;
+  budget_file_structure = 0;
+  structure_bytes.assign(number_of_file_structures,0);
+  group_first_tessellation = group_first_context = 0;
+  for(uint32_t i = 0; i < number_of_file_structures; ++i)
+  {
+    fileStructures[i] = new PRCFileStructure(buffer_pool);
+    fileStructures[i]->minimal_version_for_read = PRCVersion;
+    fileStructures[i]->authoring_version = PRCVersion;
+    makeFileUUID(fileStructures[i]->file_structure_uuid);
+    makeAppUUID(fileStructures[i]->application_uuid);
+    fileStructures[i]->unit = unit.unit;
+  }
+
+  groups_done = false;
+  groups.push(PRCgroup());
+  PRCgroup &group = groups.top();
+  group.name="root";
+  group.transform = NULL;
+  group.product_occurrence = new PRCProductOccurrence(group.name);
+  group.parent_product_occurrence = NULL;
+  group.part_definition = new PRCPartDefinition;
+  group.parent_part_definition = NULL;
+}
+
+void oPRCFile::doRootGroup()
 {
+  if(groups_done)
+    return;
   if(groups.size()!=1) {
     fputs("begingroup without matching endgroup",stderr);
     exit(1);
   }
   doGroup(groups.top());
+  groups_done = true;
+}
+
+// Prepares the file structures concurrently. Each takes the identifiers it
+// needs while serialized from a copy of those in use, as they only have
+// to be unique within a structure; this way they do not depend on the
+// order the structures are prepared in.
+class PRCfileStructureWork : public PRCparallelWork
+{
+  public:
+    PRCfileStructureWork(PRCFileStructure **fileStructures) :
+      fileStructures(fileStructures), base(PRCIdentifierContext::current()) {}
+    void run(size_t index)
+    {
+      PRCIdentifierContext identifiers(base);
+      PRCIdentifierScope scope(identifiers);
+      fileStructures[index]->prepare();
+    }
+  private:
+    PRCFileStructure **fileStructures;
+    const PRCIdentifierContext base;
+};
+
+bool oPRCFile::finish()
+{
+  const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  PRCIdentifierScope scope(identifiers);
+  doRootGroup();
+
+  // five sections and the pictures of each file structure, then the model
+  // file
+  if(statistics != NULL)
+  {
+    statistics->sections.assign(6*number_of_file_structures+1,PRCsectionStatistics());
+    for(uint32_t i = 0; i < number_of_file_structures; ++i)
+    {
+      for(uint32_t j = 0; j < 6; ++j)
+        statistics->sections[6*i+j].file_structure = i;
+      fileStructures[i]->setStatistics(&statistics->sections[6*i]);
+    }
+  }
 
   // write each section's bit data
-  fileStructures[0]->prepare();
-  SerializeModelFileData
+  PRCfileStructureWork work(fileStructures);
+  runInParallel(work,number_of_file_structures,file_structure_threads);
+  if(statistics == NULL)
+  {
+    SerializeModelFileData
+  }
+  else
+  {
+    const chrono::steady_clock::time_point model_start = chrono::steady_clock::now();
+    PRCsectionStatistics &model = statistics->sections.back();
+    modelFile_out.setEntityStatistics(&model.entities);
+    serializeModelFileData(modelFile_out);
+    modelFile_out.setEntityStatistics(NULL);
+    const uint64_t bits = modelFile_out.getBitCount();
+    modelFile_out.compress(compression.modelFile.level, compression.modelFile.strategy, compression.modelFile.threads);
+    model.name = "model file";
+    model.file_structure = m1;
+    model.record(modelFile_out, bits, chrono::duration<double>(chrono::steady_clock::now() - model_start).count());
+    for(uint32_t i = 0; i < number_of_file_structures; ++i)
+    {
+      const PRCFileStructure &fs = *fileStructures[i];
+      PRCsectionStatistics &pictures = statistics->sections[6*i+5];
+      pictures.name = "pictures";
+      pictures.bits = 8*(uint64_t)fs.picture_size;
+      pictures.size = fs.picture_size;
+      pictures.compressed_size = fs.picture_compressed_size;
+      pictures.time = pictures.compression_time = fs.picture_compression_time;
+      fileStructures[i]->setStatistics(NULL);
+    }
+  }
 
   // create the header
 
@@ -1041,22 +1291,28 @@ bool oPRCFile::finish()
     }
   }
 
-  // write the data
+  // collect the data, the sections are taken over without copying, and
+  // hand it to the sink at once
+  PRCgatherBuffer gather;
+  std::ostream output(&gather);
   header.write(output);
 
   for(uint32_t i = 0; i < number_of_file_structures; ++i)
   {
-    fileStructures[i]->write(output);
+    fileStructures[i]->write(gather);
   }
 
-  modelFile_out.write(output);
-  output.flush();
+  gather.append(modelFile_out);
+  const std::vector<PRCbuffer> &buffers = gather.getBuffers();
+  if(statistics != NULL)
+    statistics->time = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  const bool written = sink.write(buffers.empty() ? NULL : &buffers[0],buffers.size());
 
   for(uint32_t i = 0; i < number_of_file_structures; ++i)
     delete[] header.fileStructureInformation[i].offsets;
   delete[] header.fileStructureInformation;
 
-  return true;
+  return written;
 }
 
 uint32_t oPRCFile::getSize()
@@ -1072,6 +1328,229 @@ uint32_t oPRCFile::getSize()
   return size;
 }
 
+void oPRCFile::countSizes(PRCsizeReport &report)
+{
+  PRCIdentifierScope scope(identifiers);
+  doRootGroup();
+
+  // serializing takes identifiers, which finish() has to take again
+  const PRCIdentifierContext taken = identifiers;
+
+  for(uint32_t i = 0; i < number_of_file_structures; ++i)
+  {
+    // as in finish()
+    PRCIdentifierContext structure_identifiers(taken);
+    PRCIdentifierScope structure_scope(structure_identifiers);
+    fileStructures[i]->countSizes(report);
+  }
+  {
+    uint8_t *counting_data = NULL;
+    PRCbitStream counting_out(counting_data,0);
+    counting_out.setCounting(true);
+    counting_out.setEntityStatistics(&report.entities);
+    serializeModelFileData(counting_out);
+    report.modelFile += counting_out.getBitCount();
+  }
+
+  identifiers = taken;
+}
+
+void PRCsizeReport::write(ostream &out) const
+{
+  const ios_base::fmtflags flags = out.flags();
+  out << "uncompressed sizes in bits" << endl;
+  out << "  " << setw(18) << left << "globals" << right << setw(14) << globals << endl;
+  out << "  " << setw(18) << left << "tree" << right << setw(14) << tree << endl;
+  out << "  " << setw(18) << left << "tessellation" << right << setw(14) << tessellations << endl;
+  out << "  " << setw(18) << left << "geometry" << right << setw(14) << geometry << endl;
+  out << "  " << setw(18) << left << "extra geometry" << right << setw(14) << extraGeometry << endl;
+  out << "  " << setw(18) << left << "model file" << right << setw(14) << modelFile << endl;
+  out << "  " << setw(18) << left << "stored bytes" << right << setw(14) << uncompressedFiles << endl;
+  out << "entity type           count          bits" << endl;
+  for(PRCentityStatistics::EntryMap::const_iterator it = entities.entries.begin(); it != entities.entries.end(); ++it)
+    out << "  " << setw(12) << it->first << setw(12) << it->second.count << setw(14) << it->second.bits << endl;
+  out.flags(flags);
+}
+
+void PRCsectionStatistics::record(const PRCbitStream &stream, uint64_t b, double t)
+{
+  bits = b;
+  size = stream.getUncompressedSize();
+  compressed_size = stream.getSize();
+  time = t;
+  compression_time = stream.getCompressionTime();
+  double_cache_hits = stream.getDoubleCacheHits();
+  double_cache_lookups = stream.getDoubleCacheLookups();
+}
+
+PRCentityStatistics PRCstatistics::total() const
+{
+  PRCentityStatistics entities;
+  for(size_t i = 0; i < sections.size(); ++i)
+    entities.add(sections[i].entities);
+  return entities;
+}
+
+static void writeEntitiesJSON(ostream &out, const PRCentityStatistics &entities, const char *indent)
+{
+  out << indent << "\"entities\": [";
+  for(PRCentityStatistics::EntryMap::const_iterator it = entities.entries.begin(); it != entities.entries.end(); ++it)
+    out << (it == entities.entries.begin() ? "\n" : ",\n") << indent << "  { \"type\": " << it->first
+        << ", \"count\": " << it->second.count << ", \"bits\": " << it->second.bits << " }";
+  out << (entities.entries.empty() ? "" : "\n") << (entities.entries.empty() ? "" : indent) << "]," << endl;
+  out << indent << "\"parts\": {";
+  for(unsigned int i = 0; i < PRCentityStatistics::NumberOfParts; ++i)
+    out << (i == 0 ? "\n" : ",\n") << indent << "  \"" << PRCentityStatistics::getPartName(i)
+        << "\": { \"count\": " << entities.parts[i].count << ", \"bits\": " << entities.parts[i].bits << " }";
+  out << endl << indent << "}," << endl;
+  out << indent << "\"doubles\": {";
+  for(unsigned int i = 0; i < PRCentityStatistics::NumberOfDoubleEncodings; ++i)
+    out << (i == 0 ? " " : ", ") << "\"" << PRCentityStatistics::getDoubleEncodingName(i) << "\": " << entities.doubles[i];
+  out << " }" << endl;
+}
+
+void PRCstatistics::writeJSON(ostream &out) const
+{
+  const ios_base::fmtflags flags = out.flags();
+  const streamsize precision = out.precision();
+  out << setprecision(6) << fixed;
+  out << "{" << endl;
+  out << "  \"time\": " << time << "," << endl;
+  out << "  \"sections\": [";
+  for(size_t i = 0; i < sections.size(); ++i)
+  {
+    const PRCsectionStatistics &section = sections[i];
+    out << (i == 0 ? "\n" : ",\n") << "    {" << endl;
+    out << "      \"name\": \"" << section.name << "\"," << endl;
+    out << "      \"file_structure\": ";
+    if(section.file_structure == m1)
+      out << "null";
+    else
+      out << section.file_structure;
+    out << "," << endl;
+    out << "      \"bits\": " << section.bits << "," << endl;
+    out << "      \"size\": " << section.size << "," << endl;
+    out << "      \"compressed_size\": " << section.compressed_size << "," << endl;
+    out << "      \"time\": " << section.time << "," << endl;
+    out << "      \"compression_time\": " << section.compression_time << "," << endl;
+    out << "      \"double_cache_hits\": " << section.double_cache_hits << "," << endl;
+    out << "      \"double_cache_lookups\": " << section.double_cache_lookups << "," << endl;
+    writeEntitiesJSON(out,section.entities,"      ");
+    out << "    }";
+  }
+  out << (sections.empty() ? "]," : "\n  ],") << endl;
+  out << "  \"total\": {" << endl;
+  writeEntitiesJSON(out,total(),"    ");
+  out << "  }" << endl;
+  out << "}" << endl;
+  out.flags(flags);
+  out.precision(precision);
+}
+
+void oPRCFile::setStreamingCompression(bool streaming)
+{
+  for(uint32_t i = 0; i < number_of_file_structures; ++i)
+    fileStructures[i]->setStreamingCompression(streaming);
+}
+
+void oPRCFile::setDoubleCache(bool cache)
+{
+  for(uint32_t i = 0; i < number_of_file_structures; ++i)
+    fileStructures[i]->setDoubleCache(cache);
+  modelFile_out.setDoubleCache(cache);
+}
+
+void oPRCFile::setSectionThreads(unsigned int threads)
+{
+  for(uint32_t i = 0; i < number_of_file_structures; ++i)
+    fileStructures[i]->setSectionThreads(threads);
+}
+
+void oPRCFile::setEntityThreads(unsigned int threads)
+{
+  for(uint32_t i = 0; i < number_of_file_structures; ++i)
+    fileStructures[i]->setEntityThreads(threads);
+}
+
+void oPRCFile::setFileStructurePartition(EPRCFileStructurePartition p, uint32_t budget)
+{
+  partition = p;
+  partition_budget = budget;
+}
+
+void oPRCFile::setFileStructureThreads(unsigned int threads)
+{
+  file_structure_threads = threads;
+}
+
+void oPRCFile::setCurrentFileStructure(uint32_t fileStructure)
+{
+  if(fileStructure == current_file_structure)
+    return;
+  PRCfileStructureMaps &current = structure_maps[current_file_structure];
+  PRCfileStructureMaps &next = structure_maps[fileStructure];
+  colorMap.swap(current.colorMap); colorMap.swap(next.colorMap);
+  colourMap.swap(current.colourMap); colourMap.swap(next.colourMap);
+  colourwidthMap.swap(current.colourwidthMap); colourwidthMap.swap(next.colourwidthMap);
+  materialgenericMap.swap(current.materialgenericMap); materialgenericMap.swap(next.materialgenericMap);
+  texturedefinitionMap.swap(current.texturedefinitionMap); texturedefinitionMap.swap(next.texturedefinitionMap);
+  textureapplicationMap.swap(current.textureapplicationMap); textureapplicationMap.swap(next.textureapplicationMap);
+  styleMap.swap(current.styleMap); styleMap.swap(next.styleMap);
+  pictureMap.swap(current.pictureMap); pictureMap.swap(next.pictureMap);
+  transformMap.swap(current.transformMap); transformMap.swap(next.transformMap);
+  current_file_structure = fileStructure;
+}
+
+void oPRCFile::setCompressionPolicy(const PRCcompressionPolicy &policy)
+{
+  compression = policy;
+  for(uint32_t i = 0; i < number_of_file_structures; ++i)
+    fileStructures[i]->compression = policy;
+}
+
+static void reportSection(ostream &out, const char *name, uint32_t size, uint32_t compressed_size, double time)
+{
+  out << "  " << setw(14) << left << name << right
+      << setw(12) << size << " -> " << setw(12) << compressed_size << " bytes"
+      << fixed << setprecision(4) << setw(10) << time << " s" << endl;
+}
+
+static void reportDoubleCache(ostream &out, const PRCbitStream &stream)
+{
+  const uint64_t lookups = stream.getDoubleCacheLookups();
+  if(lookups == 0)
+    return;
+  const uint64_t hits = stream.getDoubleCacheHits();
+  out << "  " << setw(14) << left << "  doubles" << right
+      << setw(12) << hits << " of " << setw(12) << lookups << " cached"
+      << fixed << setprecision(1) << setw(8) << 100.0*hits/lookups << " %" << endl;
+}
+
+#define ReportSection(name,stream) \
+  reportSection(out,name,stream.getUncompressedSize(),stream.getSize(),stream.getCompressionTime()); \
+  reportDoubleCache(out,stream);
+void oPRCFile::reportCompression(ostream &out) const
+{
+  const ios_base::fmtflags flags = out.flags();
+  const streamsize precision = out.precision();
+  for(uint32_t i = 0; i < number_of_file_structures; ++i)
+  {
+    const PRCFileStructure &fs = *fileStructures[i];
+    out << "file structure " << i << endl;
+    ReportSection("globals",fs.globals_out)
+    ReportSection("tree",fs.tree_out)
+    ReportSection("tessellation",fs.tessellations_out)
+    ReportSection("geometry",fs.geometry_out)
+    ReportSection("extra geometry",fs.extraGeometry_out)
+    if(fs.picture_size != 0)
+      reportSection(out,"pictures",fs.picture_size,fs.picture_compressed_size,fs.picture_compression_time);
+  }
+  out << "model file" << endl;
+  ReportSection("model file",modelFile_out)
+  out.flags(flags);
+  out.precision(precision);
+}
+
 uint32_t PRCFileStructure::addPicture(EPRCPictureDataFormat format, uint32_t size, const uint8_t *p, uint32_t width, uint32_t height, string name)
 {
   uint8_t *data = NULL;
@@ -1115,43 +1594,13 @@ uint32_t PRCFileStructure::addPicture(EPRCPictureDataFormat format, uint32_t siz
 
       {
         uint32_t compressedDataSize = 0;
-        const int CHUNK= 1024; // is this reasonable?
-
-        z_stream strm;
-        strm.zalloc = Z_NULL;
-        strm.zfree = Z_NULL;
-        strm.opaque = Z_NULL;
-        if(deflateInit(&strm,Z_DEFAULT_COMPRESSION) != Z_OK)
-          { cerr << "Compression initialization failed" << endl; return m1; }
-        unsigned int sizeAvailable = deflateBound(&strm,size);
-        uint8_t *compressedData = (uint8_t*) malloc(sizeAvailable);
-        strm.avail_in = size;
-        strm.next_in = (unsigned char*)p;
-        strm.next_out = (unsigned char*)compressedData;
-        strm.avail_out = sizeAvailable;
-
-        int code;
-        unsigned int chunks = 0;
-        while((code = deflate(&strm,Z_FINISH)) == Z_OK)
-        {
-          ++chunks;
-          // strm.avail_out should be 0 if we got Z_OK
-          compressedDataSize = sizeAvailable - strm.avail_out;
-          compressedData = (uint8_t*) realloc(compressedData,CHUNK*chunks);
-          strm.next_out = (Bytef*)(compressedData + compressedDataSize);
-          strm.avail_out += CHUNK;
-          sizeAvailable += CHUNK;
-        }
-        compressedDataSize = sizeAvailable-strm.avail_out;
-
-        if(code != Z_STREAM_END)
-        {
-          deflateEnd(&strm);
-          free(compressedData);
-          { cerr << "Compression error" << endl; return m1; }
-        }
-
-        deflateEnd(&strm);
+        uint8_t *compressedData = NULL;
+        const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        if(!compressData(p,size,compressedData,compressedDataSize,compression.pictures.level,compression.pictures.strategy,compression.pictures.threads))
+          return m1;
+        picture_compression_time += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        picture_size += size;
+        picture_compressed_size += compressedDataSize;
         size = compressedDataSize;
         data = new uint8_t[compressedDataSize];
         memcpy(data, compressedData, compressedDataSize);
@@ -1198,7 +1647,7 @@ uint32_t oPRCFile::addColor(const PRCRgbColor &color)
   if(pColor!=colorMap.end())
     return pColor->second;
 //  color_index = addRgbColorUnique(color);
-  const uint32_t color_index = fileStructures[0]->addRgbColor(color);
+  const uint32_t color_index = fileStructures[current_file_structure]->addRgbColor(color);
   colorMap.insert(make_pair(color,color_index));
   return color_index;
 }
@@ -1218,7 +1667,7 @@ uint32_t oPRCFile::addColour(const RGBAColour &colour)
   style->is_transparency_defined = (colour.A < 1.0);
   style->transparency = (uint8_t)(colour.A * 256);
   style->additional = 0;
-  const uint32_t style_index = fileStructures[0]->addStyle(style);
+  const uint32_t style_index = fileStructures[current_file_structure]->addStyle(style);
   colourMap.insert(make_pair(colour,style_index));
   return style_index;
 }
@@ -1239,7 +1688,7 @@ uint32_t oPRCFile::addColourWidth(const RGBAColour &colour, double width)
   style->is_transparency_defined = (colour.A < 1.0);
   style->transparency = (uint8_t)(colour.A * 256);
   style->additional = 0;
-  const uint32_t style_index = fileStructures[0]->addStyle(style);
+  const uint32_t style_index = fileStructures[current_file_structure]->addStyle(style);
   colourwidthMap.insert(make_pair(colourwidth,style_index));
   return style_index;
 }
@@ -1283,7 +1732,7 @@ uint32_t oPRCFile::addTransform(PRCGeneralTransformation3d*& transform)
   }
   else
   coordinateSystem->axis_set = transform;
-  const uint32_t coordinate_system_index = fileStructures[0]->addCoordinateSystem(coordinateSystem);
+  const uint32_t coordinate_system_index = fileStructures[current_file_structure]->addCoordinateSystem(coordinateSystem);
   transformMap.insert(make_pair(*transform,coordinate_system_index));
   if(transform_replaced)
     delete transform;
@@ -1306,7 +1755,7 @@ uint32_t oPRCFile::addTransform(const double origin[3], const double x_axis[3],
     return m1;
   PRCCoordinateSystem *coordinateSystem = new PRCCoordinateSystem();
   coordinateSystem->axis_set = transform;
-  const uint32_t coordinate_system_index = fileStructures[0]->addCoordinateSystem(coordinateSystem);
+  const uint32_t coordinate_system_index = fileStructures[current_file_structure]->addCoordinateSystem(coordinateSystem);
   return coordinate_system_index;
 }
 
@@ -1439,6 +1888,24 @@ void oPRCFile::begingroup(const char *name, PRCoptions *options,
   group.parent_product_occurrence = parent_group.product_occurrence;
   group.part_definition = new PRCPartDefinition;
   group.parent_part_definition = parent_group.part_definition;
+  group.parent_file_structure = group.file_structure = parent_group.file_structure;
+  if(groups.size() == 2 && number_of_file_structures > 1)
+  {
+    if(partition == KEPRCFileStructurePartition_ByGroup)
+      group.file_structure = top_level_groups % number_of_file_structures;
+    else if(partition == KEPRCFileStructurePartition_ByBudget)
+    {
+      if(structure_bytes[budget_file_structure] >= partition_budget &&
+         budget_file_structure+1 < number_of_file_structures)
+        budget_file_structure++;
+      group.file_structure = budget_file_structure;
+    }
+    top_level_groups++;
+    const PRCFileStructure &fileStructure = *fileStructures[group.file_structure];
+    group_first_tessellation = fileStructure.tessellations.size();
+    group_first_context = fileStructure.contexts.size();
+  }
+  setCurrentFileStructure(group.file_structure);
 }
 
 void oPRCFile::endgroup()
@@ -1449,6 +1916,10 @@ void oPRCFile::endgroup()
   }
   doGroup(groups.top());
   groups.pop();
+  if(groups.size() == 1 && partition == KEPRCFileStructurePartition_ByBudget)
+    structure_bytes[current_file_structure] +=
+      fileStructures[current_file_structure]->countGeometrySize(group_first_tessellation,group_first_context);
+  setCurrentFileStructure(groups.top().file_structure);
 
 // std::cout << lastgroupname << std::endl;
 // for(std::vector<std::string>::const_iterator it=lastgroupnames.begin(); it!=lastgroupnames.end(); it++)
@@ -2074,13 +2545,33 @@ void oPRCFile::addPatch(const double cP[][3], const PRCmaterial &m)
   }
 }
 
+// Whether the patches of a surface write fewer bits as compressed faces,
+// whose body has the tolerance given, than the surface does.
+static bool smallerAsPatches(const std::vector<PRCbezierPatch> &patches,
+                             PRCNURBSSurface &surface, double tolerance)
+{
+  uint8_t *patchData = NULL, *surfaceData = NULL;
+  PRCbitStream patchBits(patchData,0), surfaceBits(surfaceData,0);
+  patchBits.setCounting(true);
+  surfaceBits.setCounting(true);
+  PRCCompressedFace face;
+  for(size_t i = 0; i < patches.size(); ++i)
+  {
+    const size_t points = (patches[i].degree+1)*(patches[i].degree+1);
+    face.degree = patches[i].degree;
+    face.control_point.assign(patches[i].point,patches[i].point+points);
+    face.serializeCompressedFace(patchBits,tolerance);
+  }
+  surface.serializeNURBSSurface(surfaceBits);
+  return patchBits.getBitCount() < surfaceBits.getBitCount();
+}
+
 void oPRCFile::addSurface(uint32_t dU, uint32_t dV, uint32_t nU, uint32_t nV,
                           const double cP[][3], const double *kU,
                           const double *kV, const PRCmaterial &m,
                           const double w[])
 {
-  ADDFACE(PRCNURBSSurface)
-
+  PRCNURBSSurface *surface = new PRCNURBSSurface;
   surface->is_rational = (w!=NULL);
   surface->degree_in_u = dU;
   surface->degree_in_v = dV;
@@ -2092,6 +2583,36 @@ void oPRCFile::addSurface(uint32_t dU, uint32_t dV, uint32_t nU, uint32_t nV,
       surface->control_point[i]=PRCControlPoint(cP[i][0],cP[i][1],cP[i][2]);
   surface->knot_u.insert(surface->knot_u.end(), kU, kU+(dU+nU+1));
   surface->knot_v.insert(surface->knot_v.end(), kV, kV+(dV+nV+1));
+
+  const double compression = findGroup().options.compression;
+  if(compression != 0.0)
+  {
+    // approximated to the precision compressed faces store their points
+    // with, 0.2 of the tolerance 0.1*compression of their body
+    const double tolerance = 0.1*compression;
+    std::vector<PRCbezierPatch> patches;
+    if(splitNURBSSurface(dU,dV,nU,nV,cP,kU,kV,w,0.2*tolerance,patches) &&
+       smallerAsPatches(patches,*surface,tolerance))
+    {
+      delete surface;
+      for(size_t i = 0; i < patches.size(); ++i)
+      {
+        ADDCOMPFACE
+
+        const size_t points = (patches[i].degree+1)*(patches[i].degree+1);
+        compface->degree = patches[i].degree;
+        compface->control_point.assign(patches[i].point,patches[i].point+points);
+      }
+      return;
+    }
+  }
+  PRCgroup &group = findGroup();
+  group.faces.push_back(PRCface());
+  PRCface& face = group.faces.back();
+  face.face = new PRCFace;
+  face.face->base_surface = surface;
+  face.transparent = m.alpha < 1.0;
+  face.style = addMaterial(m);
 }
 
 #define SETTRANSF \
@@ -38,6 +38,8 @@
 
 #include "PRC.h"
 #include "PRCbitStream.h"
+#include "PRCsink.h"
+#include "PRCbufferPool.h"
 #include "writePRC.h"
 
 class oPRCFile;
@@ -444,13 +446,107 @@ public:
       tess(tess), do_break(do_break), no_break(no_break), crease_angle(crease_angle) {}
 };
 
+// zlib settings for one part of the file
+class PRCcompression
+{
+public:
+  int level;    // -1 zlib default, 0 store only (fastest) ... 9 smallest
+  int strategy; // zlib strategy: 0 default, 1 filtered, 2 Huffman only, 3 RLE, 4 fixed
+  unsigned int threads; // threads deflating large data in blocks, 0 for all, 1 single stream
+
+  PRCcompression(int level=-1, int strategy=0, unsigned int threads=1) :
+    level(level), strategy(strategy), threads(threads) {}
+};
+
+class PRCcompressionPolicy
+{
+public:
+  // file structure sections
+  PRCcompression globals;
+  PRCcompression tree;
+  PRCcompression tessellations;
+  PRCcompression geometry;
+  PRCcompression extraGeometry;
+  PRCcompression modelFile;
+  PRCcompression pictures; // raw bitmaps, compressed when they are added
+
+  PRCcompressionPolicy(const PRCcompression &c=PRCcompression()) :
+    globals(c), tree(c), tessellations(c), geometry(c), extraGeometry(c),
+    modelFile(c), pictures(c) {}
+};
+
+// Uncompressed sizes found by oPRCFile::countSizes()
+class PRCsizeReport
+{
+public:
+  PRCsizeReport() : globals(0), tree(0), tessellations(0), geometry(0),
+    extraGeometry(0), modelFile(0), uncompressedFiles(0) {}
+  // bits of each section
+  uint64_t globals;
+  uint64_t tree;
+  uint64_t tessellations;
+  uint64_t geometry;
+  uint64_t extraGeometry;
+  uint64_t modelFile;
+  // bytes stored as they are: file structure headers and pictures
+  uint64_t uncompressedFiles;
+  // bits of the entities of each PRC type, nested entities excluded
+  PRCentityStatistics entities;
+
+  void write(std::ostream &out) const;
+};
+
+// What serializing a section took, see PRCstatistics
+class PRCsectionStatistics
+{
+public:
+  PRCsectionStatistics() : file_structure(0), bits(0), size(0),
+    compressed_size(0), time(0), compression_time(0),
+    double_cache_hits(0), double_cache_lookups(0) {}
+  std::string name;
+  // m1 for the model file
+  uint32_t file_structure;
+  // bits serialized, bytes before and after compression
+  uint64_t bits;
+  uint32_t size;
+  uint32_t compressed_size;
+  // seconds spent serializing and compressing, and compressing alone
+  double time;
+  double compression_time;
+  uint64_t double_cache_hits;
+  uint64_t double_cache_lookups;
+  // bits of the entities, parts and doubles written to the section
+  PRCentityStatistics entities;
+
+  // take the sizes and counters of the stream the section went to
+  void record(const PRCbitStream &stream, uint64_t bits, double time);
+};
+
+// Filled in by oPRCFile::finish() when given to oPRCFile::setStatistics():
+// each section of each file structure, its pictures and the model file.
+// Collecting the entities makes each section write them in turn.
+class PRCstatistics
+{
+public:
+  PRCstatistics() : time(0) {}
+  std::vector<PRCsectionStatistics> sections;
+  // seconds finish() spent before handing the file to the sink
+  double time;
+
+  // entities of all sections
+  PRCentityStatistics total() const;
+  void writeJSON(std::ostream &out) const;
+};
+
 class PRCgroup
 {
  public:
   PRCgroup() : 
-    product_occurrence(NULL), parent_product_occurrence(NULL), part_definition(NULL), parent_part_definition(NULL), transform(NULL) {}
+    product_occurrence(NULL), parent_product_occurrence(NULL), part_definition(NULL), parent_part_definition(NULL), transform(NULL),
+    file_structure(0), parent_file_structure(0) {}
   PRCgroup(const std::string& name) : 
-    product_occurrence(NULL), parent_product_occurrence(NULL), part_definition(NULL), parent_part_definition(NULL), transform(NULL), name(name) {}
+    product_occurrence(NULL), parent_product_occurrence(NULL), part_definition(NULL), parent_part_definition(NULL), transform(NULL), name(name),
+    file_structure(0), parent_file_structure(0) {}
   PRCProductOccurrence *product_occurrence, *parent_product_occurrence;
   PRCPartDefinition *part_definition, *parent_part_definition;
   PRCfaceList       faces;
@@ -467,6 +563,8 @@ class PRCgroup
   PRCGeneralTransformation3d*  transform;
   std::string name;
   PRCoptions options;
+  // the file structures the group and its parent are written to
+  uint32_t file_structure, parent_file_structure;
 };
 
 void makeFileUUID(PRCUniqueId&);
@@ -525,6 +623,17 @@ class PRCFileStructure : public PRCStartHeader
     PRCTopoContextList contexts;
     PRCTessList tessellations;
 
+    PRCcompressionPolicy compression;
+    bool streaming_compression;
+    bool double_cache;
+    unsigned int section_threads;
+    unsigned int entity_threads;
+    // raw bitmap pictures before and after compression
+    uint32_t picture_size, picture_compressed_size;
+    double picture_compression_time;
+    // the statistics of the five sections, NULL for none
+    PRCsectionStatistics *statistics;
+
     uint32_t sizes[6];
     uint8_t *globals_data;
     PRCbitStream globals_out; // order matters: PRCbitStream must be initialized last
@@ -548,27 +657,42 @@ class PRCFileStructure : public PRCStartHeader
       for(PRCProductOccurrenceList::iterator it=product_occurrences.begin(); it!=product_occurrences.end(); ++it) delete *it;
       for(PRCCoordinateSystemList::iterator  it=reference_coordinate_systems.begin(); it!=reference_coordinate_systems.end(); it++)
         delete *it;
-
-      free(globals_data);
-      free(tree_data);
-      free(tessellations_data);
-      free(geometry_data);
-      free(extraGeometry_data);
     }
 
-    PRCFileStructure() :
+    // the section streams take their buffers from pool, if given
+    PRCFileStructure(PRCbufferPool *pool=NULL) :
       number_of_referenced_file_structures(0),
       tessellation_chord_height_ratio(2000.0),tessellation_angle_degree(40.0),
       default_font_family_name(""),
       unit(1),
-      globals_data(NULL),globals_out(globals_data,0),
-      tree_data(NULL),tree_out(tree_data,0),
-      tessellations_data(NULL),tessellations_out(tessellations_data,0),
-      geometry_data(NULL),geometry_out(geometry_data,0),
-      extraGeometry_data(NULL),extraGeometry_out(extraGeometry_data,0) {}
-    void write(std::ostream&);
+      streaming_compression(false), double_cache(false), section_threads(1), entity_threads(1),
+      picture_size(0), picture_compressed_size(0), picture_compression_time(0),
+      statistics(NULL),
+      globals_data(NULL),globals_out(globals_data,0,pool),
+      tree_data(NULL),tree_out(tree_data,0,pool),
+      tessellations_data(NULL),tessellations_out(tessellations_data,0,pool),
+      geometry_data(NULL),geometry_out(geometry_data,0,pool),
+      extraGeometry_data(NULL),extraGeometry_out(extraGeometry_data,0,pool) {}
+    // hands the data of the sections over to gather
+    void write(PRCgatherBuffer &gather);
     void prepare();
     uint32_t getSize();
+    void setStreamingCompression(bool streaming);
+    void setDoubleCache(bool cache);
+    // prepare() serializes and compresses the sections on up to that
+    // many threads, 0 for all; 1, the default, does it in turn
+    void setSectionThreads(unsigned int threads);
+    // threads each section may write independent entities on, see
+    // PRCbitStream::writeItems()
+    void setEntityThreads(unsigned int threads);
+    // record what prepare() takes for each section in the five given
+    void setStatistics(PRCsectionStatistics *sections) { statistics = sections; }
+    // serialize and compress the section with that index in sizes
+    void prepareSection(uint32_t index);
+    void countSizes(PRCsizeReport &report);
+    // uncompressed bytes of the tessellations and topological contexts
+    // from those indices on
+    uint32_t countGeometrySize(size_t first_tessellation, size_t first_context);
     void serializeFileStructureGlobals(PRCbitStream&);
     void serializeFileStructureTree(PRCbitStream&);
     void serializeFileStructureTessellation(PRCbitStream&);
@@ -624,63 +748,66 @@ class PRCHeader : public PRCStartHeader
 
 typedef std::map <PRCGeneralTransformation3d,uint32_t> PRCtransformMap;
 
+// How oPRCFile spreads the top-level groups over its file structures: all
+// in the first, the default; each in the next structure in turn; or each
+// in the same structure as the previous until the tessellations and
+// geometry written there reach a budget of bytes, then in the next.
+enum EPRCFileStructurePartition
+{
+  KEPRCFileStructurePartition_None,
+  KEPRCFileStructurePartition_ByGroup,
+  KEPRCFileStructurePartition_ByBudget
+};
+
+// what oPRCFile has added to a file structure, for reuse
+class PRCfileStructureMaps
+{
+  public:
+    PRCcolorMap colorMap;
+    PRCcolourMap colourMap;
+    PRCcolourwidthMap colourwidthMap;
+    PRCmaterialgenericMap materialgenericMap;
+    PRCtexturedefinitionMap texturedefinitionMap;
+    PRCtextureapplicationMap textureapplicationMap;
+    PRCstyleMap styleMap;
+    PRCpictureMap pictureMap;
+    PRCtransformMap transformMap;
+};
+
 class oPRCFile
 {
   public:
-    oPRCFile(std::ostream &os, double u=1, uint32_t n=1) :
+    // the buffers of the streams come from pool, if given, and go back to
+    // it; it has to outlive the file
+    oPRCFile(std::ostream &os, double u=1, uint32_t n=1, PRCbufferPool *pool=NULL) :
       number_of_file_structures(n),
       fileStructures(new PRCFileStructure*[n]),
-      unit(u),
-      modelFile_data(NULL),modelFile_out(modelFile_data,0),
-      fout(NULL),output(os)
+      unit(u),identifier_scope(identifiers),
+      modelFile_data(NULL),modelFile_out(modelFile_data,0,pool),
+      buffer_pool(pool),ownedSink(new PRCstreamSink(os)),sink(*ownedSink)
       {
-        for(uint32_t i = 0; i < number_of_file_structures; ++i)
-        {
-          fileStructures[i] = new PRCFileStructure();
-          fileStructures[i]->minimal_version_for_read = PRCVersion;
-          fileStructures[i]->authoring_version = PRCVersion;
-          makeFileUUID(fileStructures[i]->file_structure_uuid);
-          makeAppUUID(fileStructures[i]->application_uuid);
-          fileStructures[i]->unit = u;
-        }
-
-        groups.push(PRCgroup());
-        PRCgroup &group = groups.top();
-        group.name="root";
-        group.transform = NULL;
-        group.product_occurrence = new PRCProductOccurrence(group.name);
-        group.parent_product_occurrence = NULL;
-        group.part_definition = new PRCPartDefinition;
-        group.parent_part_definition = NULL;
+        init();
       }
 
-    oPRCFile(const std::string &name, double u=1, uint32_t n=1) :
+    oPRCFile(const std::string &name, double u=1, uint32_t n=1, PRCbufferPool *pool=NULL) :
       number_of_file_structures(n),
       fileStructures(new PRCFileStructure*[n]),
-      unit(u),
-      modelFile_data(NULL),modelFile_out(modelFile_data,0),
-      fout(new std::ofstream(name.c_str(),
-                             std::ios::out|std::ios::binary|std::ios::trunc)),
-      output(*fout)
+      unit(u),identifier_scope(identifiers),
+      modelFile_data(NULL),modelFile_out(modelFile_data,0,pool),
+      buffer_pool(pool),ownedSink(new PRCfileSink(name)),sink(*ownedSink)
       {
-        for(uint32_t i = 0; i < number_of_file_structures; ++i)
-        {
-          fileStructures[i] = new PRCFileStructure();
-          fileStructures[i]->minimal_version_for_read = PRCVersion;
-          fileStructures[i]->authoring_version = PRCVersion;
-          makeFileUUID(fileStructures[i]->file_structure_uuid);
-          makeAppUUID(fileStructures[i]->application_uuid);
-          fileStructures[i]->unit = u;
-        }
+        init();
+      }
 
-        groups.push(PRCgroup());
-        PRCgroup &group = groups.top();
-        group.name="root";
-        group.transform = NULL;
-        group.product_occurrence = new PRCProductOccurrence(group.name);
-        group.parent_product_occurrence = NULL;
-        group.part_definition = new PRCPartDefinition;
-        group.parent_part_definition = NULL;
+    // the sink has to outlive finish()
+    oPRCFile(PRCsink &s, double u=1, uint32_t n=1, PRCbufferPool *pool=NULL) :
+      number_of_file_structures(n),
+      fileStructures(new PRCFileStructure*[n]),
+      unit(u),identifier_scope(identifiers),
+      modelFile_data(NULL),modelFile_out(modelFile_data,0,pool),
+      buffer_pool(pool),ownedSink(NULL),sink(s)
+      {
+        init();
       }
 
     ~oPRCFile()
@@ -688,10 +815,11 @@ class oPRCFile
       for(uint32_t i = 0; i < number_of_file_structures; ++i)
         delete fileStructures[i];
       delete[] fileStructures;
-      if(fout != NULL)
-        delete fout;
-      free(modelFile_data);
+      delete ownedSink;
       for(PRCpictureMap::iterator it=pictureMap.begin(); it!=pictureMap.end(); ++it) delete it->first.data;
+      for(size_t i=0; i<structure_maps.size(); ++i)
+        for(PRCpictureMap::iterator it=structure_maps[i].pictureMap.begin(); it!=structure_maps[i].pictureMap.end(); ++it)
+          delete it->first.data;
     }
 
     void begingroup(const char *name, PRCoptions *options=NULL,
@@ -703,12 +831,67 @@ class oPRCFile
     std::string calculate_unique_name(const ContentPRCBase *prc_entity,const ContentPRCBase *prc_occurence);
     
     bool finish();
+    // Serialize without storing anything, to learn the uncompressed size
+    // of each section and entity type before the real export. Nothing can
+    // be added afterwards; finish() can still follow and writes the same.
+    void countSizes(PRCsizeReport &report);
     uint32_t getSize();
+    // compress the sections while they are serialized, see PRCbitStream
+    void setStreamingCompression(bool streaming);
+    // cache the encodings of repeated doubles in each section, see
+    // PRCbitStream; reportCompression() shows the hit rates
+    void setDoubleCache(bool cache);
+    // serialize the sections of each file structure concurrently on up to
+    // that many threads in finish(), 0 for all; output is the same
+    void setSectionThreads(unsigned int threads);
+    // write tessellations and the faces of compressed breps concurrently
+    // on up to that many threads within each section, 0 for all; output
+    // is the same
+    void setEntityThreads(unsigned int threads);
+    // Spread the top-level groups over the file structures, see
+    // EPRCFileStructurePartition; budget is in uncompressed bytes. Set
+    // this before adding any group. A group written to another structure
+    // than the root is referred to from it as the prototype of an
+    // occurrence there.
+    void setFileStructurePartition(EPRCFileStructurePartition partition, uint32_t budget=0);
+    // prepare the file structures on up to that many threads in finish(),
+    // 0 for all
+    void setFileStructureThreads(unsigned int threads);
+    // zlib level and strategy of each part of the file; pictures are
+    // compressed when added, so set this before adding any
+    void setCompressionPolicy(const PRCcompressionPolicy &policy);
+    const PRCcompressionPolicy& getCompressionPolicy() const { return compression; }
+    // sizes and compression times of each section, after finish()
+    void reportCompression(std::ostream &out) const;
+    // fill in statistics in finish(), which has to outlive it; NULL, the
+    // default, for none
+    void setStatistics(PRCstatistics *s) { statistics = s; }
 
     const uint32_t number_of_file_structures;
     PRCFileStructure **fileStructures;
     PRCHeader header;
     PRCUnit unit;
+    // Entities created on the thread of the file while it is alive take
+    // their identifiers from it, unless a file created later is alive too;
+    // finish() and countSizes() take them from it on any thread.
+    PRCIdentifierContext identifiers;
+    PRCIdentifierScope identifier_scope;
+    PRCcompressionPolicy compression;
+    EPRCFileStructurePartition partition;
+    uint32_t partition_budget;
+    unsigned int file_structure_threads;
+    PRCstatistics *statistics;
+    // The structure the add functions write to by default, that of the
+    // innermost group. The maps below are those of this structure, the
+    // ones of the others are kept in structure_maps.
+    uint32_t current_file_structure;
+    std::vector<PRCfileStructureMaps> structure_maps;
+    // Top-level groups begun. When partitioning by budget, the structure
+    // they go to, the bytes of tessellations and geometry they wrote to
+    // each, and where the one begun last started in its structure.
+    uint32_t top_level_groups, budget_file_structure;
+    std::vector<uint64_t> structure_bytes;
+    size_t group_first_tessellation, group_first_context;
     uint8_t *modelFile_data;
     PRCbitStream modelFile_out; // order matters: PRCbitStream must be initialized last
     PRCcolorMap colorMap;
@@ -722,8 +905,10 @@ class oPRCFile
     PRCgroup rootGroup;
     PRCtransformMap transformMap;
     std::stack<PRCgroup> groups;
+    bool groups_done;
     PRCgroup& findGroup();
     void doGroup(PRCgroup& group);
+    void doRootGroup();
     uint32_t addColor(const PRCRgbColor &color);
     uint32_t addColour(const RGBAColour &colour);
     uint32_t addColourWidth(const RGBAColour &colour, double width);
@@ -731,6 +916,10 @@ class oPRCFile
                { return addColourWidth(c,width); }
     uint32_t addMaterial(const PRCmaterial &material);
     uint32_t addTransform(PRCGeneralTransformation3d*& transform);
+    void setCurrentFileStructure(uint32_t fileStructure);
+    // the given file structure, the current one for m1
+    PRCFileStructure* getFileStructure(uint32_t fileStructure)
+      { return fileStructures[fileStructure==m1 ? current_file_structure : fileStructure]; }
     uint32_t addTransform(const double* t);
     uint32_t addTransform(const double origin[3], const double x_axis[3], const double y_axis[3], double scale);
     void addPoint(const double P[3], const RGBAColour &c, double w=1.0);
@@ -825,6 +1014,13 @@ class oPRCFile
 
     void addRectangle(const double P[][3], const PRCmaterial &m);
     void addPatch(const double cP[][3], const PRCmaterial &m);
+    // In a compressed group, the surface is split into compressed Bezier
+    // patches by splitNURBSSurface (PRCbezier.h), when these write fewer
+    // bits than the NURBS surface, as they do not when many small spans
+    // of a smooth surface repeat its points. Rational and higher degree
+    // spans are approximated within the precision compressed faces store
+    // their points with, 0.02*compression. The analytic surfaces below
+    // are written as they are.
     void addSurface(uint32_t dU, uint32_t dV, uint32_t nU, uint32_t nV,
      const double cP[][3], const double *kU, const double *kV, const PRCmaterial &m,
      const double w[]);
@@ -840,89 +1036,93 @@ class oPRCFile
 #undef PRCGENTRANSFORM
 
 
+    // fileStructure is the current one, that of the innermost group, if
+    // not given
     uint32_t addPicture(EPRCPictureDataFormat format, uint32_t size, const uint8_t *picture, uint32_t width=0, uint32_t height=0,
-      std::string name="", uint32_t fileStructure=0)
-      { return fileStructures[fileStructure]->addPicture(format, size, picture, width, height, name); }
+      std::string name="", uint32_t fileStructure=m1)
+      { return getFileStructure(fileStructure)->addPicture(format, size, picture, width, height, name); }
     uint32_t addPicture(const PRCpicture& pic,
-      std::string name="", uint32_t fileStructure=0)
-      { return fileStructures[fileStructure]->addPicture(pic.format, pic.size, pic.data, pic.width, pic.height, name); }
-    uint32_t addTextureDefinition(PRCTextureDefinition*& pTextureDefinition, uint32_t fileStructure=0)
+      std::string name="", uint32_t fileStructure=m1)
+      { return getFileStructure(fileStructure)->addPicture(pic.format, pic.size, pic.data, pic.width, pic.height, name); }
+    uint32_t addTextureDefinition(PRCTextureDefinition*& pTextureDefinition, uint32_t fileStructure=m1)
       {
-        return fileStructures[fileStructure]->addTextureDefinition(pTextureDefinition);
+        return getFileStructure(fileStructure)->addTextureDefinition(pTextureDefinition);
       }
-    uint32_t addTextureApplication(PRCTextureApplication*& pTextureApplication, uint32_t fileStructure=0)
+    uint32_t addTextureApplication(PRCTextureApplication*& pTextureApplication, uint32_t fileStructure=m1)
       {
-        return fileStructures[fileStructure]->addTextureApplication(pTextureApplication);
+        return getFileStructure(fileStructure)->addTextureApplication(pTextureApplication);
       }
     uint32_t addRgbColor(const PRCRgbColor &color,
-       uint32_t fileStructure=0)
+       uint32_t fileStructure=m1)
       {
-        return fileStructures[fileStructure]->addRgbColor(color);
+        return getFileStructure(fileStructure)->addRgbColor(color);
       }
     uint32_t addRgbColorUnique(const PRCRgbColor &color,
-       uint32_t fileStructure=0)
+       uint32_t fileStructure=m1)
       {
-        return fileStructures[fileStructure]->addRgbColorUnique(color);
+        return getFileStructure(fileStructure)->addRgbColorUnique(color);
       }
     uint32_t addMaterialGeneric(PRCMaterialGeneric*& pMaterialGeneric,
-       uint32_t fileStructure=0)
+       uint32_t fileStructure=m1)
       {
-        return fileStructures[fileStructure]->addMaterialGeneric(pMaterialGeneric);
+        return getFileStructure(fileStructure)->addMaterialGeneric(pMaterialGeneric);
       }
-    uint32_t addStyle(PRCStyle*& pStyle, uint32_t fileStructure=0)
+    uint32_t addStyle(PRCStyle*& pStyle, uint32_t fileStructure=m1)
       {
-        return fileStructures[fileStructure]->addStyle(pStyle);
+        return getFileStructure(fileStructure)->addStyle(pStyle);
       }
-    uint32_t addPartDefinition(PRCPartDefinition*& pPartDefinition, uint32_t fileStructure=0)
+    uint32_t addPartDefinition(PRCPartDefinition*& pPartDefinition, uint32_t fileStructure=m1)
       {
-        return fileStructures[fileStructure]->addPartDefinition(pPartDefinition);
+        return getFileStructure(fileStructure)->addPartDefinition(pPartDefinition);
       }
-    uint32_t addProductOccurrence(PRCProductOccurrence*& pProductOccurrence, uint32_t fileStructure=0)
+    uint32_t addProductOccurrence(PRCProductOccurrence*& pProductOccurrence, uint32_t fileStructure=m1)
       {
-        return fileStructures[fileStructure]->addProductOccurrence(pProductOccurrence);
+        return getFileStructure(fileStructure)->addProductOccurrence(pProductOccurrence);
       }
-    uint32_t addTopoContext(PRCTopoContext*& pTopoContext, uint32_t fileStructure=0)
+    uint32_t addTopoContext(PRCTopoContext*& pTopoContext, uint32_t fileStructure=m1)
       {
-        return fileStructures[fileStructure]->addTopoContext(pTopoContext);
+        return getFileStructure(fileStructure)->addTopoContext(pTopoContext);
       }
-    uint32_t getTopoContext(PRCTopoContext*& pTopoContext, uint32_t fileStructure=0)
+    uint32_t getTopoContext(PRCTopoContext*& pTopoContext, uint32_t fileStructure=m1)
     {
-      return fileStructures[fileStructure]->getTopoContext(pTopoContext);
+      return getFileStructure(fileStructure)->getTopoContext(pTopoContext);
     }
-    uint32_t add3DTess(PRC3DTess*& p3DTess, uint32_t fileStructure=0)
+    uint32_t add3DTess(PRC3DTess*& p3DTess, uint32_t fileStructure=m1)
       {
-        return fileStructures[fileStructure]->add3DTess(p3DTess);
+        return getFileStructure(fileStructure)->add3DTess(p3DTess);
       }
-    uint32_t add3DWireTess(PRC3DWireTess*& p3DWireTess, uint32_t fileStructure=0)
+    uint32_t add3DWireTess(PRC3DWireTess*& p3DWireTess, uint32_t fileStructure=m1)
       {
-        return fileStructures[fileStructure]->add3DWireTess(p3DWireTess);
+        return getFileStructure(fileStructure)->add3DWireTess(p3DWireTess);
       }
 /*
-    uint32_t addMarkupTess(PRCMarkupTess*& pMarkupTess, uint32_t fileStructure=0)
+    uint32_t addMarkupTess(PRCMarkupTess*& pMarkupTess, uint32_t fileStructure=m1)
       {
-        return fileStructures[fileStructure]->addMarkupTess(pMarkupTess);
+        return getFileStructure(fileStructure)->addMarkupTess(pMarkupTess);
       }
-    uint32_t addMarkup(PRCMarkup*& pMarkup, uint32_t fileStructure=0)
+    uint32_t addMarkup(PRCMarkup*& pMarkup, uint32_t fileStructure=m1)
       {
-        return fileStructures[fileStructure]->addMarkup(pMarkup);
+        return getFileStructure(fileStructure)->addMarkup(pMarkup);
       }
-    uint32_t addAnnotationItem(PRCAnnotationItem*& pAnnotationItem, uint32_t fileStructure=0)
+    uint32_t addAnnotationItem(PRCAnnotationItem*& pAnnotationItem, uint32_t fileStructure=m1)
       {
-        return fileStructures[fileStructure]->addAnnotationItem(pAnnotationItem);
+        return getFileStructure(fileStructure)->addAnnotationItem(pAnnotationItem);
       }
  */
-    uint32_t addCoordinateSystem(PRCCoordinateSystem*& pCoordinateSystem, uint32_t fileStructure=0)
+    uint32_t addCoordinateSystem(PRCCoordinateSystem*& pCoordinateSystem, uint32_t fileStructure=m1)
       {
-        return fileStructures[fileStructure]->addCoordinateSystem(pCoordinateSystem);
+        return getFileStructure(fileStructure)->addCoordinateSystem(pCoordinateSystem);
       }
-    uint32_t addCoordinateSystemUnique(PRCCoordinateSystem*& pCoordinateSystem, uint32_t fileStructure=0)
+    uint32_t addCoordinateSystemUnique(PRCCoordinateSystem*& pCoordinateSystem, uint32_t fileStructure=m1)
       {
-        return fileStructures[fileStructure]->addCoordinateSystemUnique(pCoordinateSystem);
+        return getFileStructure(fileStructure)->addCoordinateSystemUnique(pCoordinateSystem);
       }
   private:
+    void init();
     void serializeModelFileData(PRCbitStream&);
-    std::ofstream *fout;
-    std::ostream &output;
+    PRCbufferPool *buffer_pool;
+    PRCsink *ownedSink;
+    PRCsink &sink;
 };
 
 #endif // __O_PRC_FILE_H
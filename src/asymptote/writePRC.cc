@@ -22,6 +22,11 @@
 #include "writePRC.h"
 #include <climits>
 #include <cassert>
+#include <cstring>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PRC_SSE2
+#include <emmintrin.h>
+#endif
 
 // debug print includes
 #include <iostream>
@@ -70,9 +75,12 @@ uint32_t Log2(uint32_t x)
 }
 
 #define WriteUnsignedInteger( value ) pbs << (uint32_t)(value);
+#define WriteUnsignedIntegers( values ) pbs.writeUnsignedIntegers(values);
 #define WriteInteger( value ) pbs << (int32_t)(value);
 #define WriteCharacter( value ) pbs << (uint8_t)(value);
+#define WriteCharacters( values, size ) pbs.writeBytes(values,size);
 #define WriteDouble( value ) pbs << (double)(value);
+#define WriteDoubles( values ) pbs.writeDoubles(values);
 #define WriteBit( value ) pbs << (bool)(value);
 #define WriteBoolean( value ) pbs << (bool)(value);
 #define WriteString( value ) pbs << (value);
@@ -80,11 +88,11 @@ uint32_t Log2(uint32_t x)
 #define SerializeGraphics serializeGraphics(pbs);
 #define SerializePRCBaseWithGraphics { serializeContentPRCBase(pbs); serializeGraphics(pbs); }
 #define SerializeRepresentationItemContent serializeRepresentationItemContent(pbs);
-#define SerializeRepresentationItem( value ) (value)->serializeRepresentationItem(pbs);
+#define SerializeRepresentationItem( value ) { PRCentityScope entity(pbs); (value)->serializeRepresentationItem(pbs); }
 #define SerializeMarkup( value ) (value).serializeMarkup(pbs);
 #define SerializeReferenceUniqueIdentifier( value ) (value).serializeReferenceUniqueIdentifier(pbs);
 #define SerializeContentBaseTessData serializeContentBaseTessData(pbs);
-#define SerializeTessFace( value ) (value)->serializeTessFace(pbs);
+#define SerializeTessFace( value ) { PRCentityScope entity(pbs); (value)->serializeTessFace(pbs); }
 #define SerializeUserData UserData(0,0).write(pbs);
 #define SerializeLineAttr( value ) pbs << (uint32_t)((value)+1);
 #define SerializeVector3d( value ) (value).serializeVector3d(pbs);
@@ -98,16 +106,16 @@ uint32_t Log2(uint32_t x)
 #define SerializeTransformation  serializeTransformation(pbs);
 #define SerializeBaseTopology  serializeBaseTopology(pbs);
 #define SerializeBaseGeometry  serializeBaseGeometry(pbs);
-#define SerializePtrCurve( value )    {WriteBoolean( false ); if((value)==NULL) pbs << (uint32_t)PRC_TYPE_ROOT; else (value)->serializeCurve(pbs);}
-#define SerializePtrSurface( value )  {WriteBoolean( false ); if((value)==NULL) pbs << (uint32_t)PRC_TYPE_ROOT; else (value)->serializeSurface(pbs);}
-#define SerializePtrTopology( value ) {WriteBoolean( false ); if((value)==NULL) pbs << (uint32_t)PRC_TYPE_ROOT; else (value)->serializeTopoItem(pbs);}
+#define SerializePtrCurve( value )    {WriteBoolean( false ); if((value)==NULL) pbs << (uint32_t)PRC_TYPE_ROOT; else { PRCentityScope entity(pbs); (value)->serializeCurve(pbs); }}
+#define SerializePtrSurface( value )  {WriteBoolean( false ); if((value)==NULL) pbs << (uint32_t)PRC_TYPE_ROOT; else { PRCentityScope entity(pbs); (value)->serializeSurface(pbs); }}
+#define SerializePtrTopology( value ) {WriteBoolean( false ); if((value)==NULL) pbs << (uint32_t)PRC_TYPE_ROOT; else { PRCentityScope entity(pbs); (value)->serializeTopoItem(pbs); }}
 #define SerializeContentCurve  serializeContentCurve(pbs);
 #define SerializeContentWireEdge  serializeContentWireEdge(pbs);
 #define SerializeContentBody  serializeContentBody(pbs);
 #define SerializeTopoContext  serializeTopoContext(pbs);
 #define SerializeContextAndBodies( value )  (value).serializeContextAndBodies(pbs);
-#define SerializeBody( value )  (value)->serializeBody(pbs);
-#define ResetCurrentGraphics resetGraphics();
+#define SerializeBody( value )  { PRCentityScope entity(pbs); (value)->serializeBody(pbs); }
+#define ResetCurrentGraphics resetGraphics(pbs);
 #define SerializeContentSurface  serializeContentSurface(pbs);
 #define SerializeCompressedUniqueId( value ) (value).serializeCompressedUniqueId(pbs);
 #define SerializeUnit( value ) (value).serializeUnit(pbs);
@@ -172,16 +180,54 @@ void PRCVector2d::serializeVector2d(PRCbitStream &pbs)
   WriteDouble (y)
 }
 
+// contexts made current on this thread, innermost last
+static thread_local std::vector<PRCIdentifierContext*> identifierContexts;
+
+PRCIdentifierContext &PRCIdentifierContext::current()
+{
+  static thread_local PRCIdentifierContext threadContext;
+  return identifierContexts.empty() ? threadContext : *identifierContexts.back();
+}
+
+PRCIdentifierScope::PRCIdentifierScope(PRCIdentifierContext &c) :
+  context(c), contexts(identifierContexts)
+{
+  contexts.push_back(&context);
+}
+
+PRCIdentifierScope::~PRCIdentifierScope()
+{
+  // scopes need not end in the order they began
+  for(size_t i = contexts.size(); i-- > 0; )
+    if(contexts[i] == &context)
+    {
+      contexts.erase(contexts.begin()+i);
+      break;
+    }
+}
+
 uint32_t makeCADID()
 {
-  static uint32_t ID = 1;
-  return ID++;
+  return PRCIdentifierContext::current().nextCADID++;
 }
 
 uint32_t makePRCID()
 {
-  static uint32_t ID = 1;
-  return ID++;
+  return PRCIdentifierContext::current().nextPRCID++;
+}
+
+void getNextIDs(uint32_t &cad_id, uint32_t &prc_id)
+{
+  const PRCIdentifierContext &context = PRCIdentifierContext::current();
+  cad_id = context.nextCADID;
+  prc_id = context.nextPRCID;
+}
+
+void setNextIDs(uint32_t cad_id, uint32_t prc_id)
+{
+  PRCIdentifierContext &context = PRCIdentifierContext::current();
+  context.nextCADID = cad_id;
+  context.nextPRCID = prc_id;
 }
 
 bool type_eligible_for_reference(uint32_t type)
@@ -286,6 +332,7 @@ void PRCAttribute::serializeAttribute(PRCbitStream &pbs) const
 
 void PRCAttributes::serializeAttributes(PRCbitStream &pbs) const
 {
+  PRCpartScope part(pbs, PRCentityStatistics::Attributes);
   if (attributes.empty()) { // shortcut for most typical case
     const uint32_t number_of_attributes = 0;
     WriteUnsignedInteger (number_of_attributes) 
@@ -461,14 +508,12 @@ void PRCTextureApplication::serializeTextureApplication(PRCbitStream &pbs)
 
 void PRCLinePattern::serializeLinePattern(PRCbitStream &pbs)
 {
-  uint32_t i = 0;
   WriteUnsignedInteger (PRC_TYPE_GRAPH_LinePattern)
   SerializeContentPRCBase
   
   const uint32_t size_lengths = lengths.size();
   WriteUnsignedInteger (size_lengths)
-  for (i=0;i<size_lengths;i++)
-    WriteDouble (lengths[i])
+  WriteDoubles (lengths)
   WriteDouble (phase)
   WriteBoolean (is_real_length)
 }
@@ -503,10 +548,10 @@ void PRCStyle::serializeCategory1LineStyle(PRCbitStream &pbs)
      WriteCharacter (additional_3)
 }
 
-std::string currentName;
-
 void writeName(PRCbitStream &pbs,const std::string &name)
 {
+  PRCpartScope part(pbs, PRCentityStatistics::Names);
+  std::string &currentName = pbs.getSerializationContext().name;
   pbs << (name == currentName);
   if(name != currentName)
   {
@@ -515,24 +560,22 @@ void writeName(PRCbitStream &pbs,const std::string &name)
   }
 }
 
-void resetName()
+void resetName(PRCbitStream &pbs)
 {
-  currentName = "";
+  pbs.getSerializationContext().resetName();
 }
 
-uint32_t current_layer_index = m1;
-uint32_t current_index_of_line_style = m1;
-uint16_t current_behaviour_bit_field = 1;
-
 void writeGraphics(PRCbitStream &pbs,uint32_t l,uint32_t i,uint16_t b,bool force)
 {
-  if(force || current_layer_index != l || current_index_of_line_style != i || current_behaviour_bit_field != b)
+  PRCpartScope part(pbs, PRCentityStatistics::Graphics);
+  PRCSerializationContext &current = pbs.getSerializationContext();
+  if(force || current.layer_index != l || current.index_of_line_style != i || current.behaviour_bit_field != b)
   {
     pbs << false << (uint32_t)(l+1) << (uint32_t)(i+1)
         << (uint8_t)(b&0xFF) << (uint8_t)((b>>8)&0xFF);
-    current_layer_index = l;
-    current_index_of_line_style = i;
-    current_behaviour_bit_field = b;
+    current.layer_index = l;
+    current.index_of_line_style = i;
+    current.behaviour_bit_field = b;
   }
   else
     pbs << true;
@@ -540,16 +583,18 @@ void writeGraphics(PRCbitStream &pbs,uint32_t l,uint32_t i,uint16_t b,bool force
 
 void writeGraphics(PRCbitStream &pbs,const PRCGraphics &graphics,bool force)
 {
-  if(force || current_layer_index != graphics.layer_index || current_index_of_line_style != graphics.index_of_line_style || current_behaviour_bit_field != graphics.behaviour_bit_field)
+  PRCpartScope part(pbs, PRCentityStatistics::Graphics);
+  PRCSerializationContext &current = pbs.getSerializationContext();
+  if(force || current.layer_index != graphics.layer_index || current.index_of_line_style != graphics.index_of_line_style || current.behaviour_bit_field != graphics.behaviour_bit_field)
   {
     pbs << false
         << (uint32_t)(graphics.layer_index+1)
         << (uint32_t)(graphics.index_of_line_style+1)
         << (uint8_t)(graphics.behaviour_bit_field&0xFF)
         << (uint8_t)((graphics.behaviour_bit_field>>8)&0xFF);
-    current_layer_index = graphics.layer_index;
-    current_index_of_line_style = graphics.index_of_line_style;
-    current_behaviour_bit_field = graphics.behaviour_bit_field;
+    current.layer_index = graphics.layer_index;
+    current.index_of_line_style = graphics.index_of_line_style;
+    current.behaviour_bit_field = graphics.behaviour_bit_field;
   }
   else
     pbs << true;
@@ -557,16 +602,18 @@ void writeGraphics(PRCbitStream &pbs,const PRCGraphics &graphics,bool force)
 
 void PRCGraphics::serializeGraphics(PRCbitStream &pbs)
 {
-  if(current_layer_index != this->layer_index || current_index_of_line_style != this->index_of_line_style || current_behaviour_bit_field != this->behaviour_bit_field)
+  PRCpartScope part(pbs, PRCentityStatistics::Graphics);
+  PRCSerializationContext &current = pbs.getSerializationContext();
+  if(current.layer_index != this->layer_index || current.index_of_line_style != this->index_of_line_style || current.behaviour_bit_field != this->behaviour_bit_field)
   {
     pbs << false
         << (uint32_t)(this->layer_index+1)
         << (uint32_t)(this->index_of_line_style+1)
         << (uint8_t)(this->behaviour_bit_field&0xFF)
         << (uint8_t)((this->behaviour_bit_field>>8)&0xFF);
-    current_layer_index = this->layer_index;
-    current_index_of_line_style = this->index_of_line_style;
-    current_behaviour_bit_field = this->behaviour_bit_field;
+    current.layer_index = this->layer_index;
+    current.index_of_line_style = this->index_of_line_style;
+    current.behaviour_bit_field = this->behaviour_bit_field;
   }
   else
     pbs << true;
@@ -574,26 +621,26 @@ void PRCGraphics::serializeGraphics(PRCbitStream &pbs)
 
 void PRCGraphics::serializeGraphicsForced(PRCbitStream &pbs)
 {
+  PRCpartScope part(pbs, PRCentityStatistics::Graphics);
+  PRCSerializationContext &current = pbs.getSerializationContext();
   pbs << false
       << (uint32_t)(this->layer_index+1)
       << (uint32_t)(this->index_of_line_style+1)
       << (uint8_t)(this->behaviour_bit_field&0xFF)
       << (uint8_t)((this->behaviour_bit_field>>8)&0xFF);
-  current_layer_index = this->layer_index;
-  current_index_of_line_style = this->index_of_line_style;
-  current_behaviour_bit_field = this->behaviour_bit_field;
+  current.layer_index = this->layer_index;
+  current.index_of_line_style = this->index_of_line_style;
+  current.behaviour_bit_field = this->behaviour_bit_field;
 }
 
-void resetGraphics()
+void resetGraphics(PRCbitStream &pbs)
 {
-  current_layer_index = m1;
-  current_index_of_line_style = m1;
-  current_behaviour_bit_field = 1;
+  pbs.getSerializationContext().resetGraphics();
 }
 
-void resetGraphicsAndName()
+void resetGraphicsAndName(PRCbitStream &pbs)
 {
-  resetGraphics(); resetName();
+  pbs.getSerializationContext().reset();
 }
 
 void  PRCMarkup::serializeMarkup(PRCbitStream &pbs)
@@ -635,6 +682,29 @@ void  PRCRepresentationItemContent::serializeRepresentationItemContent(PRCbitStr
   WriteUnsignedInteger (index_tessellation + 1)
 }
 
+void  PRCRepresentationItem::serializeRepresentationItem(PRCbitStream &pbs)
+{
+  switch(type)
+  {
+    case PRC_TYPE_RI_BrepModel:
+      static_cast<PRCBrepModel*>(this)->serializeBrepModel(pbs); break;
+    case PRC_TYPE_RI_PolyBrepModel:
+      static_cast<PRCPolyBrepModel*>(this)->serializePolyBrepModel(pbs); break;
+    case PRC_TYPE_RI_PointSet:
+      static_cast<PRCPointSet*>(this)->serializePointSet(pbs); break;
+    case PRC_TYPE_RI_Set:
+      static_cast<PRCSet*>(this)->serializeSet(pbs); break;
+    case PRC_TYPE_RI_Curve:
+      static_cast<PRCWire*>(this)->serializeWire(pbs); break;
+    case PRC_TYPE_RI_PolyWire:
+      static_cast<PRCPolyWire*>(this)->serializePolyWire(pbs); break;
+    case PRC_TYPE_RI_CoordinateSystem:
+      static_cast<PRCCoordinateSystem*>(this)->serializeCoordinateSystem(pbs); break;
+    default:
+      cerr << "unknown representation item type " << type << endl;
+  }
+}
+
 void  PRCBrepModel::serializeBrepModel(PRCbitStream &pbs)
 {
    WriteUnsignedInteger (PRC_TYPE_RI_BrepModel)
@@ -863,6 +933,7 @@ void  PRCFontKeysSameFont::serializeFontKeysSameFont(PRCbitStream &pbs)
 
 void SerializeArrayRGBA (const std::vector<uint8_t> &rgba_vertices,const bool is_rgba, PRCbitStream &pbs)
 {
+  PRCpartScope part(pbs, PRCentityStatistics::Colours);
   uint32_t i = 0;
   uint32_t j = 0;
 // number_by_vector can be assigned a value of 3 (RGB) or 4 (RGBA).
@@ -872,25 +943,21 @@ void SerializeArrayRGBA (const std::vector<uint8_t> &rgba_vertices,const bool is
   const uint32_t number_of_colors=vector_color.size();
   const uint32_t number_of_vectors=number_of_colors / number_by_vector;
   // first one 
-  for (i=0;i<number_by_vector;i++)
-     WriteCharacter (vector_color[i])
+  WriteCharacters (&vector_color[0], number_by_vector)
   
   for (i=1;i<number_of_vectors;i++)
   {
-     bool b_same = true;
-     for (j=0;j<number_by_vector;j++)
-     {
-        if ((vector_color[i*number_by_vector+j] - vector_color[(i-1)*number_by_vector+j]) != 0)
-        {
-           b_same = false;
-           break;
-        }
-     }
-     WriteBoolean (b_same)
-     if (!b_same)
+     const uint8_t *color = &vector_color[i*number_by_vector];
+     const bool b_same = memcmp(color,color-number_by_vector,number_by_vector) == 0;
+     if (b_same)
+        WriteBoolean (b_same)
+     else
      {
+        // the false flag and the components in one write
+        uint64_t bits = 0;
         for (j=0;j<number_by_vector;j++)
-           WriteCharacter (vector_color[i*number_by_vector+j])
+           bits = bits << 8 | color[j];
+        pbs.writeBits(bits,1+8*number_by_vector);
      }
   }
 }
@@ -908,16 +975,14 @@ void  PRCTessFace::serializeTessFace(PRCbitStream &pbs)
   WriteUnsignedInteger (start_wire) 
   const uint32_t size_of_sizes_wire=sizes_wire.size();
   WriteUnsignedInteger (size_of_sizes_wire) 
-  for (i=0;i<size_of_sizes_wire;i++) 
-     WriteUnsignedInteger (sizes_wire[i])
+  WriteUnsignedIntegers (sizes_wire)
 
   WriteUnsignedInteger (used_entities_flag) 
 
   WriteUnsignedInteger (start_triangulated) 
   const uint32_t size_of_sizes_triangulated=sizes_triangulated.size();
   WriteUnsignedInteger (size_of_sizes_triangulated) 
-  for (i=0;i<size_of_sizes_triangulated;i++) 
-     WriteUnsignedInteger (sizes_triangulated[i])
+  WriteUnsignedIntegers (sizes_triangulated)
 
   if(number_of_texture_coordinate_indexes==0 &&
      used_entities_flag &
@@ -957,12 +1022,26 @@ void  PRCTessFace::serializeTessFace(PRCbitStream &pbs)
 
 void  PRCContentBaseTessData::serializeContentBaseTessData(PRCbitStream &pbs)
 {
-  uint32_t i=0; // universal index for PRC standart compatibility
   WriteBoolean (is_calculated)
   const uint32_t number_of_coordinates = coordinates.size();
   WriteUnsignedInteger (number_of_coordinates)
-  for (i=0;i<number_of_coordinates;i++)
-     WriteDouble (coordinates[i])
+  PRCpartScope part(pbs, PRCentityStatistics::Coordinates);
+  WriteDoubles (coordinates)
+}
+
+void  PRCTess::serializeBaseTessData(PRCbitStream &pbs)
+{
+  switch(tess_type)
+  {
+    case PRC_TYPE_TESS_3D:
+      static_cast<PRC3DTess*>(this)->serialize3DTess(pbs); break;
+    case PRC_TYPE_TESS_3D_Wire:
+      static_cast<PRC3DWireTess*>(this)->serialize3DWireTess(pbs); break;
+    case PRC_TYPE_TESS_Markup:
+      static_cast<PRCMarkupTess*>(this)->serializeMarkupTess(pbs); break;
+    default:
+      cerr << "unknown tessellation type " << tess_type << endl;
+  }
 }
 
 void  PRC3DTess::serialize3DTess(PRCbitStream &pbs)
@@ -985,19 +1064,22 @@ void  PRC3DTess::serialize3DTess(PRCbitStream &pbs)
   
   const uint32_t number_of_normal_coordinates=normal_coordinate.size();
   WriteUnsignedInteger (number_of_normal_coordinates)
-  for (i=0;i<number_of_normal_coordinates;i++)
-     WriteDouble (normal_coordinate[i])
+  {
+    PRCpartScope part(pbs, PRCentityStatistics::Normals);
+    WriteDoubles (normal_coordinate)
+  }
   
-  const uint32_t number_of_wire_indices=wire_index.size();
-  WriteUnsignedInteger (number_of_wire_indices)
-  for (i=0;i<number_of_wire_indices;i++)
-     WriteUnsignedInteger (wire_index[i])
+  {
+    PRCpartScope part(pbs, PRCentityStatistics::Indices);
+    const uint32_t number_of_wire_indices=wire_index.size();
+    WriteUnsignedInteger (number_of_wire_indices)
+    WriteUnsignedIntegers (wire_index)
   
-  // note : those can be single triangles, triangle fans or stripes
-  const uint32_t number_of_triangulated_indices=triangulated_index.size();
-  WriteUnsignedInteger (number_of_triangulated_indices)
-  for (i=0;i<number_of_triangulated_indices;i++)
-     WriteUnsignedInteger (triangulated_index[i])
+    // note : those can be single triangles, triangle fans or stripes
+    const uint32_t number_of_triangulated_indices=triangulated_index.size();
+    WriteUnsignedInteger (number_of_triangulated_indices)
+    WriteUnsignedIntegers (triangulated_index)
+  }
   
   const uint32_t number_of_face_tessellation=face_tessellation.size();
   WriteUnsignedInteger (number_of_face_tessellation)
@@ -1006,8 +1088,8 @@ void  PRC3DTess::serialize3DTess(PRCbitStream &pbs)
   
   const uint32_t number_of_texture_coordinates=texture_coordinate.size();
   WriteUnsignedInteger (number_of_texture_coordinates)
-  for (i=0;i<number_of_texture_coordinates;i++)
-     WriteDouble (texture_coordinate[i])
+  PRCpartScope part(pbs, PRCentityStatistics::TextureCoordinates);
+  WriteDoubles (texture_coordinate)
 }
 
 void PRC3DTess::addTessFace(PRCTessFace*& pTessFace)
@@ -1020,13 +1102,14 @@ void  PRC3DWireTess::serialize3DWireTess(PRCbitStream &pbs)
 {
 // group___tf3_d_wire_tess_data_____serialize2.html
 // group___tf3_d_wire_tess_data_____serialize_content2.html
-  uint32_t i=0; // universal index for PRC standart compatibility
   WriteUnsignedInteger (PRC_TYPE_TESS_3D_Wire)
   SerializeContentBaseTessData 
-  const uint32_t number_of_wire_indexes=wire_indexes.size();
-  WriteUnsignedInteger (number_of_wire_indexes)
-  for (i=0;i<number_of_wire_indexes;i++)
-     WriteUnsignedInteger (wire_indexes[i])
+  {
+    PRCpartScope part(pbs, PRCentityStatistics::Indices);
+    const uint32_t number_of_wire_indexes=wire_indexes.size();
+    WriteUnsignedInteger (number_of_wire_indexes)
+    WriteUnsignedIntegers (wire_indexes)
+  }
   
   const bool has_vertex_colors = !rgba_vertices.empty();
   WriteBoolean (has_vertex_colors)
@@ -1057,8 +1140,7 @@ void  PRCMarkupTess::serializeMarkupTess(PRCbitStream &pbs)
 
   const uint32_t number_of_codes=codes.size();
   WriteUnsignedInteger (number_of_codes)
-  for (i=0;i<number_of_codes;i++)
-     WriteUnsignedInteger (codes[i])
+  WriteUnsignedIntegers (codes)
   const uint32_t number_of_texts=texts.size();
   WriteUnsignedInteger (number_of_texts)
   for (i=0;i<number_of_texts;i++)
@@ -1102,6 +1184,28 @@ void PRCBaseGeometry::serializeBaseGeometry(PRCbitStream &pbs)
    }
 }
 
+void PRCBody::serializeBody(PRCbitStream &pbs)
+{
+  switch(topo_item_type)
+  {
+    case PRC_TYPE_TOPO_SingleWireBody:
+      static_cast<PRCSingleWireBody*>(this)->serializeSingleWireBody(pbs); break;
+    case PRC_TYPE_TOPO_BrepData:
+      static_cast<PRCBrepData*>(this)->serializeBrepData(pbs); break;
+    case PRC_TYPE_TOPO_BrepDataCompress:
+      static_cast<PRCCompressedBrepData*>(this)->serializeCompressedBrepData(pbs); break;
+    default:
+      cerr << "unknown body type " << topo_item_type << endl;
+  }
+}
+
+double PRCBody::serialTolerance()
+{
+  if(topo_item_type == PRC_TYPE_TOPO_BrepDataCompress)
+    return static_cast<PRCCompressedBrepData*>(this)->serial_tolerance;
+  return 0;
+}
+
 void PRCContentBody::serializeContentBody(PRCbitStream &pbs)
 {
    SerializeBaseTopology
@@ -1194,29 +1298,39 @@ void  PRCNURBSSurface::serializeNURBSSurface(PRCbitStream &pbs)
    WriteUnsignedInteger ( surface_form )
 }
 
+// value saturates to all ones if it does not fit in bit_number bits
+static inline uint32_t saturateToBitNumber(uint32_t value, uint32_t bit_number)
+{
+   if(bit_number < 32 && (value >> bit_number) != 0)
+      return (1u << bit_number) - 1;
+   return value;
+}
+
 void writeUnsignedIntegerWithVariableBitNumber(PRCbitStream &pbs, uint32_t value, uint32_t bit_number)
 {
-   uint32_t i;
-   for(i=0; i<bit_number; i++)
-   {
-      if( value >= 1u<<(bit_number - 1 - i) )
-      {
-         WriteBoolean (true)
-      
-         value -= 1u<<(bit_number - 1 - i);
-      }
-      else
-      {
-         WriteBoolean (false)
-      }
-   }
+   if(bit_number > 32)
+      bit_number = 32;
+   pbs.writeBits(saturateToBitNumber(value, bit_number), bit_number);
 }
 #define WriteUnsignedIntegerWithVariableBitNumber( value, bit_number )  writeUnsignedIntegerWithVariableBitNumber( pbs, (value), (bit_number) );
 
+// sign bit, then the absolute value on the remaining bits; 0 < uBitNumber <= 33
+static inline uint64_t integerWithVariableBitNumber(int32_t iValue, uint32_t uBitNumber)
+{
+  const uint32_t uAbsValue = iValue<0 ? 0u-(uint32_t)iValue : (uint32_t)iValue;
+  return ((uint64_t)(iValue<0) << (uBitNumber-1)) | saturateToBitNumber(uAbsValue, uBitNumber-1);
+}
+
 void writeIntegerWithVariableBitNumber(PRCbitStream &pbs, int32_t iValue, uint32_t uBitNumber)
 { 
-  WriteBoolean(iValue<0);
-  WriteUnsignedIntegerWithVariableBitNumber(abs(iValue), uBitNumber - 1);
+  if(uBitNumber == 0)
+  {
+    WriteBoolean(iValue<0);
+    return;
+  }
+  if(uBitNumber > 33)
+    uBitNumber = 33;
+  pbs.writeBits(integerWithVariableBitNumber(iValue, uBitNumber), uBitNumber);
 }
 #define WriteIntegerWithVariableBitNumber( value, bit_number )  writeIntegerWithVariableBitNumber( pbs, (value), (bit_number) );
 
@@ -1230,27 +1344,21 @@ void writeDoubleWithVariableBitNumber(PRCbitStream &pbs, double dValue,double dT
 
 uint32_t  GetNumberOfBitsUsedToStoreUnsignedInteger(uint32_t uValue)
 {
-  uint32_t uNbBit=2;
-  uint32_t uTemp = 2;
-  while(uValue >= uTemp)
-  {
-    uTemp*=2;
-    uNbBit++;
-  }
-  return uNbBit-1;
+  // at least one bit, even for 0
+  return uValue < 2 ? 1 : 32-CLZ(uValue);
 }
 
 void  writeNumberOfBitsThenUnsignedInteger(PRCbitStream &pbs, uint32_t unsigned_integer)
 {
-   uint32_t number_of_bits = GetNumberOfBitsUsedToStoreUnsignedInteger( unsigned_integer );
-   WriteUnsignedIntegerWithVariableBitNumber ( number_of_bits, 5 )
-   WriteUnsignedIntegerWithVariableBitNumber ( unsigned_integer, number_of_bits )
+   const uint32_t number_of_bits = GetNumberOfBitsUsedToStoreUnsignedInteger( unsigned_integer );
+   // number of bits on 5 bits, then the value
+   pbs.writeBits(((uint64_t)saturateToBitNumber(number_of_bits, 5) << number_of_bits) | unsigned_integer, 5+number_of_bits);
 }
 #define WriteNumberOfBitsThenUnsignedInteger( value ) writeNumberOfBitsThenUnsignedInteger( pbs, value );
 
 uint32_t  GetNumberOfBitsUsedToStoreInteger(int32_t iValue)
 {
-   return GetNumberOfBitsUsedToStoreUnsignedInteger(abs(iValue))+1;
+   return GetNumberOfBitsUsedToStoreUnsignedInteger(iValue<0 ? 0u-(uint32_t)iValue : (uint32_t)iValue)+1;
 }
 
 int32_t intdiv(double dValue, double dTolerance)
@@ -1271,54 +1379,308 @@ double roundto(double dValue, double dTolerance)
     return intdiv(dValue, dTolerance) * dTolerance;
 }
 
-PRCVector3d roundto(PRCVector3d vec, double dTolerance)
+uint32_t  GetNumberOfBitsUsedToStoreDouble(double dValue, double dTolerance )
 {
-    PRCVector3d res;
-    res.x = roundto(vec.x,dTolerance);
-    res.y = roundto(vec.y,dTolerance);
-    res.z = roundto(vec.z,dTolerance);
-    return    res;
+   return GetNumberOfBitsUsedToStoreInteger(intdiv(dValue,dTolerance));
 }
 
-uint32_t  GetNumberOfBitsUsedToStoreDouble(double dValue, double dTolerance )
+static inline uint32_t maxBitsOfTriple(uint32_t bits, int32_t x, int32_t y, int32_t z)
 {
-   return GetNumberOfBitsUsedToStoreInteger(intdiv(dValue,dTolerance));
+  const uint32_t ux = x<0 ? 0u-(uint32_t)x : (uint32_t)x;
+  const uint32_t uy = y<0 ? 0u-(uint32_t)y : (uint32_t)y;
+  const uint32_t uz = z<0 ? 0u-(uint32_t)z : (uint32_t)z;
+  // the bits of the largest absolute value are the most of the three
+  const uint32_t triple_bits = GetNumberOfBitsUsedToStoreUnsignedInteger(ux|uy|uz)+1;
+  return triple_bits > bits ? triple_bits : bits;
 }
 
-struct itriple
+// A double for each of two faces predicted together, and a condition on
+// them: SSE2 registers where there are, else pairs. Both do the IEEE
+// operations of the scalar prediction in its order, so that the points
+// do not depend on which is used; a condition is computed for both lanes
+// and chooses between results computed for both.
+#ifdef PRC_SSE2
+class PRCmaskPair
 {
-  int32_t x;
-  int32_t y;
-  int32_t z;
+  public:
+    PRCmaskPair(__m128d m) : m(m) {}
+    PRCmaskPair operator&(const PRCmaskPair &b) const { return _mm_and_pd(m,b.m); }
+    PRCmaskPair operator|(const PRCmaskPair &b) const { return _mm_or_pd(m,b.m); }
+    // this and not b
+    PRCmaskPair andNot(const PRCmaskPair &b) const { return _mm_andnot_pd(b.m,m); }
+    __m128d m;
+};
+
+class PRCdoublePair
+{
+  public:
+    PRCdoublePair() {}
+    PRCdoublePair(__m128d v) : v(v) {}
+    PRCdoublePair(double d) : v(_mm_set1_pd(d)) {}
+    PRCdoublePair(double a, double b) : v(_mm_set_pd(b,a)) {}
+    double operator[](int lane) const { double d[2]; _mm_storeu_pd(d,v); return d[lane]; }
+    PRCdoublePair operator+(const PRCdoublePair &b) const { return _mm_add_pd(v,b.v); }
+    PRCdoublePair operator-(const PRCdoublePair &b) const { return _mm_sub_pd(v,b.v); }
+    PRCdoublePair operator*(const PRCdoublePair &b) const { return _mm_mul_pd(v,b.v); }
+    PRCdoublePair operator/(const PRCdoublePair &b) const { return _mm_div_pd(v,b.v); }
+    PRCmaskPair operator<(const PRCdoublePair &b) const { return _mm_cmplt_pd(v,b.v); }
+    PRCmaskPair operator>=(const PRCdoublePair &b) const { return _mm_cmpge_pd(v,b.v); }
+    friend PRCdoublePair sqrt(const PRCdoublePair &a) { return _mm_sqrt_pd(a.v); }
+    friend PRCdoublePair fabs(const PRCdoublePair &a) { return _mm_andnot_pd(_mm_set1_pd(-0.0),a.v); }
+    // toward zero, as (int32_t) does for values that fit
+    friend PRCdoublePair truncate(const PRCdoublePair &a) { return _mm_cvtepi32_pd(_mm_cvttpd_epi32(a.v)); }
+    // a where the condition holds, else b
+    friend PRCdoublePair choose(const PRCmaskPair &c, const PRCdoublePair &a, const PRCdoublePair &b)
+    { return _mm_or_pd(_mm_and_pd(c.m,a.v),_mm_andnot_pd(c.m,b.v)); }
+  private:
+    __m128d v;
+};
+#else
+class PRCmaskPair
+{
+  public:
+    PRCmaskPair(bool a, bool b) { m[0] = a; m[1] = b; }
+    PRCmaskPair operator&(const PRCmaskPair &b) const { return PRCmaskPair(m[0] && b.m[0],m[1] && b.m[1]); }
+    PRCmaskPair operator|(const PRCmaskPair &b) const { return PRCmaskPair(m[0] || b.m[0],m[1] || b.m[1]); }
+    PRCmaskPair andNot(const PRCmaskPair &b) const { return PRCmaskPair(m[0] && !b.m[0],m[1] && !b.m[1]); }
+    bool m[2];
 };
 
-uint32_t  GetNumberOfBitsUsedToStoreTripleInteger(const itriple &iTriple)
+class PRCdoublePair
+{
+  public:
+    PRCdoublePair() {}
+    PRCdoublePair(double d) { v[0] = v[1] = d; }
+    PRCdoublePair(double a, double b) { v[0] = a; v[1] = b; }
+    double operator[](int lane) const { return v[lane]; }
+    PRCdoublePair operator+(const PRCdoublePair &b) const { return PRCdoublePair(v[0]+b.v[0],v[1]+b.v[1]); }
+    PRCdoublePair operator-(const PRCdoublePair &b) const { return PRCdoublePair(v[0]-b.v[0],v[1]-b.v[1]); }
+    PRCdoublePair operator*(const PRCdoublePair &b) const { return PRCdoublePair(v[0]*b.v[0],v[1]*b.v[1]); }
+    PRCdoublePair operator/(const PRCdoublePair &b) const { return PRCdoublePair(v[0]/b.v[0],v[1]/b.v[1]); }
+    PRCmaskPair operator<(const PRCdoublePair &b) const { return PRCmaskPair(v[0]<b.v[0],v[1]<b.v[1]); }
+    PRCmaskPair operator>=(const PRCdoublePair &b) const { return PRCmaskPair(v[0]>=b.v[0],v[1]>=b.v[1]); }
+    friend PRCdoublePair sqrt(const PRCdoublePair &a) { return PRCdoublePair(::sqrt(a.v[0]),::sqrt(a.v[1])); }
+    friend PRCdoublePair fabs(const PRCdoublePair &a) { return PRCdoublePair(::fabs(a.v[0]),::fabs(a.v[1])); }
+    // toward zero, as (int32_t) does for values that fit; the others are
+    // not selected
+    friend PRCdoublePair truncate(const PRCdoublePair &a)
+    { return PRCdoublePair(truncateDouble(a.v[0]),truncateDouble(a.v[1])); }
+    friend PRCdoublePair choose(const PRCmaskPair &c, const PRCdoublePair &a, const PRCdoublePair &b)
+    { return PRCdoublePair(c.m[0] ? a.v[0] : b.v[0],c.m[1] ? a.v[1] : b.v[1]); }
+  private:
+    static double truncateDouble(double d) { return ::fabs(d) <= INT_MAX ? (double)(int32_t)d : 0; }
+    double v[2];
+};
+#endif
+
+// intdiv() of each lane, as a double
+static inline PRCdoublePair intdiv(const PRCdoublePair &value, const PRCdoublePair &tolerance)
 {
-   const uint32_t x_bits = GetNumberOfBitsUsedToStoreInteger(iTriple.x);
-   const uint32_t y_bits = GetNumberOfBitsUsedToStoreInteger(iTriple.y);
-   const uint32_t z_bits = GetNumberOfBitsUsedToStoreInteger(iTriple.z);
-   uint32_t bits = x_bits;
-   if(y_bits > bits)
-     bits = y_bits;
-   if(z_bits > bits)
-     bits = z_bits;
-   return bits;
+  const PRCdoublePair ratio = fabs(value)/tolerance;
+  const PRCdoublePair q = truncate(ratio);
+  const PRCdoublePair rounded = choose(ratio-q >= PRCdoublePair(0.5), q+PRCdoublePair(1.0), q);
+  return choose(value < PRCdoublePair(0.0), PRCdoublePair(0.0)-rounded, rounded);
 }
 
-itriple iroundto(PRCVector3d vec, double dTolerance)
+// Predict the control points of two faces of the same degree at once,
+// one in each lane; a and b may be the same face, for one alone.
+static void predictCompressedNurbs(const PRCCompressedFace &a, const PRCCompressedFace &b, double tolerance,
+                                   PRCcompressedNurbsPoints &points_a, PRCcompressedNurbsPoints &points_b)
 {
-    itriple res;
-    res.x = intdiv(vec.x, dTolerance);
-    res.y = intdiv(vec.y, dTolerance);
-    res.z = intdiv(vec.z, dTolerance);
-    return    res;
+   const uint32_t size = a.degree+1;
+   const uint32_t n = size*size;
+   PRCdoublePair px[16], py[16], pz[16];
+   for(uint32_t k=0; k<n; k++)
+   {
+      px[k] = PRCdoublePair(a.control_point[k].x, b.control_point[k].x);
+      py[k] = PRCdoublePair(a.control_point[k].y, b.control_point[k].y);
+      pz[k] = PRCdoublePair(a.control_point[k].z, b.control_point[k].z);
+   }
+   PRCcompressedNurbsPoints *points[2] = { &points_a, &points_b };
+   for(int lane = 0; lane < 2; ++lane)
+   {
+      points[lane]->size = size;
+      points[lane]->first[0] = px[0][lane];
+      points[lane]->first[1] = py[0][lane];
+      points[lane]->first[2] = pz[0][lane];
+   }
+   const PRCdoublePair t = tolerance;
+
+   // the first row and column, from the point before
+   uint32_t bits[2] = { 1, 1 };
+   for(uint32_t k = 1; k < n; k = (k+1 < size) ? k+1 : ((k < size) ? size : k+size))
+   {
+      const uint32_t previous = k < size ? k-1 : k-size;
+      const PRCdoublePair qx = intdiv(px[k]-px[previous], t);
+      const PRCdoublePair qy = intdiv(py[k]-py[previous], t);
+      const PRCdoublePair qz = intdiv(pz[k]-pz[previous], t);
+      px[k] = px[previous] + qx*t;
+      py[k] = py[previous] + qy*t;
+      pz[k] = pz[previous] + qz*t;
+      for(int lane = 0; lane < 2; ++lane)
+      {
+         points[lane]->type[k] = 0;
+         points[lane]->x[k] = (int32_t)qx[lane];
+         points[lane]->y[k] = (int32_t)qy[lane];
+         points[lane]->z[k] = (int32_t)qz[lane];
+         bits[lane] = maxBitsOfTriple(bits[lane], points[lane]->x[k], points[lane]->y[k], points[lane]->z[k]);
+      }
+   }
+   for(int lane = 0; lane < 2; ++lane)
+   {
+      points[lane]->number_of_bits_for_isomin = bits[lane];
+      bits[lane] = 1;
+   }
+
+   // The others, from the parallelogram of the three points before. Each
+   // is predicted in every way, and its type then selects one: 0 on the
+   // parallelogram, 1 off it along the normal, 2 in its plane, 3 anywhere.
+   const PRCdoublePair zero = 0.0, tolerance2 = tolerance*tolerance, half_tolerance = tolerance/2;
+   const PRCdoublePair epsilon = FLT_EPSILON;
+   for(uint32_t i = 1; i < size; i++)
+   for(uint32_t j = 1; j < size; j++)
+   {
+      const uint32_t k = i*size+j, k00 = k-size-1, k01 = k-size, k10 = k-1;
+      const PRCdoublePair Vx = px[k01]-px[k00], Vy = py[k01]-py[k00], Vz = pz[k01]-pz[k00];
+      const PRCdoublePair Ux = px[k10]-px[k00], Uy = py[k10]-py[k00], Uz = pz[k10]-pz[k00];
+      const PRCdoublePair Bx = (px[k00]+Ux)+Vx, By = (py[k00]+Uy)+Vy, Bz = (pz[k00]+Uz)+Vz;
+      const PRCdoublePair Pcx = px[k]-Bx, Pcy = py[k]-By, Pcz = pz[k]-Bz;
+      const PRCmaskPair on = sqrt(Pcx*Pcx+Pcy*Pcy+Pcz*Pcz) < t;
+
+      const PRCdoublePair Nx = (Uy*Vz)-(Uz*Vy), Ny = (Uz*Vx)-(Ux*Vz), Nz = (Ux*Vy)-(Uy*Vx);
+      const PRCdoublePair V_length = sqrt(Vx*Vx+Vy*Vy+Vz*Vz);
+      const PRCdoublePair U_length = sqrt(Ux*Ux+Uy*Uy+Uz*Uz);
+      const PRCdoublePair N_length = sqrt(Nx*Nx+Ny*Ny+Nz*Nz);
+      const PRCmaskPair frame = ((V_length >= epsilon) & (U_length >= epsilon) & (N_length >= epsilon)).andNot(on);
+      const PRCdoublePair u_factor = PRCdoublePair(1.0)/U_length, n_factor = PRCdoublePair(1.0)/N_length;
+      const PRCdoublePair Uex = Ux*u_factor, Uey = Uy*u_factor, Uez = Uz*u_factor;
+      const PRCdoublePair Nex = Nx*n_factor, Ney = Ny*n_factor, Nez = Nz*n_factor;
+      const PRCdoublePair NUex = (Ney*Uez)-(Nez*Uey), NUey = (Nez*Uex)-(Nex*Uez), NUez = (Nex*Uey)-(Ney*Uex);
+      const PRCdoublePair x = (Pcx*Uex)+(Pcy*Uey)+(Pcz*Uez);
+      const PRCdoublePair y = (Pcx*NUex)+(Pcy*NUey)+(Pcz*NUez);
+      const PRCdoublePair z = (Pcx*Nex)+(Pcy*Ney)+(Pcz*Nez);
+      const PRCmaskPair normal = frame & (x*x+y*y < tolerance2);
+      const PRCmaskPair plane = frame.andNot(normal) & (fabs(z) < half_tolerance);
+
+      const PRCdoublePair qz1 = intdiv(z, t), rz = qz1*t;
+      const PRCdoublePair qx2 = intdiv(x, t), qy2 = intdiv(y, t), rx = qx2*t, ry = qy2*t;
+      const PRCdoublePair qx3 = intdiv(Pcx, t), qy3 = intdiv(Pcy, t), qz3 = intdiv(Pcz, t);
+      px[k] = choose(on, Bx, choose(normal, Bx + Nex*rz, choose(plane, (Bx + Uex*rx) + NUex*ry, Bx + qx3*t)));
+      py[k] = choose(on, By, choose(normal, By + Ney*rz, choose(plane, (By + Uey*rx) + NUey*ry, By + qy3*t)));
+      pz[k] = choose(on, Bz, choose(normal, Bz + Nez*rz, choose(plane, (Bz + Uez*rx) + NUez*ry, Bz + qz3*t)));
+      const PRCdoublePair qx = choose(on | normal, zero, choose(plane, qx2, qx3));
+      const PRCdoublePair qy = choose(on | normal, zero, choose(plane, qy2, qy3));
+      const PRCdoublePair qz = choose(on | plane, zero, choose(normal, qz1, qz3));
+      const PRCdoublePair type = choose(on, zero, choose(normal, PRCdoublePair(1.0), choose(plane, PRCdoublePair(2.0), PRCdoublePair(3.0))));
+      for(int lane = 0; lane < 2; ++lane)
+      {
+         points[lane]->type[k] = (uint32_t)type[lane];
+         points[lane]->x[k] = (int32_t)qx[lane];
+         points[lane]->y[k] = (int32_t)qy[lane];
+         points[lane]->z[k] = (int32_t)qz[lane];
+         bits[lane] = maxBitsOfTriple(bits[lane], points[lane]->x[k], points[lane]->y[k], points[lane]->z[k]);
+      }
+   }
+   for(int lane = 0; lane < 2; ++lane)
+   {
+      if( bits[lane] == 2 ) bits[lane]--; // really I think it must be unconditional, but so it seems to be done in Adobe Acrobat (9.3)
+      points[lane]->number_of_bits_for_rest = bits[lane];
+   }
+}
+
+// Write the points, all that one needs in a single call when it fits
+static void writeCompressedNurbsPoints(PRCbitStream &pbs, const PRCcompressedNurbsPoints &points)
+{
+   const uint32_t size = points.size;
+   WriteUnsignedIntegerWithVariableBitNumber ( points.number_of_bits_for_isomin, 20 )
+   WriteUnsignedIntegerWithVariableBitNumber ( points.number_of_bits_for_rest,   20 )
+   WriteDouble ( points.first[0] )
+   WriteDouble ( points.first[1] )
+   WriteDouble ( points.first[2] )
+
+   uint32_t bit_number = points.number_of_bits_for_isomin+1;
+   if(bit_number > 33)
+     bit_number = 33;
+   for(uint32_t k = 1; k < size*size; k = (k+1 < size) ? k+1 : ((k < size) ? size : k+size))
+   {
+      const uint64_t x = integerWithVariableBitNumber(points.x[k], bit_number);
+      const uint64_t y = integerWithVariableBitNumber(points.y[k], bit_number);
+      const uint64_t z = integerWithVariableBitNumber(points.z[k], bit_number);
+      if(3*bit_number <= 57)
+        pbs.writeBits((x << 2*bit_number) | (y << bit_number) | z, 3*bit_number);
+      else
+      {
+        pbs.writeBits(x, bit_number);
+        pbs.writeBits(y, bit_number);
+        pbs.writeBits(z, bit_number);
+      }
+   }
+
+   bit_number = points.number_of_bits_for_rest+1;
+   if(bit_number > 33)
+     bit_number = 33;
+   for(uint32_t i = 1; i < size; i++)
+   for(uint32_t j = 1; j < size; j++)
+   {
+      const uint32_t k = i*size+j;
+      const uint32_t type = points.type[k];
+      const uint64_t x = integerWithVariableBitNumber(points.x[k], bit_number);
+      const uint64_t y = integerWithVariableBitNumber(points.y[k], bit_number);
+      const uint64_t z = integerWithVariableBitNumber(points.z[k], bit_number);
+      if(type == 0)
+        pbs.writeBits(0, 2);
+      else if(type == 1)
+        pbs.writeBits(((uint64_t)1 << bit_number) | z, 2+bit_number);
+      else if(2+3*bit_number <= 57)
+      {
+        if(type == 2)
+          pbs.writeBits(((uint64_t)2 << 2*bit_number) | (x << bit_number) | y, 2+2*bit_number);
+        else
+          pbs.writeBits(((uint64_t)3 << 3*bit_number) | (x << 2*bit_number) | (y << bit_number) | z, 2+3*bit_number);
+      }
+      else
+      {
+        pbs.writeBits(type, 2);
+        pbs.writeBits(x, bit_number);
+        pbs.writeBits(y, bit_number);
+        if(type == 3)
+          pbs.writeBits(z, bit_number);
+      }
+   }
+}
+
+void predictCompressedFaces(PRCCompressedFace *const *face, size_t count, double brep_data_compressed_tolerance,
+                            PRCcompressedNurbsPoints *points)
+{
+   const double nurbs_tolerance = 0.2*brep_data_compressed_tolerance;
+   PRCcompressedNurbsPoints unused;
+   for(size_t i = 0; i < count; )
+   {
+      if(i+1 < count && face[i+1]->degree == face[i]->degree)
+      {
+         predictCompressedNurbs(*face[i], *face[i+1], nurbs_tolerance, points[i], points[i+1]);
+         i += 2;
+      }
+      else
+      {
+         predictCompressedNurbs(*face[i], *face[i], nurbs_tolerance, points[i], unused);
+         ++i;
+      }
+   }
 }
 
 void  PRCCompressedFace::serializeCompressedFace(PRCbitStream &pbs, double brep_data_compressed_tolerance)
 {
-   serializeCompressedAnaNurbs( pbs, brep_data_compressed_tolerance );
+   PRCCompressedFace *const self = this;
+   PRCcompressedNurbsPoints points;
+   predictCompressedFaces(&self, 1, brep_data_compressed_tolerance, &points);
+   serializeCompressedAnaNurbs( pbs, points );
+}
+
+void  PRCCompressedFace::serializeCompressedFace(PRCbitStream &pbs, const PRCcompressedNurbsPoints &points)
+{
+   serializeCompressedAnaNurbs( pbs, points );
 }
-#define SerializeCompressedFace( value ) (value)->serializeCompressedFace( pbs, brep_data_compressed_tolerance );
 
 void  PRCCompressedFace::serializeContentCompressedFace(PRCbitStream &pbs)
 {
@@ -1327,19 +1689,18 @@ void  PRCCompressedFace::serializeContentCompressedFace(PRCbitStream &pbs)
    WriteBoolean ( surface_is_trimmed )
 }
 
-void  PRCCompressedFace::serializeCompressedAnaNurbs(PRCbitStream &pbs, double brep_data_compressed_tolerance)
+void  PRCCompressedFace::serializeCompressedAnaNurbs(PRCbitStream &pbs, const PRCcompressedNurbsPoints &points)
 {
    // WriteCompressedEntityType ( PRC_HCG_AnaNurbs )
    const bool is_a_curve = false;
    WriteBoolean ( is_a_curve ) 
    WriteUnsignedIntegerWithVariableBitNumber (13 , 4)
    serializeContentCompressedFace( pbs );
-   serializeCompressedNurbs( pbs, brep_data_compressed_tolerance );
+   serializeCompressedNurbs( pbs, points );
 }
 
-void  PRCCompressedFace::serializeCompressedNurbs(PRCbitStream &pbs, double brep_data_compressed_tolerance)
+void  PRCCompressedFace::serializeCompressedNurbs(PRCbitStream &pbs, const PRCcompressedNurbsPoints &points)
 {
-   const double nurbs_tolerance = 0.2*brep_data_compressed_tolerance;
    const uint32_t degree_in_u = degree;
    const uint32_t degree_in_v = degree;
    
@@ -1364,154 +1725,8 @@ void  PRCCompressedFace::serializeCompressedNurbs(PRCbitStream &pbs, double brep
    const bool is_closed_v = false; 
    WriteBoolean ( is_closed_v )
 
-   const uint32_t number_of_control_point_in_u = degree_in_u + 1;
-   const uint32_t number_of_control_point_in_v = degree_in_v + 1;
-
-#if defined(__GNUC__) && !defined(__clang__)
-   PRCVector3d P[number_of_control_point_in_u][number_of_control_point_in_v];
-#else
-   vector<vector<PRCVector3d> > P(number_of_control_point_in_u, vector<PRCVector3d>(number_of_control_point_in_v));
-#endif
-   for(uint32_t i=0;i<number_of_control_point_in_u;i++)
-   for(uint32_t j=0;j<number_of_control_point_in_v;j++)
-      P[i][j] = control_point[i*number_of_control_point_in_v+j];
-#ifdef __GNUC__
-   itriple compressed_control_point[number_of_control_point_in_u][number_of_control_point_in_v];
-   uint32_t control_point_type[number_of_control_point_in_u][number_of_control_point_in_v];
-#else
-   vector<vector<itriple> > compressed_control_point(number_of_control_point_in_u, vector<itriple>(number_of_control_point_in_v));
-   vector<vector<uint32_t> > control_point_type(number_of_control_point_in_u, vector<uint32_t>(number_of_control_point_in_v));
-#endif
-
-   uint32_t number_of_bits_for_isomin = 1;
-   uint32_t number_of_bits_for_rest = 1;
-   
-   for(uint32_t j = 1; j < number_of_control_point_in_v; j++)
-   {
-      compressed_control_point[0][j] = iroundto(P[0][j]-P[0][j-1], nurbs_tolerance );
-      P[0][j] = P[0][j-1] + roundto(P[0][j]-P[0][j-1], nurbs_tolerance);
-      uint32_t bit_size = GetNumberOfBitsUsedToStoreTripleInteger(compressed_control_point[0][j]);
-      if (bit_size > number_of_bits_for_isomin)
-        number_of_bits_for_isomin = bit_size;
-   }
-
-   for(uint32_t i = 1; i < number_of_control_point_in_u; i++)
-   {
-      compressed_control_point[i][0] = iroundto(P[i][0]-P[i-1][0], nurbs_tolerance );
-      P[i][0] = P[i-1][0] + roundto(P[i][0]-P[i-1][0], nurbs_tolerance);
-      uint32_t bit_size = GetNumberOfBitsUsedToStoreTripleInteger(compressed_control_point[i][0]);
-      if (bit_size > number_of_bits_for_isomin)
-        number_of_bits_for_isomin = bit_size;
-   }
+   writeCompressedNurbsPoints(pbs, points);
 
-   for(uint32_t i=1;i<number_of_control_point_in_u;i++)
-   for(uint32_t j=1;j<number_of_control_point_in_v;j++)
-   {
-     compressed_control_point[i][j].x = 0;
-     compressed_control_point[i][j].y = 0;
-     compressed_control_point[i][j].z = 0;
-     
-     PRCVector3d V = P[i-1][j] - P[i-1][j-1];
-     PRCVector3d U = P[i][j-1] - P[i-1][j-1];
-     PRCVector3d Pc = P[i][j] - (P[i-1][j-1] + U + V);
-
-     if(Pc.Length() < nurbs_tolerance)
-     {
-       control_point_type[i][j] = 0;
-       P[i][j] = P[i-1][j-1] + U + V;
-     }
-     else 
-     {
-       PRCVector3d N = U*V;
-       PRCVector3d Ue = U;
-       PRCVector3d Ne = N;
-       if( V.Length() < FLT_EPSILON || !Ue.Normalize() || !Ne.Normalize())
-       {
-          control_point_type[i][j] = 3;
-       // Pc = roundto(Pc, nurbs_tolerance); // not sure if this rounding really happens, need to experiment, docs imply but do not state
-          compressed_control_point[i][j] = iroundto(Pc, nurbs_tolerance);
-          P[i][j] = P[i-1][j-1] + U + V + roundto(Pc, nurbs_tolerance); // see above
-       }
-       else
-       {
-         PRCVector3d NUe = Ne*Ue;
-         double x = Pc.Dot(Ue);
-         double y = Pc.Dot(NUe);
-         double z = Pc.Dot(Ne);
-
-         if(x*x+y*y<nurbs_tolerance*nurbs_tolerance)
-         {
-           control_point_type[i][j] = 1;
-           compressed_control_point[i][j] = iroundto(PRCVector3d(0.0,0.0,z), nurbs_tolerance);
-           P[i][j] = P[i-1][j-1] + U + V + roundto(z, nurbs_tolerance)*Ne; // see above
-         }
-         else
-         {
-           if(fabs(z)<nurbs_tolerance/2)
-           {
-             control_point_type[i][j] = 2;
-             compressed_control_point[i][j] = iroundto(PRCVector3d(x,y,0), nurbs_tolerance);
-             P[i][j] = P[i-1][j-1] + U + V + roundto(x, nurbs_tolerance)*Ue + roundto(y, nurbs_tolerance)*NUe; // see above
-           }
-           else
-           {
-             control_point_type[i][j] = 3;
-             compressed_control_point[i][j] = iroundto(Pc, nurbs_tolerance);
-             P[i][j] = P[i-1][j-1] + U + V + roundto(Pc, nurbs_tolerance); // see above
-           }
-         }
-       }
-     }
-     uint32_t bit_size = GetNumberOfBitsUsedToStoreTripleInteger(compressed_control_point[i][j]);
-     if (bit_size > number_of_bits_for_rest)
-       number_of_bits_for_rest = bit_size;
-   }
-
-   if( number_of_bits_for_rest == 2 ) number_of_bits_for_rest--; // really I think it must be unconditional, but so it seems to be done in Adobe Acrobat (9.3)
-   WriteUnsignedIntegerWithVariableBitNumber ( number_of_bits_for_isomin, 20 )
-   WriteUnsignedIntegerWithVariableBitNumber ( number_of_bits_for_rest,   20 )
-   WriteDouble ( P[0][0].x )
-   WriteDouble ( P[0][0].y )
-   WriteDouble ( P[0][0].z )
-   
-   for(uint32_t j = 1; j < number_of_control_point_in_v; j++)
-   {
-      WriteIntegerWithVariableBitNumber(compressed_control_point[0][j].x, number_of_bits_for_isomin+1)
-      WriteIntegerWithVariableBitNumber(compressed_control_point[0][j].y, number_of_bits_for_isomin+1)
-      WriteIntegerWithVariableBitNumber(compressed_control_point[0][j].z, number_of_bits_for_isomin+1)
-   }
-   
-   for(uint32_t i = 1; i < number_of_control_point_in_u; i++)
-   {
-      WriteIntegerWithVariableBitNumber(compressed_control_point[i][0].x, number_of_bits_for_isomin+1)
-      WriteIntegerWithVariableBitNumber(compressed_control_point[i][0].y, number_of_bits_for_isomin+1)
-      WriteIntegerWithVariableBitNumber(compressed_control_point[i][0].z, number_of_bits_for_isomin+1)
-   }
-   
-   for(uint32_t i = 1; i < number_of_control_point_in_u; i++)
-   {
-      for(uint32_t j = 1; j < number_of_control_point_in_v; j++)
-      {
-         WriteUnsignedIntegerWithVariableBitNumber ( control_point_type[i][j], 2 )
-         
-         if(control_point_type[i][j] == 1)
-         {
-            WriteIntegerWithVariableBitNumber ( compressed_control_point[i][j].z, number_of_bits_for_rest+1 )
-         }
-         else if(control_point_type[i][j] == 2)
-         {
-            WriteIntegerWithVariableBitNumber ( compressed_control_point[i][j].x, number_of_bits_for_rest+1 )
-            WriteIntegerWithVariableBitNumber ( compressed_control_point[i][j].y, number_of_bits_for_rest+1 )
-         }
-         else if(control_point_type[i][j] == 3)
-         {
-            WriteIntegerWithVariableBitNumber ( compressed_control_point[i][j].x, number_of_bits_for_rest+1 )
-            WriteIntegerWithVariableBitNumber ( compressed_control_point[i][j].y, number_of_bits_for_rest+1 )
-            WriteIntegerWithVariableBitNumber ( compressed_control_point[i][j].z, number_of_bits_for_rest+1 )
-         }
-      }
-   }
-   
    const uint32_t type_param_u = 0;
    WriteBoolean( type_param_u == 0 )
    const uint32_t type_param_v = 0;
@@ -1520,6 +1735,35 @@ void  PRCCompressedFace::serializeCompressedNurbs(PRCbitStream &pbs, double brep
    WriteBoolean( is_rational )
 }
 
+// faces predicted at once
+static const size_t compressedFaceBatch = 16;
+
+// faces to write, predicted a batch at a time and then written in turn
+class PRCcompressedFaceItems : public PRCbitStreamItems
+{
+  public:
+    PRCcompressedFaceItems(const PRCCompressedFaceList &face, double brep_data_compressed_tolerance) :
+      face(face), brep_data_compressed_tolerance(brep_data_compressed_tolerance) {}
+    // the faces of batch b
+    void write(PRCbitStream &pbs, size_t b)
+    {
+      const size_t first = b*compressedFaceBatch;
+      const size_t count = std::min(compressedFaceBatch, face.size()-first);
+      PRCCompressedFace *faces[compressedFaceBatch];
+      PRCcompressedNurbsPoints points[compressedFaceBatch];
+      std::copy(face.begin()+first, face.begin()+first+count, faces);
+      predictCompressedFaces(faces, count, brep_data_compressed_tolerance, points);
+      for(size_t i = 0; i < count; i++)
+      {
+        PRCpartScope part(pbs, PRCentityStatistics::CompressedFaces);
+        faces[i]->serializeCompressedFace(pbs, points[i]);
+      }
+    }
+  private:
+    const PRCCompressedFaceList &face;
+    const double brep_data_compressed_tolerance;
+};
+
 void PRCCompressedBrepData::serializeCompressedShell(PRCbitStream &pbs)
 {
    uint32_t i;
@@ -1529,8 +1773,8 @@ void PRCCompressedBrepData::serializeCompressedShell(PRCbitStream &pbs)
    if( number_of_face != 1 )
       WriteNumberOfBitsThenUnsignedInteger (number_of_face)
    
-   for( i=0; i < number_of_face; i++)
-         SerializeCompressedFace ( face[i] )
+   PRCcompressedFaceItems items(face, brep_data_compressed_tolerance);
+   pbs.writeItems(items, (number_of_face+compressedFaceBatch-1)/compressedFaceBatch);
    
    const bool is_an_iso_face = false;
    for( i=0; i < number_of_face; i++)
@@ -1853,54 +2097,28 @@ void PRCTopoContext::serializeGeometrySummary(PRCbitStream &pbs)
 
 void PRCTopoContext::serializeContextGraphics(PRCbitStream &pbs)
 { 
-   uint32_t i=0, j=0, k=0, l=0;
+   uint32_t i=0, j=0;
    ResetCurrentGraphics
-   uint32_t number_of_body = body.size();
-   PRCGraphicsList element;
+   const uint32_t number_of_element = face_graphics.size();
    bool has_graphics = false;
-   for (i=0;i<number_of_body;i++)
-   {
-        if ( body[i]->topo_item_type == PRC_TYPE_TOPO_BrepData && dynamic_cast<PRCBrepData*>(body[i]))
-        {
-                PRCBrepData *body_i = dynamic_cast<PRCBrepData*>(body[i]);
-                for (j=0;j<body_i->connex.size();j++)
-                {
-                        for(k=0;k<body_i->connex[j]->shell.size();k++)
-                        {
-                                for( l=0;l<body_i->connex[j]->shell[k]->face.size();l++)
-                                {
-                                        element.push_back( body_i->connex[j]->shell[k]->face[l] );
-                                        has_graphics = has_graphics || body_i->connex[j]->shell[k]->face[l]->has_graphics();
-                                }
-                        }
-                }
-        }
-        else if ( body[i]->topo_item_type == PRC_TYPE_TOPO_BrepDataCompress && dynamic_cast<PRCCompressedBrepData*>(body[i]))
-        {
-                PRCCompressedBrepData *body_i = dynamic_cast<PRCCompressedBrepData*>(body[i]);
-             	for( l=0;l<body_i->face.size();l++)
-             	{
-             		element.push_back( body_i->face[l] );
-             		has_graphics = has_graphics || body_i->face[l]->has_graphics();
-             	}
-        }
-   }
+   for (j=0;j<number_of_element && !has_graphics;j++)
+      has_graphics = face_graphics[j]->has_graphics();
    uint32_t number_of_treat_type = 0;
-   if (has_graphics && !element.empty())
+   if (has_graphics)
      number_of_treat_type = 1;
    WriteUnsignedInteger (number_of_treat_type) 
    for (i=0;i<number_of_treat_type;i++) 
    {
       const uint32_t element_type = PRC_TYPE_TOPO_Face;
       WriteUnsignedInteger (element_type) 
-      const uint32_t number_of_element = element.size();
       WriteUnsignedInteger (number_of_element) 
       for (j=0;j<number_of_element;j++) 
       {
-         WriteBoolean ( element[j]->has_graphics() ) 
-         if (element[j]->has_graphics()) 
+         const bool element_has_graphics = face_graphics[j]->has_graphics();
+         WriteBoolean ( element_has_graphics ) 
+         if (element_has_graphics) 
          {
-            element[j]->serializeGraphics(pbs);
+            face_graphics[j]->serializeGraphics(pbs);
          }
       }
    }
@@ -1915,6 +2133,9 @@ uint32_t PRCTopoContext::addSingleWireBody(PRCSingleWireBody*& pSingleWireBody)
 
 uint32_t PRCTopoContext::addBrepData(PRCBrepData*& pBrepData)
 {
+  for(PRCConnexList::const_iterator cit=pBrepData->connex.begin(); cit!=pBrepData->connex.end(); ++cit)
+    for(PRCShellList::const_iterator sit=(*cit)->shell.begin(); sit!=(*cit)->shell.end(); ++sit)
+      face_graphics.insert(face_graphics.end(),(*sit)->face.begin(),(*sit)->face.end());
   body.push_back(pBrepData);
   pBrepData = NULL;
   return body.size()-1;
@@ -1922,6 +2143,7 @@ uint32_t PRCTopoContext::addBrepData(PRCBrepData*& pBrepData)
 
 uint32_t PRCTopoContext::addCompressedBrepData(PRCCompressedBrepData*& pCompressedBrepData)
 {
+  face_graphics.insert(face_graphics.end(),pCompressedBrepData->face.begin(),pCompressedBrepData->face.end());
   body.push_back(pCompressedBrepData);
   pCompressedBrepData = NULL;
   return body.size()-1;
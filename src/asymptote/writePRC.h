@@ -52,6 +52,8 @@ public :
  x(c?c[0]:fx), y(c?c[1]:fy), z(c?c[2]:fz) {}
  PRCVector3d(const PRCVector3d& sVector3d) :
  x(sVector3d.x), y(sVector3d.y), z(sVector3d.z) {}
+ PRCVector3d& operator=(const PRCVector3d& sVector3d)
+ { x = sVector3d.x; y = sVector3d.y; z = sVector3d.z; return *this; }
 
  void Set(double fx, double fy, double fz)
  { x = fx; y = fy; z = fz; }
@@ -240,8 +242,39 @@ class PRCAttributes
 };
 
 bool type_eligible_for_reference(uint32_t type);
+
+// The identifiers handed out to the entities of one file, and the count
+// of its file structure UUIDs. Entities take them from the current
+// context of the thread that creates them: the one of the innermost
+// PRCIdentifierScope alive there, else one of the thread's own.
+class PRCIdentifierContext
+{
+  public:
+    PRCIdentifierContext() : nextCADID(1), nextPRCID(1), fileUUIDCount(0) {}
+    uint32_t nextCADID;
+    uint32_t nextPRCID;
+    uint32_t fileUUIDCount;
+
+    static PRCIdentifierContext &current();
+};
+
+// Makes a context current on the constructing thread until destroyed,
+// which has to happen on the same thread.
+class PRCIdentifierScope
+{
+  public:
+    PRCIdentifierScope(PRCIdentifierContext &context);
+    ~PRCIdentifierScope();
+  private:
+    PRCIdentifierContext &context;
+    std::vector<PRCIdentifierContext*> &contexts;
+};
+
 uint32_t makeCADID();
 uint32_t makePRCID();
+// the identifiers the two above hand out next in the current context
+void getNextIDs(uint32_t &cad_id, uint32_t &prc_id);
+void setNextIDs(uint32_t cad_id, uint32_t prc_id);
 
 class ContentPRCBase : public PRCAttributes
 {
@@ -275,18 +308,15 @@ public:
   uint32_t unique_identifier;
 };
 
-extern std::string currentName;
+// Names and graphics are only written when they differ from the last
+// ones written to the stream, see PRCSerializationContext.
 void writeName(PRCbitStream&,const std::string&);
-void resetName();
-
-extern uint32_t current_layer_index;
-extern uint32_t current_index_of_line_style;
-extern uint16_t current_behaviour_bit_field;
+void resetName(PRCbitStream&);
 
 void writeGraphics(PRCbitStream&,uint32_t=m1,uint32_t=m1,uint16_t=1,bool=false);
-void resetGraphics();
+void resetGraphics(PRCbitStream&);
 
-void resetGraphicsAndName();
+void resetGraphicsAndName(PRCbitStream&);
 
 struct PRCRgbColor
 {
@@ -538,8 +568,11 @@ public:
 class PRCTess : public PRCContentBaseTessData
 {
 public:
+  PRCTess(uint32_t t) : tess_type(t) {}
   virtual ~PRCTess() {}
-  virtual void serializeBaseTessData(PRCbitStream &pbs) = 0;
+  // dispatches on tess_type
+  void serializeBaseTessData(PRCbitStream &pbs);
+  const uint32_t tess_type;
 };
 typedef std::deque <PRCTess*>  PRCTessList;
 
@@ -547,12 +580,11 @@ class PRC3DTess : public PRCTess
 {
 public:
   PRC3DTess() :
-  has_faces(false), has_loops(false),
+  PRCTess(PRC_TYPE_TESS_3D), has_faces(false), has_loops(false),
   crease_angle(25.8419)  // arccos(0.9), default found in Acrobat output
   {}
   ~PRC3DTess() { for(PRCTessFaceList::iterator it=face_tessellation.begin(); it!=face_tessellation.end(); ++it) delete *it; }
   void serialize3DTess(PRCbitStream&);
-  void serializeBaseTessData(PRCbitStream &pbs) { serialize3DTess(pbs); }
   void addTessFace(PRCTessFace*& pTessFace);
 
   bool has_faces;
@@ -569,9 +601,8 @@ class PRC3DWireTess : public PRCTess
 {
 public:
   PRC3DWireTess() :
-  is_rgba(false), is_segment_color(false) {}
+  PRCTess(PRC_TYPE_TESS_3D_Wire), is_rgba(false), is_segment_color(false) {}
   void serialize3DWireTess(PRCbitStream&);
-  void serializeBaseTessData(PRCbitStream &pbs) { serialize3DWireTess(pbs); }
 
   bool is_rgba;
   bool is_segment_color;
@@ -583,10 +614,9 @@ class PRCMarkupTess : public PRCTess
 {
 public:
   PRCMarkupTess() :
-  behaviour(0)
+  PRCTess(PRC_TYPE_TESS_Markup), behaviour(0)
   {}
   void serializeMarkupTess(PRCbitStream&);
-  void serializeBaseTessData(PRCbitStream &pbs) { serializeMarkupTess(pbs); }
 
   std::vector<uint32_t> codes;
   std::vector<std::string> texts;
@@ -652,7 +682,8 @@ public:
   PRCRepresentationItem(uint32_t t, std::string n="") :
     PRCRepresentationItemContent(t,n) {}
   virtual ~PRCRepresentationItem() {}
-  virtual void serializeRepresentationItem(PRCbitStream &pbs) = 0;
+  // dispatches on type
+  void serializeRepresentationItem(PRCbitStream &pbs);
 };
 typedef std::deque <PRCRepresentationItem*>  PRCRepresentationItemList;
 
@@ -662,7 +693,6 @@ public:
   PRCBrepModel(std::string n="") :
     PRCRepresentationItem(PRC_TYPE_RI_BrepModel,n), has_brep_data(true), context_id(m1), body_id(m1), is_closed(false) {}
   void serializeBrepModel(PRCbitStream&);
-  void serializeRepresentationItem(PRCbitStream &pbs) { serializeBrepModel(pbs); }
   bool has_brep_data;
   uint32_t context_id;
   uint32_t body_id;
@@ -675,7 +705,6 @@ public:
   PRCPolyBrepModel(std::string n="") :
     PRCRepresentationItem(PRC_TYPE_RI_PolyBrepModel,n), is_closed(false) {}
   void serializePolyBrepModel(PRCbitStream&);
-  void serializeRepresentationItem(PRCbitStream &pbs) { serializePolyBrepModel(pbs); }
   bool is_closed;
 };
 
@@ -685,7 +714,6 @@ public:
   PRCPointSet(std::string n="") :
     PRCRepresentationItem(PRC_TYPE_RI_PointSet,n) {}
   void serializePointSet(PRCbitStream&);
-  void serializeRepresentationItem(PRCbitStream &pbs) { serializePointSet(pbs); }
   std::vector<PRCVector3d> point;
 };
 
@@ -695,7 +723,6 @@ public:
   PRCWire(std::string n="") :
     PRCRepresentationItem(PRC_TYPE_RI_Curve,n), has_wire_body(true), context_id(m1), body_id(m1) {}
   void serializeWire(PRCbitStream&);
-  void serializeRepresentationItem(PRCbitStream &pbs) { serializeWire(pbs); }
   bool has_wire_body;
   uint32_t context_id;
   uint32_t body_id;
@@ -707,7 +734,6 @@ public:
   PRCPolyWire(std::string n="") :
     PRCRepresentationItem(PRC_TYPE_RI_PolyWire,n) {}
   void serializePolyWire(PRCbitStream&);
-  void serializeRepresentationItem(PRCbitStream &pbs) { serializePolyWire(pbs); }
 };
 
 class PRCSet : public PRCRepresentationItem
@@ -717,7 +743,6 @@ public:
     PRCRepresentationItem(PRC_TYPE_RI_Set,n) {}
   ~PRCSet() { for(PRCRepresentationItemList::iterator it=elements.begin(); it!=elements.end(); ++it) delete *it; }
   void serializeSet(PRCbitStream&);
-  void serializeRepresentationItem(PRCbitStream &pbs) { serializeSet(pbs); }
   uint32_t addBrepModel(PRCBrepModel*& pBrepModel);
   uint32_t addPolyBrepModel(PRCPolyBrepModel*& pPolyBrepModel);
   uint32_t addPointSet(PRCPointSet*& pPointSet);
@@ -865,7 +890,6 @@ public:
   PRCRepresentationItem(PRC_TYPE_RI_CoordinateSystem,n), axis_set(NULL) {}
   ~PRCCoordinateSystem() { delete axis_set; }
   void serializeCoordinateSystem(PRCbitStream&);
-  void serializeRepresentationItem(PRCbitStream &pbs) { serializeCoordinateSystem(pbs); }
   void setAxisSet(PRCGeneralTransformation3d*& transform) { axis_set = transform; transform = NULL; } 
   void setAxisSet(PRCCartesianTransformation3d*& transform) { axis_set = transform; transform = NULL; } 
   PRCTransformation3d *axis_set;
@@ -1232,10 +1256,11 @@ public:
   PRCBody(uint32_t tit, std::string n) :
     PRCContentBody(n), topo_item_type(tit) {}
   virtual ~PRCBody() {}
-  virtual void serializeBody(PRCbitStream &pbs) = 0;
+  // dispatches on topo_item_type
+  void serializeBody(PRCbitStream &pbs);
   void serializeTopoItem(PRCbitStream &pbs) { serializeBody(pbs); }
   uint32_t serialType() { return topo_item_type; }
-  virtual double serialTolerance() { return 0; }
+  double serialTolerance();
   const uint32_t topo_item_type;
 };
 typedef std::deque <PRCBody*>  PRCBodyList;
@@ -1271,7 +1296,6 @@ public:
     PRCBody(PRC_TYPE_TOPO_SingleWireBody, n), wire_edge(NULL) {}
   ~PRCSingleWireBody() { delete wire_edge; }
   void serializeSingleWireBody(PRCbitStream &pbs);
-  void serializeBody(PRCbitStream &pbs) { serializeSingleWireBody(pbs); }
   void setWireEdge(PRCWireEdge*& wireEdge) { wire_edge = wireEdge; wireEdge = NULL; }  
   PRCWireEdge* wire_edge;
 };
@@ -1339,11 +1363,32 @@ public:
     PRCBody(PRC_TYPE_TOPO_BrepData, n) {}
   ~PRCBrepData() { for(PRCConnexList::iterator it=connex.begin(); it!=connex.end(); ++it) delete *it; }
   void serializeBrepData(PRCbitStream &pbs);
-  void serializeBody(PRCbitStream &pbs) { serializeBrepData(pbs); }
   void addConnex(PRCConnex*& pConnex);
   PRCConnexList connex;
 };
 
+// The control points of a compressed NURBS face as written: each is
+// predicted from the ones before it, which are taken as rounded, and
+// the difference is quantized. Coordinates are kept in separate arrays.
+struct PRCcompressedNurbsPoints
+{
+  uint32_t size; // points in each direction, at most 4
+  double first[3];
+  uint32_t type[16];
+  int32_t x[16];
+  int32_t y[16];
+  int32_t z[16];
+  uint32_t number_of_bits_for_isomin;
+  uint32_t number_of_bits_for_rest;
+};
+
+class PRCCompressedFace;
+// Predict the points of count faces as they are written in a body with
+// the tolerance given, two faces of the same degree next to each other
+// at a time.
+void predictCompressedFaces(PRCCompressedFace *const *face, size_t count, double brep_data_compressed_tolerance,
+                            PRCcompressedNurbsPoints *points);
+
 // For now - treat just the case of Bezier surfaces cubic 4x4 or linear 2x2
 class PRCCompressedFace : public PRCBaseTopology, public PRCGraphics
 {
@@ -1353,9 +1398,11 @@ public:
   PRCCompressedFace(std::string n) :
     PRCBaseTopology(n,makeCADID()), orientation_surface_with_shell(true), degree(0) {} 
   void serializeCompressedFace(PRCbitStream &pbs, double brep_data_compressed_tolerance);
+  // with its points predicted by predictCompressedFaces()
+  void serializeCompressedFace(PRCbitStream &pbs, const PRCcompressedNurbsPoints &points);
   void serializeContentCompressedFace(PRCbitStream &pbs);
-  void serializeCompressedAnaNurbs(PRCbitStream &pbs, double brep_data_compressed_tolerance);
-  void serializeCompressedNurbs(PRCbitStream &pbs, double brep_data_compressed_tolerance);
+  void serializeCompressedAnaNurbs(PRCbitStream &pbs, const PRCcompressedNurbsPoints &points);
+  void serializeCompressedNurbs(PRCbitStream &pbs, const PRCcompressedNurbsPoints &points);
   bool orientation_surface_with_shell;
   uint32_t degree;
   std::vector<PRCVector3d> control_point;
@@ -1372,9 +1419,7 @@ public:
     PRCBody(PRC_TYPE_TOPO_BrepDataCompress, n), serial_tolerance(0), brep_data_compressed_tolerance(0) {}
   ~PRCCompressedBrepData() { for(PRCCompressedFaceList::iterator it=face.begin(); it!=face.end(); ++it) delete *it; }
   void serializeCompressedBrepData(PRCbitStream &pbs);
-  void serializeBody(PRCbitStream &pbs) { serializeCompressedBrepData(pbs); }
   void serializeCompressedShell(PRCbitStream &pbs);
-  double serialTolerance() { return serial_tolerance; }
   double serial_tolerance;
   double brep_data_compressed_tolerance;
   PRCCompressedFaceList face;
@@ -1402,6 +1447,9 @@ public:
   bool have_scale;
   double scale;
   PRCBodyList body;
+  // the faces of the bodies in the order they are serialized, registered
+  // when their body is added, which has to be complete by then
+  std::vector<PRCGraphics*> face_graphics;
 };
 typedef std::deque <PRCTopoContext*>  PRCTopoContextList;
 
@@ -0,0 +1,224 @@
+// Splitting NURBS surfaces into Bezier patches: random surfaces, clamped
+// or not, with repeated knots, rational or not and of degree up to 5, are
+// evaluated by de Boor's algorithm against their patches, which have to
+// cover the domain and match the surface, exactly for non-rational spans
+// of degree at most 3 and within the tolerance asked for otherwise.
+
+#include "PRCbezier.h"
+#include "prctest.h"
+
+#include <math.h>
+#include <vector>
+
+static const double tolerance = 1e-3;
+
+// the homogeneous point at u of the B-spline of degree d with n points
+// P[0], P[stride]... of 4 doubles and knots U, by de Boor's algorithm
+static void deBoor(uint32_t d, size_t n, const double *P, size_t stride,
+                   const std::vector<double> &U, double u, double p[4])
+{
+  // the last span starting at u or before
+  size_t k = d;
+  for(size_t i = d; i < n; ++i)
+    if(U[i] < U[i+1] && U[i] <= u)
+      k = i;
+  std::vector<double> D(4*(d+1));
+  for(uint32_t j = 0; j <= d; ++j)
+    for(int c = 0; c < 4; ++c)
+      D[4*j+c] = P[(j+k-d)*stride+c];
+  for(uint32_t r = 1; r <= d; ++r)
+    for(uint32_t j = d; j >= r; --j)
+    {
+      const double alpha = (u-U[j+k-d])/(U[j+1+k-r]-U[j+k-d]);
+      for(int c = 0; c < 4; ++c)
+        D[4*j+c] = (1-alpha)*D[4*(j-1)+c]+alpha*D[4*j+c];
+    }
+  for(int c = 0; c < 4; ++c)
+    p[c] = D[4*d+c];
+}
+
+struct Surface
+{
+  uint32_t dU, dV, nU, nV;
+  std::vector<double> U, V, w;
+  std::vector<double> P; // homogeneous, v varying fastest
+  std::vector<double> cP;
+  // along v in every row, then along u
+  PRCVector3d evaluate(double u, double v) const
+  {
+    std::vector<double> column(4*nU);
+    for(uint32_t i = 0; i < nU; ++i)
+      deBoor(dV,nV,&P[4*i*nV],4,V,v,&column[4*i]);
+    double p[4];
+    deBoor(dU,nU,&column[0],4,U,u,p);
+    return PRCVector3d(p[0]/p[3],p[1]/p[3],p[2]/p[3]);
+  }
+};
+
+static PRCVector3d evaluatePatch(const PRCbezierPatch &patch, double s, double t)
+{
+  const uint32_t d = patch.degree;
+  PRCVector3d row[4], point[4];
+  for(uint32_t i = 0; i <= d; ++i)
+  {
+    for(uint32_t j = 0; j <= d; ++j)
+      point[j] = patch.point[i*(d+1)+j];
+    for(uint32_t k = 1; k <= d; ++k)
+      for(uint32_t j = 0; j+k <= d; ++j)
+        point[j] = (1-t)*point[j]+t*point[j+1];
+    row[i] = point[0];
+  }
+  for(uint32_t k = 1; k <= d; ++k)
+    for(uint32_t i = 0; i+k <= d; ++i)
+      row[i] = (1-s)*row[i]+s*row[i+1];
+  return row[0];
+}
+
+static double distance(const PRCVector3d &a, const PRCVector3d &b)
+{
+  const PRCVector3d d = a-b;
+  return sqrt(d.x*d.x+d.y*d.y+d.z*d.z);
+}
+
+// knots with runs of at most d inside, clamped or not
+static std::vector<double> randomKnots(PRCtestRandom &random, uint32_t d, uint32_t n, bool clamped)
+{
+  std::vector<double> U(n+d+1);
+  uint32_t run = 1;
+  for(size_t i = 1; i < U.size(); ++i)
+  {
+    const bool end = clamped && (i <= d || i > n);
+    if(end || (run < d && i != n && random.next() % 4 == 0))
+    {
+      U[i] = U[i-1];
+      ++run;
+    }
+    else
+    {
+      U[i] = U[i-1]+0.25+(random.next() % 1000)/1000.0;
+      run = 1;
+    }
+  }
+  return U;
+}
+
+static uint32_t spans(const std::vector<double> &U, uint32_t d, uint32_t n)
+{
+  uint32_t count = 0;
+  for(uint32_t i = d; i < n; ++i)
+    count += U[i] < U[i+1] ? 1 : 0;
+  return count;
+}
+
+// compare the patches with the surface, error relative to the tolerance
+static void check(const Surface &surface, const std::vector<PRCbezierPatch> &patches,
+                  bool exact, uint64_t seed)
+{
+  const double a = surface.U[surface.dU], b = surface.U[surface.nU];
+  const double c = surface.V[surface.dV], d = surface.V[surface.nV];
+  double area = 0;
+  for(size_t i = 0; i < patches.size(); ++i)
+  {
+    const PRCbezierPatch &patch = patches[i];
+    PRC_CHECK(patch.u0 >= a && patch.u1 <= b && patch.v0 >= c && patch.v1 <= d && patch.u0 < patch.u1 && patch.v0 < patch.v1,
+              "seed " << seed << ": patch " << i << " is outside the domain")
+    area += (patch.u1-patch.u0)*(patch.v1-patch.v0);
+    const uint32_t degree = exact && surface.dU == 1 && surface.dV == 1 ? 1 : 3;
+    PRC_CHECK(patch.degree == degree, "seed " << seed << ": patch " << i << " has degree " << patch.degree)
+    // the grid the approximation is checked at, then one in between
+    for(int grid = 0; grid < 2; ++grid)
+      for(int k = 0; k <= 5; ++k)
+        for(int l = 0; l <= 5; ++l)
+        {
+          const double s = grid == 0 ? k/8.0 : k/5.0, t = grid == 0 ? l/8.0 : l/5.0;
+          const double error = distance(evaluatePatch(patch,s,t),
+            surface.evaluate(patch.u0+s*(patch.u1-patch.u0),patch.v0+t*(patch.v1-patch.v0)));
+          const double allowed = exact ? 1e-9 : (grid == 0 ? 1.0001 : 2)*tolerance;
+          PRC_CHECK(error <= allowed, "seed " << seed << ": patch " << i << " is " << error
+                    << " from the surface at " << s << "," << t)
+        }
+  }
+  PRC_CHECK(fabs(area-(b-a)*(d-c)) <= 1e-9*(b-a)*(d-c),
+            "seed " << seed << ": patches cover " << area << " of " << (b-a)*(d-c))
+}
+
+static void randomSurfaces()
+{
+  unsigned int approximated = 0, unclamped = 0;
+  for(uint64_t seed = 1; seed <= 1000; ++seed)
+  {
+    PRCtestRandom random(seed);
+    Surface surface;
+    const uint32_t r = random.next();
+    surface.dU = 1+r % 3 + ((r >> 8) % 8 == 0 ? 2 : 0);
+    surface.dV = 1+(r >> 2) % 3;
+    surface.nU = surface.dU+1+(r >> 12) % 6;
+    surface.nV = surface.dV+1+(r >> 16) % 6;
+    const bool clamped = (r >> 20) % 3 != 0;
+    const int weights = (r >> 24) % 3; // none, the same, random
+    surface.U = randomKnots(random,surface.dU,surface.nU,clamped);
+    surface.V = randomKnots(random,surface.dV,surface.nV,clamped);
+
+    const size_t n = (size_t)surface.nU*surface.nV;
+    surface.cP.resize(3*n);
+    surface.P.resize(4*n);
+    surface.w.resize(n);
+    for(size_t i = 0; i < n; ++i)
+    {
+      surface.w[i] = weights == 0 ? 1 : weights == 1 ? 2.5 : 0.5+(random.next() % 1500)/1000.0;
+      for(int c = 0; c < 3; ++c)
+      {
+        surface.cP[3*i+c] = (random.next() % 10000)/10000.0;
+        surface.P[4*i+c] = surface.w[i]*surface.cP[3*i+c];
+      }
+      surface.P[4*i+3] = surface.w[i];
+    }
+
+    std::vector<PRCbezierPatch> patches;
+    const bool split = splitNURBSSurface(surface.dU,surface.dV,surface.nU,surface.nV,
+                                         (const double(*)[3])&surface.cP[0],&surface.U[0],&surface.V[0],
+                                         weights == 0 ? NULL : &surface.w[0],tolerance,patches);
+    PRC_CHECK(split, "seed " << seed << ": not split")
+    if(!split)
+      continue;
+    const bool exact = surface.dU <= 3 && weights != 2;
+    if(exact)
+    {
+      PRC_CHECK(patches.size() == spans(surface.U,surface.dU,surface.nU)*spans(surface.V,surface.dV,surface.nV),
+                "seed " << seed << ": " << patches.size() << " patches")
+    }
+    check(surface,patches,exact,seed);
+    approximated += exact ? 0 : 1;
+    unclamped += clamped ? 0 : 1;
+  }
+  PRC_CHECK(approximated > 200 && unclamped > 200,
+            approximated << " surfaces approximated, " << unclamped << " unclamped")
+}
+
+// a quarter of a cylinder of radius 1, as a rational quadratic in u
+static void cylinder()
+{
+  const double s = sqrt(0.5);
+  const double cP[6][3] = { {1,0,0}, {1,0,2}, {1,1,0}, {1,1,2}, {0,1,0}, {0,1,2} };
+  const double w[6] = { 1, 1, s, s, 1, 1 };
+  const double kU[6] = { 0, 0, 0, 1, 1, 1 }, kV[4] = { 0, 0, 1, 1 };
+  std::vector<PRCbezierPatch> patches;
+  PRC_CHECK(splitNURBSSurface(2,1,3,2,cP,kU,kV,w,tolerance,patches), "cylinder not split")
+  PRC_CHECK(patches.size() > 1, "cylinder in " << patches.size() << " patch")
+  double worst = 0;
+  for(size_t i = 0; i < patches.size(); ++i)
+    for(int k = 0; k <= 10; ++k)
+      for(int l = 0; l <= 10; ++l)
+      {
+        const PRCVector3d p = evaluatePatch(patches[i],k/10.0,l/10.0);
+        worst = std::max(worst,fabs(sqrt(p.x*p.x+p.y*p.y)-1));
+      }
+  PRC_CHECK(worst <= 2*tolerance, "cylinder patches " << worst << " off its radius")
+}
+
+int main()
+{
+  randomSurfaces();
+  cylinder();
+  return prcTestResult();
+}
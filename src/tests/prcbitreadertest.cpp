@@ -0,0 +1,234 @@
+// Round trips through PRCbitStream and PRCbitReader: random sequences of
+// each encoding operator<< writes, and runs of raw bits, must read back
+// as written, ending at the bit the writer ended at.
+
+#include "PRCbitStream.h"
+#include "PRCbitReader.h"
+#include "PRCdouble.h"
+#include "prctest.h"
+
+#include <zlib.h>
+#include <cstring>
+#include <string>
+#include <vector>
+
+enum Kind { Boolean, Unsigned, Character, Signed, Double, String, Bits, NumberOfKinds };
+
+struct Item
+{
+  Kind kind;
+  uint64_t value; // also the bits of a double
+  uint8_t width;  // of Bits
+  std::string text;
+};
+
+static double toDouble(uint64_t bits)
+{
+  double d;
+  memcpy(&d,&bits,sizeof(d));
+  return d;
+}
+
+static uint64_t toBits(double d)
+{
+  uint64_t bits;
+  memcpy(&bits,&d,sizeof(bits));
+  return bits;
+}
+
+// doubles of every kind the codec tells apart: zero, values of acofdoe,
+// powers of two, mantissas with repeated bytes and random ones
+static uint64_t randomDouble(PRCtestRandom &random)
+{
+  const uint64_t sign = (uint64_t)(random.next() & 1) << 63;
+  switch(random.next() % 6)
+  {
+    case 0:
+      return sign;
+    case 1:
+      return sign | (toBits(acofdoe[random.next() % NUMBEROFELEMENTINACOFDOE].u2uod.Value) & ~((uint64_t)1 << 63));
+    case 2:
+      return sign | (uint64_t)(1+random.next() % 2046) << 52;
+    case 3:
+    {
+      const uint64_t byte = random.next() & 0xFF;
+      uint64_t mantissa = 0;
+      for(int i = 0; i < 7; ++i)
+        mantissa = mantissa << 8 | ((random.next() & 3) == 0 ? random.next() & 0xFF : byte);
+      return sign | (uint64_t)(1+random.next() % 2046) << 52 | (mantissa & (((uint64_t)1 << 52)-1));
+    }
+    case 4:
+      return toBits((double)(int32_t)random.next()/(1+random.next() % 1000));
+    default:
+      return sign | (uint64_t)(1+random.next() % 2046) << 52 | (random.next64() & (((uint64_t)1 << 52)-1));
+  }
+}
+
+static Item randomItem(PRCtestRandom &random)
+{
+  Item item;
+  item.kind = (Kind)(random.next() % NumberOfKinds);
+  item.width = 0;
+  const uint32_t r = random.next();
+  switch(item.kind)
+  {
+    case Boolean: item.value = r & 1; break;
+    case Unsigned: case Signed: item.value = r >> (random.next() % 32); break;
+    case Character: item.value = r & 0xFF; break;
+    case Double: item.value = randomDouble(random); break;
+    case String:
+      item.value = 0;
+      for(uint32_t i = r % 20; i > 0; --i)
+        item.text += (char)(1+random.next() % 255);
+      break;
+    case Bits:
+      item.width = (uint8_t)(1+random.next() % 56);
+      item.value = random.next64() & (((uint64_t)1 << item.width)-1);
+      break;
+    default: break;
+  }
+  return item;
+}
+
+static void write(PRCbitStream &out, const Item &item)
+{
+  switch(item.kind)
+  {
+    case Boolean: out << (item.value != 0); break;
+    case Unsigned: out << (uint32_t)item.value; break;
+    case Character: out << (uint8_t)item.value; break;
+    case Signed: out << (int32_t)(uint32_t)item.value; break;
+    case Double: out << toDouble(item.value); break;
+    case String: out << item.text; break;
+    case Bits: out.writeBits(item.value,item.width); break;
+    default: break;
+  }
+}
+
+static void checkRead(PRCbitReader &in, const Item &item, size_t index)
+{
+  switch(item.kind)
+  {
+    case Boolean: { bool b; in >> b; PRC_CHECK(b == (item.value != 0), "item " << index << ": boolean") break; }
+    case Unsigned: { uint32_t u; in >> u; PRC_CHECK(u == item.value, "item " << index << ": unsigned " << item.value << " read as " << u) break; }
+    case Character: { uint8_t c; in >> c; PRC_CHECK(c == item.value, "item " << index << ": character") break; }
+    case Signed:
+    {
+      int32_t i;
+      in >> i;
+      PRC_CHECK(i == (int32_t)(uint32_t)item.value, "item " << index << ": signed " << (int32_t)(uint32_t)item.value << " read as " << i)
+      break;
+    }
+    case Double:
+    {
+      double d;
+      in >> d;
+      // -0.0 is written as 0.0
+      const uint64_t expected = (item.value << 1) == 0 ? 0 : item.value;
+      PRC_CHECK(toBits(d) == expected, "item " << index << ": double " << std::hex << item.value << " read as " << toBits(d) << std::dec)
+      break;
+    }
+    case String: { std::string s; in >> s; PRC_CHECK(s == item.text, "item " << index << ": string") break; }
+    case Bits:
+    {
+      const uint64_t bits = in.readBits(item.width);
+      PRC_CHECK(bits == item.value, "item " << index << ": " << (unsigned int)item.width << " bits")
+      break;
+    }
+    default: break;
+  }
+}
+
+static void roundTrip(uint64_t seed, size_t count)
+{
+  PRCtestRandom random(seed);
+  std::vector<Item> items;
+  for(size_t i = 0; i < count; ++i)
+    items.push_back(randomItem(random));
+
+  uint8_t *data = NULL;
+  PRCbitStream out(data,0);
+  for(size_t i = 0; i < count; ++i)
+    write(out,items[i]);
+  const uint64_t bits = out.getBitCount();
+
+  PRCbitReader in(out.getData(),out.getSize());
+  for(size_t i = 0; i < count; ++i)
+    checkRead(in,items[i],i);
+  PRC_CHECK(in.getPosition() == bits, "seed " << seed << ": read " << in.getPosition() << " bits of " << bits)
+  PRC_CHECK(!in.overrun(), "seed " << seed << ": overrun")
+}
+
+// every value of acofdoe, either sign, and the values next to it
+static void roundTripTable()
+{
+  uint8_t *data = NULL;
+  PRCbitStream out(data,0);
+  std::vector<uint64_t> values;
+  for(size_t i = 0; i < NUMBEROFELEMENTINACOFDOE; ++i)
+  {
+    const uint64_t bits = toBits(acofdoe[i].u2uod.Value);
+    for(int sign = 0; sign < 2; ++sign)
+    {
+      const uint64_t value = bits | (uint64_t)sign << 63;
+      values.push_back(value);
+      if((bits << 1) != 0)
+      {
+        values.push_back(value+1);
+        values.push_back(value-1);
+      }
+    }
+  }
+  for(size_t i = 0; i < values.size(); ++i)
+    out << toDouble(values[i]);
+  PRCbitReader in(out.getData(),out.getSize());
+  for(size_t i = 0; i < values.size(); ++i)
+  {
+    Item item;
+    item.kind = Double;
+    item.value = values[i];
+    checkRead(in,item,i);
+  }
+}
+
+// Writes after compress() are refused, leaving the compressed data as
+// it was: inflated, it reads back as what was written before.
+static void writeAfterCompress()
+{
+  PRCtestRandom random(1);
+  std::vector<Item> items;
+  for(size_t i = 0; i < 1000; ++i)
+    items.push_back(randomItem(random));
+  uint8_t *data = NULL;
+  PRCbitStream out(data,0);
+  for(size_t i = 0; i < items.size(); ++i)
+    write(out,items[i]);
+  out.compress();
+  const unsigned int size = out.getSize();
+  const unsigned int uncompressed = out.getUncompressedSize();
+  const uint64_t bits = out.getBitCount();
+  const std::vector<uint8_t> compressed(out.getData(),out.getData()+size);
+  out.writeBits(5,3);
+  out << 1.5;
+  out << (uint32_t)7;
+  PRC_CHECK(out.getSize() == size, "compressed size changed from " << size << " to " << out.getSize())
+  PRC_CHECK(out.getUncompressedSize() == uncompressed, "uncompressed size changed")
+  PRC_CHECK(out.getBitCount() == bits, "bit count changed from " << bits << " to " << out.getBitCount())
+  PRC_CHECK(memcmp(out.getData(),&compressed[0],size) == 0, "compressed data changed")
+
+  std::vector<uint8_t> inflated(uncompressed);
+  uLongf length = uncompressed;
+  PRC_CHECK(uncompress(&inflated[0],&length,&compressed[0],size) == Z_OK && length == uncompressed, "inflate failed")
+  PRCbitReader in(&inflated[0],uncompressed);
+  for(size_t i = 0; i < items.size(); ++i)
+    checkRead(in,items[i],i);
+}
+
+int main()
+{
+  for(uint64_t seed = 1; seed <= 200; ++seed)
+    roundTrip(seed,5000);
+  roundTripTable();
+  writeAfterCompress();
+  return prcTestResult();
+}
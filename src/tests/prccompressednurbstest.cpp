@@ -0,0 +1,318 @@
+// The control points of compressed faces: random faces of degree 1 and 3,
+// general, planar, with points coinciding and close to parallelograms,
+// must write the same bits one at a time and predicted in batches of
+// mixed degrees as the original scalar prediction, kept here as the
+// reference with the rounding it used.
+
+#include "writePRC.h"
+#include "prctest.h"
+
+#include <float.h>
+#include <limits.h>
+#include <math.h>
+#include <string.h>
+#include <vector>
+
+// defined in writePRC.cc
+uint32_t Log2(uint32_t x);
+void writeUnsignedIntegerWithVariableBitNumber(PRCbitStream &pbs, uint32_t value, uint32_t bit_number);
+void writeIntegerWithVariableBitNumber(PRCbitStream &pbs, int32_t iValue, uint32_t uBitNumber);
+
+static int32_t intdiv(double dValue, double dTolerance)
+{
+  double ratio=fabs(dValue)/dTolerance;
+  int32_t iTempValue=(int32_t) ratio;
+  if(ratio - iTempValue >= 0.5) iTempValue++;
+  if(dValue < 0)
+    return -iTempValue;
+  else
+    return iTempValue;
+}
+
+static double roundto(double dValue, double dTolerance)
+{
+  return intdiv(dValue, dTolerance) * dTolerance;
+}
+
+static PRCVector3d roundto(PRCVector3d vec, double dTolerance)
+{
+  return PRCVector3d(roundto(vec.x,dTolerance),roundto(vec.y,dTolerance),roundto(vec.z,dTolerance));
+}
+
+struct itriple
+{
+  int32_t x;
+  int32_t y;
+  int32_t z;
+};
+
+static itriple iroundto(PRCVector3d vec, double dTolerance)
+{
+  itriple res;
+  res.x = intdiv(vec.x, dTolerance);
+  res.y = intdiv(vec.y, dTolerance);
+  res.z = intdiv(vec.z, dTolerance);
+  return res;
+}
+
+static uint32_t bitsOfInteger(int32_t iValue)
+{
+  const uint32_t uValue = iValue<0 ? 0u-(uint32_t)iValue : (uint32_t)iValue;
+  uint32_t bits = 1;
+  while(bits < 32 && (uValue >> bits) != 0)
+    bits++;
+  return bits+1;
+}
+
+static uint32_t bitsOfTriple(const itriple &iTriple)
+{
+  return std::max(bitsOfInteger(iTriple.x),std::max(bitsOfInteger(iTriple.y),bitsOfInteger(iTriple.z)));
+}
+
+// PRCCompressedFace::serializeCompressedFace as it was before the points
+// were predicted in batches
+static void writeReference(PRCbitStream &pbs, const PRCCompressedFace &face, double brep_data_compressed_tolerance)
+{
+   pbs << false; // is_a_curve
+   writeUnsignedIntegerWithVariableBitNumber(pbs, 13, 4);
+   pbs << face.orientation_surface_with_shell;
+   pbs << false; // surface_is_trimmed
+
+   const double nurbs_tolerance = 0.2*brep_data_compressed_tolerance;
+   const uint32_t degree = face.degree;
+   writeUnsignedIntegerWithVariableBitNumber(pbs, degree, 5);
+   writeUnsignedIntegerWithVariableBitNumber(pbs, degree, 5);
+   for(int k = 0; k < 2; k++)
+   {
+     writeUnsignedIntegerWithVariableBitNumber(pbs, 4-2, 16);
+     pbs << false;
+     writeUnsignedIntegerWithVariableBitNumber(pbs, degree+1, degree ? Log2(degree+2) : 2);
+     pbs << true;
+   }
+   pbs << false; // is_closed_u
+   pbs << false; // is_closed_v
+
+   const uint32_t n = degree+1;
+   PRCVector3d P[4][4];
+   itriple compressed_control_point[4][4];
+   uint32_t control_point_type[4][4];
+   for(uint32_t i=0;i<n;i++)
+   for(uint32_t j=0;j<n;j++)
+      P[i][j] = face.control_point[i*n+j];
+
+   uint32_t number_of_bits_for_isomin = 1;
+   uint32_t number_of_bits_for_rest = 1;
+
+   for(uint32_t j = 1; j < n; j++)
+   {
+      compressed_control_point[0][j] = iroundto(P[0][j]-P[0][j-1], nurbs_tolerance );
+      P[0][j] = P[0][j-1] + roundto(P[0][j]-P[0][j-1], nurbs_tolerance);
+      number_of_bits_for_isomin = std::max(number_of_bits_for_isomin,bitsOfTriple(compressed_control_point[0][j]));
+   }
+   for(uint32_t i = 1; i < n; i++)
+   {
+      compressed_control_point[i][0] = iroundto(P[i][0]-P[i-1][0], nurbs_tolerance );
+      P[i][0] = P[i-1][0] + roundto(P[i][0]-P[i-1][0], nurbs_tolerance);
+      number_of_bits_for_isomin = std::max(number_of_bits_for_isomin,bitsOfTriple(compressed_control_point[i][0]));
+   }
+
+   for(uint32_t i=1;i<n;i++)
+   for(uint32_t j=1;j<n;j++)
+   {
+     compressed_control_point[i][j].x = 0;
+     compressed_control_point[i][j].y = 0;
+     compressed_control_point[i][j].z = 0;
+
+     PRCVector3d V = P[i-1][j] - P[i-1][j-1];
+     PRCVector3d U = P[i][j-1] - P[i-1][j-1];
+     PRCVector3d Pc = P[i][j] - (P[i-1][j-1] + U + V);
+
+     if(Pc.Length() < nurbs_tolerance)
+     {
+       control_point_type[i][j] = 0;
+       P[i][j] = P[i-1][j-1] + U + V;
+     }
+     else
+     {
+       PRCVector3d N = U*V;
+       PRCVector3d Ue = U;
+       PRCVector3d Ne = N;
+       if( V.Length() < FLT_EPSILON || !Ue.Normalize() || !Ne.Normalize())
+       {
+          control_point_type[i][j] = 3;
+          compressed_control_point[i][j] = iroundto(Pc, nurbs_tolerance);
+          P[i][j] = P[i-1][j-1] + U + V + roundto(Pc, nurbs_tolerance);
+       }
+       else
+       {
+         PRCVector3d NUe = Ne*Ue;
+         double x = Pc.Dot(Ue);
+         double y = Pc.Dot(NUe);
+         double z = Pc.Dot(Ne);
+
+         if(x*x+y*y<nurbs_tolerance*nurbs_tolerance)
+         {
+           control_point_type[i][j] = 1;
+           compressed_control_point[i][j] = iroundto(PRCVector3d(0.0,0.0,z), nurbs_tolerance);
+           P[i][j] = P[i-1][j-1] + U + V + roundto(z, nurbs_tolerance)*Ne;
+         }
+         else if(fabs(z)<nurbs_tolerance/2)
+         {
+           control_point_type[i][j] = 2;
+           compressed_control_point[i][j] = iroundto(PRCVector3d(x,y,0.0), nurbs_tolerance);
+           P[i][j] = P[i-1][j-1] + U + V + roundto(x, nurbs_tolerance)*Ue + roundto(y, nurbs_tolerance)*NUe;
+         }
+         else
+         {
+           control_point_type[i][j] = 3;
+           compressed_control_point[i][j] = iroundto(Pc, nurbs_tolerance);
+           P[i][j] = P[i-1][j-1] + U + V + roundto(Pc, nurbs_tolerance);
+         }
+       }
+     }
+     number_of_bits_for_rest = std::max(number_of_bits_for_rest,bitsOfTriple(compressed_control_point[i][j]));
+   }
+
+   if( number_of_bits_for_rest == 2 ) number_of_bits_for_rest--;
+   writeUnsignedIntegerWithVariableBitNumber(pbs, number_of_bits_for_isomin, 20);
+   writeUnsignedIntegerWithVariableBitNumber(pbs, number_of_bits_for_rest, 20);
+   pbs << P[0][0].x;
+   pbs << P[0][0].y;
+   pbs << P[0][0].z;
+
+   for(uint32_t j = 1; j < n; j++)
+   {
+      writeIntegerWithVariableBitNumber(pbs, compressed_control_point[0][j].x, number_of_bits_for_isomin+1);
+      writeIntegerWithVariableBitNumber(pbs, compressed_control_point[0][j].y, number_of_bits_for_isomin+1);
+      writeIntegerWithVariableBitNumber(pbs, compressed_control_point[0][j].z, number_of_bits_for_isomin+1);
+   }
+   for(uint32_t i = 1; i < n; i++)
+   {
+      writeIntegerWithVariableBitNumber(pbs, compressed_control_point[i][0].x, number_of_bits_for_isomin+1);
+      writeIntegerWithVariableBitNumber(pbs, compressed_control_point[i][0].y, number_of_bits_for_isomin+1);
+      writeIntegerWithVariableBitNumber(pbs, compressed_control_point[i][0].z, number_of_bits_for_isomin+1);
+   }
+   for(uint32_t i = 1; i < n; i++)
+   for(uint32_t j = 1; j < n; j++)
+   {
+      const uint32_t type = control_point_type[i][j];
+      const itriple &c = compressed_control_point[i][j];
+      writeUnsignedIntegerWithVariableBitNumber(pbs, type, 2);
+      if(type == 2 || type == 3)
+      {
+        writeIntegerWithVariableBitNumber(pbs, c.x, number_of_bits_for_rest+1);
+        writeIntegerWithVariableBitNumber(pbs, c.y, number_of_bits_for_rest+1);
+      }
+      if(type == 1 || type == 3)
+        writeIntegerWithVariableBitNumber(pbs, c.z, number_of_bits_for_rest+1);
+   }
+
+   pbs << true; // type_param_u == 0
+   pbs << true; // type_param_v == 0
+   pbs << false; // is_rational
+}
+
+static const double tolerance = 1e-3;
+static const double nurbs_tolerance = 0.2*tolerance;
+
+// a coordinate on the quantization grid, half way between two steps of
+// it, or anywhere
+static double randomCoordinate(PRCtestRandom &random, double scale)
+{
+  const uint32_t r = random.next();
+  const double steps = (int32_t)((r >> 4) % 20001)-10000;
+  switch(r % 4)
+  {
+    case 0: return steps*nurbs_tolerance*scale;
+    case 1: return (steps+0.5)*nurbs_tolerance*scale;
+    default: return (random.next64() % 2000001)/1000000.0*scale-scale;
+  }
+}
+
+static PRCVector3d randomVector(PRCtestRandom &random, double scale)
+{
+  const double x = randomCoordinate(random,scale);
+  const double y = randomCoordinate(random,scale);
+  return PRCVector3d(x,y,randomCoordinate(random,scale));
+}
+
+// kinds of faces: general, planar with points within or off the plane by
+// less than the tolerance, parallelograms up to less than the tolerance,
+// points coinciding, rows of points on a line
+static void randomFace(PRCtestRandom &random, PRCCompressedFace &face, unsigned int &kinds)
+{
+  const uint32_t r = random.next();
+  face.degree = r % 2 == 0 ? 1 : 3;
+  face.orientation_surface_with_shell = (r >> 1) % 2 == 0;
+  const uint32_t n = face.degree+1;
+  const int kind = (r >> 2) % 6;
+  kinds |= 1 << kind;
+  const PRCVector3d origin = randomVector(random,1);
+  const PRCVector3d U = randomVector(random,0.3), V = randomVector(random,0.3);
+  face.control_point.resize(n*n);
+  for(uint32_t i = 0; i < n; i++)
+  for(uint32_t j = 0; j < n; j++)
+  {
+    PRCVector3d &p = face.control_point[i*n+j];
+    const PRCVector3d grid = origin+(double)i*U+(double)j*V;
+    switch(kind)
+    {
+      case 0: p = randomVector(random,1); break;
+      case 1:
+      {
+        const double a = randomCoordinate(random,0.2), b = randomCoordinate(random,0.2);
+        const double off = (random.next() % 3)*0.2*nurbs_tolerance;
+        p = grid+a*U+b*V+off*(U*V);
+        break;
+      }
+      case 2: p = grid+randomVector(random,0.6*nurbs_tolerance); break;
+      case 3: p = random.next() % 2 == 0 ? origin : grid; break;
+      case 4: p = origin+(double)(i+j)*U+randomVector(random,random.next() % 2 == 0 ? 0 : 0.01); break;
+      default: p = grid+randomVector(random,(random.next() % 8)*nurbs_tolerance); break;
+    }
+  }
+}
+
+static bool sameBits(PRCbitStream &out, PRCbitStream &reference)
+{
+  return out.getBitCount() == reference.getBitCount() &&
+         memcmp(out.getData(),reference.getData(),out.getSize()) == 0;
+}
+
+int main()
+{
+  unsigned int kinds = 0, types = 0;
+  for(uint64_t seed = 1; seed <= 3000; ++seed)
+  {
+    PRCtestRandom random(seed);
+    const size_t count = 1+random.next() % 40;
+    std::vector<PRCCompressedFace> face(count);
+    std::vector<PRCCompressedFace*> pointer(count);
+    for(size_t i = 0; i < count; i++)
+    {
+      randomFace(random,face[i],kinds);
+      pointer[i] = &face[i];
+    }
+    std::vector<PRCcompressedNurbsPoints> points(count);
+    predictCompressedFaces(&pointer[0],count,tolerance,&points[0]);
+
+    for(size_t i = 0; i < count; i++)
+    {
+      uint8_t *single_data = NULL, *batch_data = NULL, *reference_data = NULL;
+      PRCbitStream single(single_data,0), batch(batch_data,0), reference(reference_data,0);
+      face[i].serializeCompressedFace(single,tolerance);
+      face[i].serializeCompressedFace(batch,points[i]);
+      writeReference(reference,face[i],tolerance);
+      PRC_CHECK(sameBits(single,reference), "seed " << seed << ": face " << i << " alone writes "
+                << single.getBitCount() << " bits, " << reference.getBitCount() << " by the reference")
+      PRC_CHECK(sameBits(batch,reference), "seed " << seed << ": face " << i << " of " << count << " writes "
+                << batch.getBitCount() << " bits, " << reference.getBitCount() << " by the reference")
+      const uint32_t n = points[i].size;
+      for(uint32_t k = n+1; k < n*n; k++)
+        if(k % n != 0)
+          types |= 1 << points[i].type[k];
+    }
+  }
+  PRC_CHECK(kinds == 0x3f && types == 0xf, "faces of kinds " << kinds << ", points of types " << types)
+  return prcTestResult();
+}
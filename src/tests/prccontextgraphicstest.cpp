@@ -0,0 +1,152 @@
+// The graphics of the faces of a topological context: contexts of random
+// bodies, whose faces are registered as the bodies are added, must write
+// the same bits as the original walk over the bodies at serialization,
+// kept here as the reference.
+
+#include "writePRC.h"
+#include "prctest.h"
+
+#include <string.h>
+#include <vector>
+
+// PRCTopoContext::serializeContextGraphics as it was before the faces
+// were registered
+static void writeReference(PRCbitStream &pbs, PRCTopoContext &context)
+{
+   uint32_t i=0, j=0, k=0, l=0;
+   resetGraphics(pbs);
+   uint32_t number_of_body = context.body.size();
+   PRCGraphicsList element;
+   bool has_graphics = false;
+   for (i=0;i<number_of_body;i++)
+   {
+        if ( context.body[i]->topo_item_type == PRC_TYPE_TOPO_BrepData && dynamic_cast<PRCBrepData*>(context.body[i]))
+        {
+                PRCBrepData *body_i = dynamic_cast<PRCBrepData*>(context.body[i]);
+                for (j=0;j<body_i->connex.size();j++)
+                {
+                        for(k=0;k<body_i->connex[j]->shell.size();k++)
+                        {
+                                for( l=0;l<body_i->connex[j]->shell[k]->face.size();l++)
+                                {
+                                        element.push_back( body_i->connex[j]->shell[k]->face[l] );
+                                        has_graphics = has_graphics || body_i->connex[j]->shell[k]->face[l]->has_graphics();
+                                }
+                        }
+                }
+        }
+        else if ( context.body[i]->topo_item_type == PRC_TYPE_TOPO_BrepDataCompress && dynamic_cast<PRCCompressedBrepData*>(context.body[i]))
+        {
+                PRCCompressedBrepData *body_i = dynamic_cast<PRCCompressedBrepData*>(context.body[i]);
+                for( l=0;l<body_i->face.size();l++)
+                {
+                        element.push_back( body_i->face[l] );
+                        has_graphics = has_graphics || body_i->face[l]->has_graphics();
+                }
+        }
+   }
+   uint32_t number_of_treat_type = 0;
+   if (has_graphics && !element.empty())
+     number_of_treat_type = 1;
+   pbs << number_of_treat_type;
+   for (i=0;i<number_of_treat_type;i++)
+   {
+      const uint32_t element_type = PRC_TYPE_TOPO_Face;
+      pbs << element_type;
+      const uint32_t number_of_element = element.size();
+      pbs << number_of_element;
+      for (j=0;j<number_of_element;j++)
+      {
+         pbs << element[j]->has_graphics();
+         if (element[j]->has_graphics())
+         {
+            element[j]->serializeGraphics(pbs);
+         }
+      }
+   }
+}
+
+// default graphics mostly, so that runs of equal ones and contexts
+// without any occur; none at all when plain
+static void randomGraphics(PRCtestRandom &random, PRCGraphics &graphics, bool plain)
+{
+  const uint32_t r = random.next();
+  if(plain || r % 3 != 0)
+    return;
+  graphics.layer_index = (r >> 4) % 4 == 0 ? m1 : (r >> 8) % 3;
+  graphics.index_of_line_style = (r >> 12) % 3 == 0 ? m1 : (r >> 16) % 4;
+  if((r >> 20) % 4 == 0)
+    graphics.behaviour_bit_field = PRC_GRAPHICS_Show | PRC_GRAPHICS_SonHeritShow;
+}
+
+static void randomContext(PRCtestRandom &random, PRCTopoContext &context)
+{
+  const bool plain = random.next() % 4 == 0;
+  for(uint32_t b = random.next() % 6; b > 0; --b)
+  {
+    switch(random.next() % 3)
+    {
+      case 0:
+      {
+        PRCBrepData *body = new PRCBrepData;
+        for(uint32_t c = 1+random.next() % 3; c > 0; --c)
+        {
+          PRCConnex *connex = new PRCConnex;
+          for(uint32_t s = 1+random.next() % 3; s > 0; --s)
+          {
+            PRCShell *shell = new PRCShell;
+            for(uint32_t f = random.next() % 5; f > 0; --f)
+            {
+              PRCFace *face = new PRCFace;
+              randomGraphics(random,*face,plain);
+              shell->addFace(face);
+            }
+            connex->addShell(shell);
+          }
+          body->addConnex(connex);
+        }
+        context.addBrepData(body);
+        break;
+      }
+      case 1:
+      {
+        PRCCompressedBrepData *body = new PRCCompressedBrepData;
+        for(uint32_t f = random.next() % 6; f > 0; --f)
+        {
+          PRCCompressedFace *face = new PRCCompressedFace;
+          randomGraphics(random,*face,plain);
+          body->face.push_back(face);
+        }
+        context.addCompressedBrepData(body);
+        break;
+      }
+      default:
+      {
+        PRCSingleWireBody *body = new PRCSingleWireBody;
+        context.addSingleWireBody(body);
+      }
+    }
+  }
+}
+
+int main()
+{
+  unsigned int with_graphics = 0;
+  for(uint64_t seed = 1; seed <= 2000; ++seed)
+  {
+    PRCtestRandom random(seed);
+    PRCTopoContext context;
+    randomContext(random,context);
+
+    uint8_t *data = NULL, *reference_data = NULL;
+    PRCbitStream out(data,0), reference(reference_data,0);
+    context.serializeContextGraphics(out);
+    writeReference(reference,context);
+    const uint64_t bits = out.getBitCount();
+    PRC_CHECK(bits == reference.getBitCount() && memcmp(out.getData(),reference.getData(),out.getSize()) == 0,
+              "seed " << seed << ": " << bits << " bits written, " << reference.getBitCount() << " by the reference")
+    with_graphics += bits > 8 ? 1 : 0;
+  }
+  PRC_CHECK(with_graphics > 100, "only " << with_graphics << " contexts with face graphics")
+  return prcTestResult();
+}
@@ -0,0 +1,341 @@
+// Differential test of the double encoding: PRCbitStream must write the
+// same bits as the original encoder, which searched acofdoe with bsearch
+// and scanned it, kept here as the reference. Random bit patterns, values
+// of the table and their neighbours, powers of two, subnormals and the
+// coordinates of real meshes are written one at a time, in batches and
+// through the double cache, with and without entity statistics, which
+// must count each value under the encoding the reference chose for it.
+// An argument multiplies the number of random
+// values, 1 by default.
+
+#include "PRCbitStream.h"
+#include "PRCdouble.h"
+#include "prctest.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+// the bits of the reference encoder, most significant first in each byte
+class ReferenceBits
+{
+  public:
+    ReferenceBits() : count(0) {}
+    void writeBit(bool bit)
+    {
+      if(count % 8 == 0)
+        bytes.push_back(0);
+      if(bit)
+        bytes.back() |= 0x80 >> (count % 8);
+      ++count;
+    }
+    void writeBits(uint32_t value, uint8_t bits)
+    {
+      for(int i = bits-1; i >= 0; --i)
+        writeBit((value >> i) & 1);
+    }
+    void writeByte(uint8_t byte) { writeBits(byte,8); }
+    std::vector<uint8_t> bytes;
+    uint64_t count;
+};
+
+// PRCbitStream::operator<<(double) as it was before the encoding tables;
+// returns how the value was encoded, a PRCentityStatistics::DoubleEncoding
+static unsigned int writeReference(ReferenceBits &out, double value)
+{
+  union ieee754_double *pid=(union ieee754_double *)&value;
+  int
+        i,
+        fSaveAtEnd;
+        PRCbyte
+        *pb,
+        *pbStart,
+        *pbStop,
+        *pbEnd,
+        *pbResult,
+        bSaveAtEnd = 0;
+  struct sCodageOfFrequentDoubleOrExponent
+        cofdoe,
+        *pcofdoe;
+
+  cofdoe.u2uod.Value=value;
+  pcofdoe = (struct sCodageOfFrequentDoubleOrExponent *)bsearch(
+                           &cofdoe,
+                           acofdoe,
+                           sizeof(acofdoe)/sizeof(pcofdoe[0]),
+                           sizeof(pcofdoe[0]),
+                           stCOFDOECompare);
+
+  while(pcofdoe>acofdoe && EXPONENT(pcofdoe->u2uod.Value)==EXPONENT((pcofdoe-1)->u2uod.Value))
+    pcofdoe--;
+
+  while(pcofdoe->Type==VT_double)
+  {
+    if(fabs(value)==pcofdoe->u2uod.Value)
+      break;
+    pcofdoe++;
+  }
+
+  for(i=1<<(pcofdoe->NumberOfBits-1);i>=1;i>>=1)
+    out.writeBit((pcofdoe->Bits&i)!=0);
+
+  if
+  (
+    !memcmp(&value,stadwZero,sizeof(value))
+    ||      !memcmp(&value,stadwNegativeZero,sizeof(value))
+  )
+    return PRCentityStatistics::DoubleZero;
+
+  out.writeBit(pid->ieee.negative);
+
+  if(pcofdoe->Type==VT_double)
+    return PRCentityStatistics::DoubleTable;
+
+  if(pid->ieee.mantissa0==0 && pid->ieee.mantissa1==0)
+  {
+    out.writeBit(0);
+    return PRCentityStatistics::DoubleExponent;
+  }
+
+  out.writeBit(1);
+
+#ifdef WORDS_BIGENDIAN
+  pb=((PRCbyte *)&value)+1;
+#else
+  pb=((PRCbyte *)&value)+6;
+#endif
+  out.writeBits((*pb)&0x0F,4);
+
+  NEXTBYTE(pb);
+  pbStart=pb;
+#ifdef WORDS_BIGENDIAN
+  pbEnd=
+  pbStop= ((PRCbyte *)(&value+1))-1;
+#else
+  pbEnd=
+  pbStop= ((PRCbyte *)&value);
+#endif
+
+  if((fSaveAtEnd=(*pbStop!=*BEFOREBYTE(pbStop)))!=0)
+    bSaveAtEnd=*pbEnd;
+  PREVIOUSBYTE(pbStop);
+
+  while(*pbStop==*BEFOREBYTE(pbStop))
+    PREVIOUSBYTE(pbStop);
+
+  for(;MOREBYTE(pb,pbStop);NEXTBYTE(pb))
+  {
+    if(pb!=pbStart && (pbResult=SEARCHBYTE(BEFOREBYTE(pb),*pb,DIFFPOINTERS(pb,pbStart)))!=NULL)
+    {
+      out.writeBit(0);
+      out.writeBits(DIFFPOINTERS(pb,pbResult),3);
+    }
+    else
+    {
+      out.writeBit(1);
+      out.writeByte(*pb);
+    }
+  }
+
+  if(!MOREBYTE(BEFOREBYTE(pbEnd),pbStop))
+  {
+    if(fSaveAtEnd)
+    {
+      out.writeBit(0);
+      out.writeBits(6,3);
+      out.writeByte(bSaveAtEnd);
+    }
+    else
+    {
+      out.writeBit(0);
+      out.writeBits(0,3);
+    }
+  }
+  else
+  {
+    if((pbResult=SEARCHBYTE(BEFOREBYTE(pb),*pb,DIFFPOINTERS(pb,pbStart)))!=NULL)
+    {
+      out.writeBit(0);
+      out.writeBits(DIFFPOINTERS(pb,pbResult),3);
+    }
+    else
+    {
+      out.writeBit(1);
+      out.writeByte(*pb);
+    }
+  }
+  return PRCentityStatistics::DoubleMantissa;
+}
+
+static double toDouble(uint64_t bits)
+{
+  double d;
+  memcpy(&d,&bits,sizeof(d));
+  return d;
+}
+
+static uint64_t toBits(double d)
+{
+  uint64_t bits;
+  memcpy(&bits,&d,sizeof(bits));
+  return bits;
+}
+
+enum Mode { Single, Batch, Cached, CountedSingle, CountedBatch, CountedCached };
+
+// the values written by PRCbitStream in that mode and by the reference
+static void compare(const char *name, const std::vector<double> &values, Mode mode)
+{
+  ReferenceBits reference;
+  uint64_t encodings[PRCentityStatistics::NumberOfDoubleEncodings] = {};
+  for(size_t i = 0; i < values.size(); ++i)
+    ++encodings[writeReference(reference,values[i])];
+
+  uint8_t *data = NULL;
+  PRCbitStream out(data,0);
+  PRCentityStatistics statistics;
+  const bool counted = mode >= CountedSingle;
+  if(counted)
+    out.setEntityStatistics(&statistics);
+  if(mode == Cached || mode == CountedCached)
+    out.setDoubleCache(true);
+  if(mode == Batch || mode == CountedBatch)
+    out.writeDoubles(values);
+  else
+    for(size_t i = 0; i < values.size(); ++i)
+      out << values[i];
+  if(counted)
+  {
+    out.setEntityStatistics(NULL);
+    for(unsigned int e = 0; e < PRCentityStatistics::NumberOfDoubleEncodings; ++e)
+      PRC_CHECK(statistics.doubles[e] == encodings[e], name << " mode " << mode << ": " << statistics.doubles[e] << " "
+                << PRCentityStatistics::getDoubleEncodingName(e) << " doubles counted instead of " << encodings[e])
+  }
+  const uint64_t bits = out.getBitCount();
+  // the stream holds a byte more when it ends at a byte boundary
+  const unsigned int size = out.getSize();
+  const uint8_t *bytes = out.getData();
+  const size_t length = reference.bytes.size();
+
+  PRC_CHECK(bits == reference.count, name << " mode " << mode << ": " << bits << " bits instead of " << reference.count)
+  if(bits != reference.count || size < length || memcmp(bytes,&reference.bytes[0],length) != 0)
+  {
+    // find the first value written differently
+    for(size_t i = 0; i < values.size(); ++i)
+    {
+      ReferenceBits one;
+      writeReference(one,values[i]);
+      uint8_t *single_data = NULL;
+      PRCbitStream single(single_data,0);
+      single << values[i];
+      if(single.getBitCount() != one.count || single.getSize() < one.bytes.size() ||
+         memcmp(single.getData(),&one.bytes[0],one.bytes.size()) != 0)
+      {
+        PRC_CHECK(false, name << " mode " << mode << ": value " << i << ", bits " << std::hex << toBits(values[i]) << std::dec << ", written differently")
+        return;
+      }
+    }
+    PRC_CHECK(false, name << " mode " << mode << ": written differently in sequence")
+  }
+}
+
+static void compareAll(const char *name, const std::vector<double> &values)
+{
+  compare(name,values,Single);
+  compare(name,values,Batch);
+  compare(name,values,Cached);
+  compare(name,values,CountedSingle);
+  compare(name,values,CountedBatch);
+  compare(name,values,CountedCached);
+}
+
+static const uint64_t signBit = (uint64_t)1 << 63;
+static const uint64_t mantissaBits = ((uint64_t)1 << 52)-1;
+
+static void special(std::vector<double> &values)
+{
+  values.push_back(0.0);
+  values.push_back(-0.0);
+  for(size_t i = 0; i < NUMBEROFELEMENTINACOFDOE; ++i)
+  {
+    const uint64_t bits = toBits(acofdoe[i].u2uod.Value);
+    for(int negative = 0; negative < 2; ++negative)
+    {
+      const uint64_t sign = negative ? signBit : 0;
+      values.push_back(toDouble(bits | sign));
+      if((bits << 1) != 0)
+      {
+        values.push_back(toDouble((bits | sign)+1));
+        values.push_back(toDouble((bits | sign)-1));
+      }
+    }
+  }
+  for(uint64_t exponent = 0; exponent < 2047; ++exponent)
+  {
+    values.push_back(toDouble(exponent << 52));
+    values.push_back(toDouble(signBit | exponent << 52 | mantissaBits));
+    values.push_back(toDouble(exponent << 52 | 1));
+  }
+  // subnormals
+  for(uint64_t mantissa = 1; mantissa != 0 && mantissa <= mantissaBits; mantissa = mantissa*3+1)
+    values.push_back(toDouble(mantissa));
+}
+
+// finite doubles with random bits, some of them with repeated mantissa
+// bytes, as the codec refers back to those
+static void random(std::vector<double> &values, size_t count, uint64_t seed)
+{
+  PRCtestRandom random(seed);
+  for(size_t i = 0; i < count; ++i)
+  {
+    uint64_t bits = random.next64();
+    if((bits >> 52 & 0x7FF) == 0x7FF)
+      bits &= ~((uint64_t)1 << 62);
+    if(i & 1)
+    {
+      const uint64_t byte = random.next() & 0xFF;
+      for(int k = 0; k < 6; ++k)
+        if(random.next() & 1)
+          bits = (bits & ~((uint64_t)0xFF << 8*k)) | byte << 8*k;
+    }
+    values.push_back(toDouble(bits));
+  }
+}
+
+// what meshes are made of: coordinates of a sphere, normals, texture
+// coordinates and rounded values, repeated as in index-free data
+static void mesh(std::vector<double> &values)
+{
+  const double pi = 3.14159265358979323846;
+  const int n = 200;
+  for(int i = 0; i <= n; ++i)
+    for(int j = 0; j <= n; ++j)
+    {
+      const double theta = pi*i/n, phi = 2*pi*j/n;
+      values.push_back(10*sin(theta)*cos(phi));
+      values.push_back(10*sin(theta)*sin(phi));
+      values.push_back(10*cos(theta));
+      values.push_back((double)i/n);
+      values.push_back((double)j/n);
+      values.push_back(floor(1000*sin(theta)*cos(phi)+0.5)/1000);
+    }
+}
+
+int main(int argc, char **argv)
+{
+  const int scale = argc > 1 ? atoi(argv[1]) : 1;
+  std::vector<double> values;
+  special(values);
+  compareAll("special",values);
+  values.clear();
+  mesh(values);
+  compareAll("mesh",values);
+  for(int run = 0; run < 2*scale; ++run)
+  {
+    values.clear();
+    random(values,250000,run+1);
+    compareAll("random",values);
+  }
+  return prcTestResult();
+}
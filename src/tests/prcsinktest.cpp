@@ -0,0 +1,79 @@
+// The gather buffer: what is written through a stream is copied, so the
+// caller may reuse its data at once, and compressed sections appended to
+// it are taken over, keeping their data until the gather buffer goes.
+
+#include "PRCsink.h"
+#include "PRCbufferPool.h"
+#include "prctest.h"
+
+#include <cstring>
+#include <vector>
+
+// the buffers of a gather buffer, one after the other
+static std::vector<uint8_t> gathered(PRCgatherBuffer &gather)
+{
+  PRCmemorySink sink;
+  const std::vector<PRCbuffer> &buffers = gather.getBuffers();
+  sink.write(buffers.empty() ? NULL : &buffers[0],buffers.size());
+  return std::vector<uint8_t>(sink.getData(),sink.getData()+sink.getSize());
+}
+
+// writes of every size from one buffer, overwritten after each
+static void copiedWrites()
+{
+  PRCtestRandom random(1);
+  std::vector<uint8_t> expected;
+  std::vector<char> scratch(20000);
+  PRCgatherBuffer gather;
+  std::ostream out(&gather);
+  for(size_t size = 0; size < scratch.size(); size = 2*size+1+random.next() % 7)
+  {
+    for(size_t i = 0; i < size; ++i)
+      scratch[i] = (char)random.next();
+    out.write(&scratch[0],size);
+    expected.insert(expected.end(),scratch.begin(),scratch.begin()+size);
+    memset(&scratch[0],0,scratch.size());
+  }
+  PRC_CHECK(gathered(gather) == expected, "gathered data differs from what was written")
+}
+
+// compressed sections between small writes, from a pool and without
+static void appendedSections()
+{
+  PRCbufferPool pool;
+  std::vector<uint8_t> expected;
+  size_t releases = 0;
+  {
+    PRCgatherBuffer gather;
+    std::ostream out(&gather);
+    for(int i = 0; i < 6; ++i)
+    {
+      out << "section " << i;
+      expected.insert(expected.end(),"section ","section "+8);
+      expected.push_back((uint8_t)('0'+i));
+
+      uint8_t *data = NULL;
+      PRCbitStream section(data,0,i % 2 == 0 ? &pool : NULL);
+      for(uint32_t j = 0; j < 1000u*i; ++j)
+        section << j;
+      section.compress();
+      const uint8_t *compressed = section.getData();
+      expected.insert(expected.end(),compressed,compressed+section.getSize());
+      const unsigned int size = section.getSize();
+      gather.append(section);
+      PRC_CHECK(section.getData() == NULL, "section " << i << " kept its data")
+      PRC_CHECK(section.getSize() == size, "section " << i << " changed its size")
+    }
+    PRC_CHECK(gathered(gather) == expected, "gathered sections differ from the compressed data")
+    releases = pool.getReleases();
+  }
+  // the pooled sections' buffers go back to the pool with the gather buffer
+  PRC_CHECK(pool.getReleases() == releases+3, "the pool took back " << pool.getReleases()-releases << " buffers of 3")
+}
+
+int main()
+{
+  copiedWrites();
+  appendedSections();
+  return prcTestResult();
+}
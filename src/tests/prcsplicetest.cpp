@@ -0,0 +1,113 @@
+// Splicing: entities written to streams of their own and appended, by
+// PRCbitStream::append() directly or by writeItems() on several threads,
+// must give the same bits as writing them one after the other, at every
+// bit offset the parent stream may be at.
+
+#include "PRCbitStream.h"
+#include "prctest.h"
+
+#include <string>
+#include <vector>
+
+// an item of random content and length, the same for each index
+static void writeItem(PRCbitStream &out, size_t index)
+{
+  PRCtestRandom random(index+1);
+  const uint32_t parts = random.next() % 12;
+  for(uint32_t i = 0; i < parts; ++i)
+  {
+    const uint32_t r = random.next();
+    switch(r % 6)
+    {
+      case 0: out << (bool)(r & 0x100); break;
+      case 1: out << (uint32_t)(random.next() >> (r >> 27)); break;
+      case 2: out << (int32_t)random.next(); break;
+      case 3: out << (double)(int32_t)random.next()/(1+(r >> 20)); break;
+      case 4: out << std::string(r >> 28,(char)('a'+(r >> 8) % 26)); break;
+      default:
+      {
+        const uint8_t width = (uint8_t)(1+(r >> 8) % 57);
+        out.writeBits(random.next64(),width);
+      }
+    }
+  }
+}
+
+class RandomItems : public PRCbitStreamItems
+{
+  public:
+    void write(PRCbitStream &out, size_t index) { writeItem(out,index); }
+};
+
+// a prefix of that many bits, so that items start at any offset
+static void writePrefix(PRCbitStream &out, uint32_t bits)
+{
+  for(; bits > 32; bits -= 32)
+    out.writeBits(0xA5A5A5A5,32);
+  out.writeBits(0x5A5A5A5A,(uint8_t)bits);
+}
+
+static bool same(PRCbitStream &a, PRCbitStream &b)
+{
+  return a.getBitCount() == b.getBitCount() && a.getSize() == b.getSize() &&
+         std::vector<uint8_t>(a.getData(),a.getData()+a.getSize()) ==
+         std::vector<uint8_t>(b.getData(),b.getData()+b.getSize());
+}
+
+// each item written to a stream of its own and appended
+static void testAppend(uint32_t prefix, size_t count)
+{
+  uint8_t *expected_data = NULL, *spliced_data = NULL;
+  PRCbitStream expected(expected_data,0), spliced(spliced_data,0);
+  writePrefix(expected,prefix);
+  writePrefix(spliced,prefix);
+  for(size_t i = 0; i < count; ++i)
+  {
+    writeItem(expected,i);
+    uint8_t *item_data = NULL;
+    PRCbitStream item(item_data,0);
+    writeItem(item,i);
+    spliced.append(item);
+  }
+  expected << (uint32_t)12345;
+  spliced << (uint32_t)12345;
+  PRC_CHECK(same(expected,spliced), "append after " << prefix << " bits, " << count << " items")
+}
+
+// writeItems() on that many threads against one, with or without the
+// double cache
+static void testItems(uint32_t prefix, size_t count, unsigned int threads, bool cache)
+{
+  RandomItems items;
+  uint8_t *expected_data = NULL, *spliced_data = NULL;
+  PRCbitStream expected(expected_data,0), spliced(spliced_data,0);
+  expected.setDoubleCache(cache);
+  spliced.setDoubleCache(cache);
+  spliced.setThreads(threads);
+  writePrefix(expected,prefix);
+  writePrefix(spliced,prefix);
+  expected.writeItems(items,count);
+  spliced.writeItems(items,count);
+  expected << true;
+  spliced << true;
+  PRC_CHECK(same(expected,spliced), "writeItems after " << prefix << " bits, " << count << " items, " << threads << " threads" << (cache ? ", cached" : ""))
+}
+
+int main()
+{
+  for(uint32_t prefix = 0; prefix < 80; ++prefix)
+  {
+    testAppend(prefix,prefix % 7);
+    testAppend(prefix,200);
+  }
+  const unsigned int threads[] = { 0, 2, 3, 4, 8 };
+  const size_t counts[] = { 0, 1, 2, 7, 100, 5000 };
+  for(uint32_t prefix = 0; prefix < 17; ++prefix)
+    for(size_t t = 0; t < sizeof(threads)/sizeof(threads[0]); ++t)
+      for(size_t c = 0; c < sizeof(counts)/sizeof(counts[0]); ++c)
+      {
+        testItems(prefix,counts[c],threads[t],false);
+        testItems(prefix,counts[c],threads[t],true);
+      }
+  return prcTestResult();
+}
@@ -0,0 +1,41 @@
+// Checks shared by the tests: a failed check is reported on stderr and
+// makes the test exit with a failure status at the end.
+
+#ifndef __PRC_TEST_H
+#define __PRC_TEST_H
+
+#include <stdint.h>
+#include <iostream>
+
+static unsigned int prcTestFailures = 0;
+
+#define PRC_CHECK(condition, what) \
+  if(!(condition)) \
+  { \
+    if(++prcTestFailures <= 20) \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": " << what << std::endl; \
+  }
+
+static inline int prcTestResult()
+{
+  if(prcTestFailures != 0)
+    std::cerr << prcTestFailures << " checks failed" << std::endl;
+  return prcTestFailures == 0 ? 0 : 1;
+}
+
+// a small deterministic generator, so that failures can be reproduced
+class PRCtestRandom
+{
+  public:
+    PRCtestRandom(uint64_t seed) : state(seed) {}
+    uint32_t next()
+    {
+      state = state*6364136223846793005ULL+1442695040888963407ULL;
+      return (uint32_t)(state >> 32);
+    }
+    uint64_t next64() { const uint64_t high = next(); return high << 32 | next(); }
+  private:
+    uint64_t state;
+};
+
+#endif // __PRC_TEST_H
@@ -0,0 +1,162 @@
+// Stress test of concurrent serialization: files are written from many
+// threads at once, each of them serializing its sections, entities and
+// file structures on threads of its own, and every one must come out as
+// the same file written on a single thread. One buffer pool is shared by
+// the writers using it while another thread reads its statistics.
+
+#include "oPRCFile.h"
+#include "PRCsink.h"
+#include "prctest.h"
+
+#include <math.h>
+#include <string.h>
+#include <string>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+struct Options
+{
+  uint32_t file_structures;
+  unsigned int section_threads;
+  unsigned int entity_threads;
+  unsigned int file_structure_threads;
+  int pool; // 0 none, 1 the thread's own, 2 the shared one
+};
+
+static PRCbufferPool sharedPool;
+
+// groups of meshes, lines, compressed surfaces and primitives
+static void content(oPRCFile &file)
+{
+  PRCtestRandom random(7);
+  const PRCmaterial red(RGBAColour(0.1,0,0),RGBAColour(1,0,0),RGBAColour(0,0,0),RGBAColour(0.5,0.5,0.5),1.0,0.1);
+  const PRCmaterial blue(RGBAColour(0,0,0.1),RGBAColour(0,0,1),RGBAColour(0,0,0),RGBAColour(0.5,0.5,0.5),0.5,0.3);
+  const int n = 12;
+  std::vector<double> P(3*(n+1)*(n+1));
+  std::vector<uint32_t> I(6*n*n);
+  for(int g = 0; g < 4; ++g)
+  {
+    const double t[16] = { 1,0,0,1.5*g, 0,1,0,0, 0,0,1,0, 0,0,0,1 };
+    PRCoptions options(g == 1 ? 0.001 : 0.0, 0.0, g == 2, false);
+    file.begingroup(("group"+std::to_string(g)).c_str(),&options,t);
+    for(int i = 0; i <= n; ++i)
+      for(int j = 0; j <= n; ++j)
+      {
+        double *p = &P[3*(i*(n+1)+j)];
+        p[0] = (double)i/n; p[1] = (double)j/n;
+        p[2] = sin(3*p[0])*cos(2*p[1])+g+random.next()*1e-12;
+      }
+    for(int i = 0; i < n; ++i)
+      for(int j = 0; j < n; ++j)
+      {
+        const uint32_t a = i*(n+1)+j, b = a+1, c = a+n+1, d = c+1;
+        uint32_t *t = &I[6*(i*n+j)];
+        t[0] = a; t[1] = b; t[2] = d; t[3] = a; t[4] = d; t[5] = c;
+      }
+    const double (*points)[3] = (const double (*)[3])&P[0];
+    file.addTriangles((n+1)*(n+1),points,2*n*n,(const uint32_t (*)[3])&I[0],g & 1 ? red : blue,
+                      0,NULL,NULL,0,NULL,NULL,0,NULL,NULL,0,NULL,NULL,25.8);
+    const uint32_t lines[5] = { 4,0,1,2,3 };
+    file.addLines(5,points,5,lines,RGBAColour(0,1,0),1.5,false,0,NULL,0,NULL);
+    double patch[16][3];
+    for(int k = 0; k < 16; ++k)
+    {
+      patch[k][0] = k%4; patch[k][1] = k/4; patch[k][2] = (random.next() % 1000)/1000.0;
+    }
+    for(int k = 0; k < 40; ++k)
+    {
+      patch[5][2] = (random.next() % 1000)/1000.0;
+      file.addPatch(patch,g & 1 ? blue : red);
+    }
+    file.addSphere(0.5+g,red);
+    file.addCylinder(0.3,2,blue);
+    file.begingroup("inner");
+    file.addTorus(2,0.3,0,360,blue);
+    file.endgroup();
+    file.endgroup();
+  }
+}
+
+static std::vector<uint8_t> writeFile(const Options &options)
+{
+  PRCmemorySink sink;
+  {
+    PRCbufferPool *pool = options.pool == 1 ? &PRCbufferPool::getThreadPool() :
+                          options.pool == 2 ? &sharedPool : NULL;
+    oPRCFile file(sink,1,options.file_structures,pool);
+    // the time in the UUIDs would differ between files written in
+    // different seconds
+    for(uint32_t i = 0; i < options.file_structures; ++i)
+      file.fileStructures[i]->file_structure_uuid.id1 = 0;
+    if(options.file_structures > 1)
+      file.setFileStructurePartition(KEPRCFileStructurePartition_ByGroup);
+    file.setSectionThreads(options.section_threads);
+    file.setEntityThreads(options.entity_threads);
+    file.setFileStructureThreads(options.file_structure_threads);
+    content(file);
+    file.finish();
+  }
+  std::vector<uint8_t> data(sink.getData(),sink.getData()+sink.getSize());
+  // the time in the UUID of the file, after "PRC" and two versions
+  if(data.size() >= 19)
+    memset(&data[15],0,4);
+  return data;
+}
+
+static const Options options[] = {
+  { 1, 1, 1, 1, 0 },
+  { 1, 4, 1, 1, 1 },
+  { 1, 1, 4, 1, 2 },
+  { 1, 4, 4, 1, 1 },
+  { 3, 1, 1, 1, 0 },
+  { 3, 1, 1, 3, 2 },
+  { 3, 4, 4, 3, 2 },
+  { 3, 2, 3, 2, 1 }
+};
+static const size_t numberOfOptions = sizeof(options)/sizeof(options[0]);
+
+int main()
+{
+  // single threaded, with one and three file structures
+  const std::vector<uint8_t> expected[2] = { writeFile(options[0]), writeFile(options[4]) };
+  PRC_CHECK(expected[0] != expected[1], "the file structures make no difference")
+
+  const size_t threads = 8, files = 8;
+  std::vector<std::vector<uint8_t> > written(threads*files);
+  std::vector<std::thread> workers;
+  std::atomic<bool> done(false);
+  bool monotonic = true;
+  std::thread reader([&done,&monotonic]() {
+    size_t last = 0;
+    while(!done)
+    {
+      const size_t handed = sharedPool.getAllocations()+sharedPool.getReuses();
+      monotonic = monotonic && handed >= last && sharedPool.getDiscards() <= sharedPool.getReleases();
+      last = handed;
+      std::this_thread::yield();
+    }
+  });
+  for(size_t t = 0; t < threads; ++t)
+    workers.push_back(std::thread([t,&written]() {
+      for(size_t f = 0; f < files; ++f)
+        written[t*files+f] = writeFile(options[(t+f) % numberOfOptions]);
+    }));
+  for(size_t t = 0; t < threads; ++t)
+    workers[t].join();
+  done = true;
+  reader.join();
+  PRC_CHECK(monotonic, "the statistics of the shared pool went back")
+  PRC_CHECK(sharedPool.getAllocations()+sharedPool.getReuses() != 0, "the shared pool was not used")
+
+  for(size_t t = 0; t < threads; ++t)
+    for(size_t f = 0; f < files; ++f)
+    {
+      const Options &o = options[(t+f) % numberOfOptions];
+      PRC_CHECK(written[t*files+f] == expected[o.file_structures == 1 ? 0 : 1],
+                "thread " << t << ", file " << f << ": " << o.file_structures << " file structures, threads "
+                << o.section_threads << " " << o.entity_threads << " " << o.file_structure_threads
+                << ", pool " << o.pool << ": differs from the single threaded file")
+    }
+  return prcTestResult();
+}
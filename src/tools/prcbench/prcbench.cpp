@@ -0,0 +1,263 @@
+// Microbenchmarks of the asymptote PRC writer. Runs the named benchmarks,
+// or all of them:
+//   prcbench [name...]
+
+#include "PRCbitStream.h"
+#include "PRCbufferPool.h"
+#include "PRCcompress.h"
+#include "oPRCFile.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <cstring>
+#include <sstream>
+#include <vector>
+
+static double seconds()
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// a small deterministic generator, so that runs write the same data
+static uint32_t nextRandom(uint64_t &state)
+{
+  state = state*6364136223846793005ULL+1442695040888963407ULL;
+  return (uint32_t)(state >> 32);
+}
+
+// Integers, booleans and characters through operator<<, the bit-level
+// path every entity goes through; reports the bits written per second.
+static void benchBits()
+{
+  const size_t count = 1 << 24;
+  uint64_t state = 1;
+  std::vector<uint32_t> values(count);
+  for(size_t i = 0; i < count; ++i)
+  {
+    const uint32_t r = nextRandom(state);
+    // mostly small, as indices and counts are
+    values[i] = r >> (r & 31);
+  }
+  uint8_t *data = NULL;
+  PRCbitStream out(data,0);
+  const double start = seconds();
+  for(size_t i = 0; i < count; i += 4)
+  {
+    out << values[i] << (bool)(values[i+1] & 1) << (uint8_t)values[i+2];
+    out << (int32_t)(values[i+3]-values[i]);
+  }
+  const double time = seconds()-start;
+  const double bits = 8.0*out.getSize();
+  printf("bits      %10.0f bits in %.3f s, %.1f Mbit/s\n",bits,time,bits/time/1e6);
+}
+
+// a sphere of n x n quads
+static void sphere(uint32_t n, std::vector<double> &P, std::vector<uint32_t> &I)
+{
+  const double pi = 3.14159265358979323846;
+  P.resize(3*(n+1)*(n+1));
+  I.resize(6*n*n);
+  for(uint32_t i = 0; i <= n; ++i)
+    for(uint32_t j = 0; j <= n; ++j)
+    {
+      const double theta = pi*i/n, phi = 2*pi*j/n;
+      double *p = &P[3*(i*(n+1)+j)];
+      p[0] = sin(theta)*cos(phi); p[1] = sin(theta)*sin(phi); p[2] = cos(theta);
+    }
+  for(uint32_t i = 0; i < n; ++i)
+    for(uint32_t j = 0; j < n; ++j)
+    {
+      const uint32_t a = i*(n+1)+j, b = a+1, c = a+n+1, d = c+1;
+      uint32_t *t = &I[6*(i*n+j)];
+      t[0] = a; t[1] = b; t[2] = d; t[3] = a; t[4] = d; t[5] = c;
+    }
+}
+
+// the sphere, its points as normals
+static void addSphere(oPRCFile &file, const std::vector<double> &P, const std::vector<uint32_t> &I)
+{
+  const PRCmaterial m(RGBAColour(0.1,0.1,0.1,1),RGBAColour(1,0,0,1),RGBAColour(0.1,0.1,0.1,1),RGBAColour(0,0,0,1),1.0,0.1);
+  file.addTriangles((uint32_t)(P.size()/3),(const double (*)[3])&P[0],(uint32_t)(I.size()/3),(const uint32_t (*)[3])&I[0],m,
+                    (uint32_t)(P.size()/3),(const double (*)[3])&P[0],(const uint32_t (*)[3])&I[0],
+                    0,NULL,NULL,0,NULL,NULL,0,NULL,NULL,25.8419);
+}
+
+// the tessellation section of a file with a sphere, uncompressed
+static void sphereSection(uint32_t n, std::vector<uint8_t> &section)
+{
+  std::vector<double> P;
+  std::vector<uint32_t> I;
+  sphere(n,P,I);
+  std::ostringstream sink;
+  oPRCFile file(sink);
+  addSphere(file,P,I);
+  uint8_t *data = NULL;
+  PRCbitStream out(data,0);
+  file.fileStructures[0]->serializeFileStructureTessellation(out);
+  section.assign(out.getData(),out.getData()+out.getSize());
+}
+
+static void compressSection(const std::vector<uint8_t> &section, const PRCcompressor &compressor, int level)
+{
+  const int runs = 3;
+  uint32_t size = 0;
+  const double start = seconds();
+  for(int run = 0; run < runs; ++run)
+  {
+    uint8_t *out = NULL;
+    const bool done = compressor.compress(&section[0],(uint32_t)section.size(),out,size,level,0);
+    free(out);
+    if(!done)
+    {
+      printf("compress  %-14s level %d failed\n",compressor.getName(),level);
+      return;
+    }
+  }
+  const double time = (seconds()-start)/runs;
+  printf("compress  %-14s level %d %10u -> %10u bytes in %.3f s, %.1f MB/s\n",
+         compressor.getName(),level,(uint32_t)section.size(),size,time,section.size()/time/1e6);
+}
+
+// Deflate a real tessellation section with stock zlib and with the
+// backend selected at build time, if that is another one.
+static void benchCompress()
+{
+  std::vector<uint8_t> section;
+  sphereSection(300,section);
+  const PRCcompressor &zlib = getZlibCompressor();
+  const PRCcompressor &selected = getCompressor();
+  const int levels[] = { 1, 6, 9 };
+  for(size_t i = 0; i < sizeof(levels)/sizeof(levels[0]); ++i)
+  {
+    compressSection(section,zlib,levels[i]);
+    if(&selected != &zlib)
+      compressSection(section,selected,levels[i]);
+  }
+}
+
+// small files, as a batch export writes them, each with a few groups of
+// spheres
+static double exportFiles(size_t files, PRCbufferPool *pool)
+{
+  std::vector<double> P;
+  std::vector<uint32_t> I;
+  sphere(16,P,I);
+  const double start = seconds();
+  for(size_t i = 0; i < files; ++i)
+  {
+    std::ostringstream sink;
+    oPRCFile file(sink,1,1,pool);
+    for(int g = 0; g < 4; ++g)
+    {
+      file.begingroup("group");
+      addSphere(file,P,I);
+      file.endgroup();
+    }
+    file.finish();
+  }
+  return seconds()-start;
+}
+
+// Export many small files without a pool, with a pool keeping nothing,
+// which allocates every buffer as no pool does, and with one pool for
+// all of them; reports the buffers allocated per file.
+static void benchPool()
+{
+  const size_t files = 500;
+  exportFiles(10,NULL);
+  const double time = exportFiles(files,NULL);
+  printf("pool      no pool         %6zu files in %.3f s\n",files,time);
+  PRCbufferPool none(0,0), shared;
+  PRCbufferPool *pools[] = { &none, &shared };
+  const char *names[] = { "keeping none", "shared" };
+  for(int i = 0; i < 2; ++i)
+  {
+    const PRCbufferPool &pool = *pools[i];
+    const double time = exportFiles(files,pools[i]);
+    printf("pool      %-14s  %6zu files in %.3f s, %.2f buffers allocated and %.2f reused per file\n",
+           names[i],files,time,(double)pool.getAllocations()/files,(double)pool.getReuses()/files);
+  }
+}
+
+// A million bicubic patches in a compressed group, written as compressed
+// NURBS faces; reports the time to add them and to write the file, and
+// how much of the latter went to compressing the sections.
+static void benchNurbs()
+{
+  const uint32_t patches = 1000000;
+  const uint32_t side = 1000;
+  uint64_t state = 1;
+  std::ostringstream sink;
+  oPRCFile file(sink);
+  PRCstatistics statistics;
+  file.setStatistics(&statistics);
+  PRCoptions options(0.001);
+  file.begingroup("patches",&options);
+  const PRCmaterial m;
+  double cP[16][3];
+  const double start = seconds();
+  for(uint32_t p = 0; p < patches; ++p)
+  {
+    const double u = p%side, v = p/side;
+    for(int i = 0; i < 4; ++i)
+      for(int j = 0; j < 4; ++j)
+      {
+        cP[4*i+j][0] = u+i/3.0;
+        cP[4*i+j][1] = v+j/3.0;
+        cP[4*i+j][2] = (nextRandom(state) >> 8)*(1.0/16777216.0);
+      }
+    file.addPatch(cP,m);
+  }
+  file.endgroup();
+  const double added = seconds();
+  file.finish();
+  const double time = seconds()-added;
+  double compression = 0;
+  for(size_t i = 0; i < statistics.sections.size(); ++i)
+    compression += statistics.sections[i].compression_time;
+  printf("nurbs     %10u patches added in %.3f s, written in %.3f s (%.3f s compressing), %.0f bytes per patch\n",
+         patches,added-start,time,compression,(double)sink.tellp()/patches);
+}
+
+struct Benchmark
+{
+  const char *name;
+  void (*run)();
+};
+
+static const Benchmark benchmarks[] = {
+  { "bits", benchBits },
+  { "compress", benchCompress },
+  { "pool", benchPool },
+  { "nurbs", benchNurbs }
+};
+static const size_t numberOfBenchmarks = sizeof(benchmarks)/sizeof(benchmarks[0]);
+
+int main(int argc, char **argv)
+{
+  for(int i = 1; i < argc; ++i)
+  {
+    size_t j = 0;
+    while(j < numberOfBenchmarks && strcmp(argv[i],benchmarks[j].name) != 0)
+      ++j;
+    if(j == numberOfBenchmarks)
+    {
+      fprintf(stderr,"prcbench [name...]; names:");
+      for(j = 0; j < numberOfBenchmarks; ++j)
+        fprintf(stderr," %s",benchmarks[j].name);
+      fprintf(stderr,"\n");
+      return 1;
+    }
+  }
+  for(size_t j = 0; j < numberOfBenchmarks; ++j)
+  {
+    bool selected = argc == 1;
+    for(int i = 1; i < argc; ++i)
+      selected = selected || strcmp(argv[i],benchmarks[j].name) == 0;
+    if(selected)
+      benchmarks[j].run();
+  }
+  return 0;
+}
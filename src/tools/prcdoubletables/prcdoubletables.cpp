@@ -0,0 +1,155 @@
+// Generates PRCdoubleTables.cc, the tables of PRCdoubleTables.h, from
+// acofdoe. The build runs it for the asymptote library:
+//   prcdoubletables <build>/src/asymptote/PRCdoubleTables.cc
+
+#include "PRCdouble.h"
+#include "PRCdoubleTables.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+static uint64_t keyOf(double value)
+{
+  uint64_t k;
+  memcpy(&k,&value,sizeof(k));
+  return k & ~((uint64_t)1 << 63);
+}
+
+static PRCdoubleCodeword codeword(const sCodageOfFrequentDoubleOrExponent &cofdoe)
+{
+  const PRCdoubleCodeword code = { cofdoe.Bits, (uint8_t)cofdoe.NumberOfBits, cofdoe.Type == VT_double };
+  return code;
+}
+
+static void buildEncodeTables(std::vector<PRCdoubleExponentCode> &exponents, std::vector<PRCdoubleFrequentCode> &frequent)
+{
+  const PRCdoubleExponentCode noExponent = { codeword(acofdoe[0]), false };
+  const PRCdoubleFrequentCode noFrequent = { 0, { 0, 0, false }, false };
+  exponents.assign(PRC_DOUBLE_EXPONENTS,noExponent);
+  frequent.assign(1 << PRC_DOUBLE_FREQUENT_BITS,noFrequent);
+  for(size_t i = 0; i < NUMBEROFELEMENTINACOFDOE; )
+  {
+    const unsigned int exponent = EXPONENT(acofdoe[i].u2uod.Value);
+    size_t j = i;
+    for(; j < NUMBEROFELEMENTINACOFDOE && acofdoe[j].Type == VT_double; ++j)
+    {
+      const uint64_t key = keyOf(acofdoe[j].u2uod.Value);
+      size_t slot = prcDoubleFrequentHash(key);
+      while(frequent[slot].used)
+        slot = (slot+1) & ((1 << PRC_DOUBLE_FREQUENT_BITS)-1);
+      frequent[slot].key = key;
+      frequent[slot].code = codeword(acofdoe[j]);
+      frequent[slot].used = true;
+      exponents[exponent].frequent = true;
+    }
+    if(j == NUMBEROFELEMENTINACOFDOE)
+    {
+      fprintf(stderr,"acofdoe ends with frequent values\n");
+      exit(1);
+    }
+    exponents[exponent].code = codeword(acofdoe[j]);
+    while(i < NUMBEROFELEMENTINACOFDOE && EXPONENT(acofdoe[i].u2uod.Value) == exponent)
+      ++i;
+  }
+}
+
+static void buildDecodeTable(std::vector<PRCdoubleCode> &table)
+{
+  const PRCdoubleCode invalid = { 0, 0, 0 };
+  table.assign(1 << PRC_DOUBLE_PRIMARY_BITS,invalid);
+  // size the secondary tables for the longest code of each prefix
+  for(uint32_t i = 0; i < NUMBEROFELEMENTINACOFDOE; ++i)
+  {
+    const uint8_t length = acofdoe[i].NumberOfBits;
+    if(length > PRC_DOUBLE_PRIMARY_BITS)
+    {
+      PRCdoubleCode &primary = table[acofdoe[i].Bits >> (length-PRC_DOUBLE_PRIMARY_BITS)];
+      if(primary.secondaryBits < length-PRC_DOUBLE_PRIMARY_BITS)
+        primary.secondaryBits = length-PRC_DOUBLE_PRIMARY_BITS;
+    }
+  }
+  for(size_t i = 0; i < (1 << PRC_DOUBLE_PRIMARY_BITS); ++i)
+    if(table[i].secondaryBits != 0)
+    {
+      table[i].value = table.size();
+      table.resize(table.size() + (1 << table[i].secondaryBits), invalid);
+    }
+  // every index starting with a code decodes to it
+  for(uint32_t i = 0; i < NUMBEROFELEMENTINACOFDOE; ++i)
+  {
+    const uint8_t length = acofdoe[i].NumberOfBits;
+    const PRCdoubleCode code = { i, length, 0 };
+    size_t first, count;
+    if(length <= PRC_DOUBLE_PRIMARY_BITS)
+    {
+      first = (size_t)acofdoe[i].Bits << (PRC_DOUBLE_PRIMARY_BITS-length);
+      count = (size_t)1 << (PRC_DOUBLE_PRIMARY_BITS-length);
+    }
+    else
+    {
+      const PRCdoubleCode &primary = table[acofdoe[i].Bits >> (length-PRC_DOUBLE_PRIMARY_BITS)];
+      const uint8_t bits = length-PRC_DOUBLE_PRIMARY_BITS;
+      const uint32_t suffix = acofdoe[i].Bits & ((1 << bits)-1);
+      first = primary.value + ((size_t)suffix << (primary.secondaryBits-bits));
+      count = (size_t)1 << (primary.secondaryBits-bits);
+    }
+    for(size_t j = first; j < first+count; ++j)
+      table[j] = code;
+  }
+}
+
+static void printCodeword(FILE *out, const PRCdoubleCodeword &code)
+{
+  fprintf(out,"{0x%x,%u,%s}",code.bits,code.length,code.value ? "true" : "false");
+}
+
+int main(int argc, char **argv)
+{
+  if(argc != 2)
+  {
+    fprintf(stderr,"prcdoubletables <PRCdoubleTables.cc>\n");
+    return 1;
+  }
+  std::vector<PRCdoubleExponentCode> exponents;
+  std::vector<PRCdoubleFrequentCode> frequent;
+  std::vector<PRCdoubleCode> decode;
+  buildEncodeTables(exponents,frequent);
+  buildDecodeTable(decode);
+
+  FILE *out = fopen(argv[1],"w");
+  if(out == NULL)
+  {
+    fprintf(stderr,"Cannot write %s\n",argv[1]);
+    return 1;
+  }
+  fprintf(out,"// Generated by prcdoubletables from acofdoe, do not edit.\n\n");
+  fprintf(out,"#include \"PRCdoubleTables.h\"\n\n");
+
+  fprintf(out,"const PRCdoubleExponentCode prcDoubleExponentCodes[PRC_DOUBLE_EXPONENTS] =\n{\n");
+  for(size_t i = 0; i < exponents.size(); ++i)
+  {
+    fprintf(out,"%s{",i%4 == 0 ? "  " : " ");
+    printCodeword(out,exponents[i].code);
+    fprintf(out,",%s}%s",exponents[i].frequent ? "true" : "false",
+            i+1 == exponents.size() ? "\n" : (i%4 == 3 ? ",\n" : ","));
+  }
+  fprintf(out,"};\n\n");
+
+  fprintf(out,"const PRCdoubleFrequentCode prcDoubleFrequentCodes[1 << PRC_DOUBLE_FREQUENT_BITS] =\n{\n");
+  for(size_t i = 0; i < frequent.size(); ++i)
+  {
+    fprintf(out,"  {0x%016llxULL,",(unsigned long long)frequent[i].key);
+    printCodeword(out,frequent[i].code);
+    fprintf(out,",%s}%s\n",frequent[i].used ? "true" : "false",i+1 == frequent.size() ? "" : ",");
+  }
+  fprintf(out,"};\n\n");
+
+  fprintf(out,"const PRCdoubleCode prcDoubleDecodeTable[%u] =\n{\n",(unsigned)decode.size());
+  for(size_t i = 0; i < decode.size(); ++i)
+    fprintf(out,"%s{%u,%u,%u}%s",i%8 == 0 ? "  " : " ",decode[i].value,decode[i].length,decode[i].secondaryBits,
+            i+1 == decode.size() ? "\n" : (i%8 == 7 ? ",\n" : ","));
+  fprintf(out,"};\n");
+  fclose(out);
+  return 0;
+}